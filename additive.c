@@ -0,0 +1,128 @@
+// **********************************************************************
+//	additive.c
+//  As trilhas guardam canal - referencia (rotacoes pelo menor arco, em
+//  graus); aplicar a camada e out = base + peso * delta, canal a canal,
+//  em blocos de 4 com SSE. Somar angulos de Euler aproxima a composicao
+//  das rotacoes, o que basta para deltas pequenos como balancar os
+//  bracos sobre um andar
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "additive.h"
+#include "blend.h"
+
+// Pre-calcula as trilhas de clip em relacao a reference (um frame de
+// canais; NULL: o primeiro frame do clip). Pesos iniciais: 1 em todos os
+// canais. Retorna 0 se faltar memoria
+int additiveBuild(AdditiveLayer* l, Clip* clip, const float* reference)
+{
+    int nc = clip->numChannels;
+    size_t size = (size_t) clip->numFrames * nc;
+    l->clip = clip;
+    l->numFrames = clip->numFrames;
+    l->numChannels = nc;
+    l->delta = malloc(size * sizeof(float));
+    l->weights = malloc(nc * sizeof(float));
+    // Copia: em um clip compactado, clipFrame reaproveita o mesmo vetor
+    float* ref = malloc(nc * sizeof(float));
+    if(!l->delta || !l->weights || !ref) {
+        free(l->delta);
+        free(l->weights);
+        free(ref);
+        l->delta = l->weights = NULL;
+        return 0;
+    }
+    memcpy(ref, reference ? reference : clipFrame(clip, 0), nc * sizeof(float));
+    for(int c=0; c<nc; c++)
+        l->weights[c] = 1;
+    for(int f=0; f<l->numFrames; f++) {
+        const float* frame = clipFrame(clip, f);
+        for(int j=0; j<clip->numNodes; j++) {
+            Node* n = clip->nodes[j];
+            for(int k=0; k<n->channels; k++) {
+                int c = n->firstChannel + k;
+                float d = frame[c] - ref[c];
+                if(n->channelType[k] >= CH_XROT) {
+                    if(d > 180) d -= 360;
+                    if(d < -180) d += 360;
+                }
+                l->delta[(size_t) f * nc + c] = d;
+            }
+        }
+    }
+    free(ref);
+    memAdd(MEM_FRAMES, (long long) (size + nc) * sizeof(float));
+    return 1;
+}
+
+// A camada pode ser somada a clip (mesmo esqueleto e canais)?
+int additiveCompatible(const AdditiveLayer* l, Clip* clip)
+{
+    if(clip->numChannels != l->numChannels || !sameHierarchy(l->clip, clip))
+        return 0;
+    for(int j=0; j<clip->numNodes; j++)
+        if(clip->nodes[j]->channels != l->clip->nodes[j]->channels
+           || memcmp(clip->nodes[j]->channelType, l->clip->nodes[j]->channelType, clip->nodes[j]->channels))
+            return 0;
+    return 1;
+}
+
+// Mascara: 1 na junta joint e em seus descendentes, 0 nas demais
+// (jointWeights tem clip->numNodes posicoes). Retorna 0 se joint nao
+// existir
+int additiveMask(Clip* clip, const char* joint, float* jointWeights)
+{
+    int found = 0;
+    // Pre-ordem: o pai sempre vem antes dos filhos
+    for(int j=0; j<clip->numNodes; j++) {
+        Node* n = clip->nodes[j];
+        int in = !strcmp(n->name, joint) || (n->parent && jointWeights[n->parent->index] > 0);
+        found |= !strcmp(n->name, joint);
+        jointWeights[j] = in ? 1 : 0;
+    }
+    return found;
+}
+
+// Peso de cada canal = peso da sua junta x weight (jointWeights NULL:
+// todas as juntas com peso 1)
+void additiveSetWeights(AdditiveLayer* l, const float* jointWeights, float weight)
+{
+    Clip* clip = l->clip;
+    for(int j=0; j<clip->numNodes; j++) {
+        Node* n = clip->nodes[j];
+        float w = (jointWeights ? jointWeights[j] : 1) * weight;
+        for(int k=0; k<n->channels; k++)
+            l->weights[n->firstChannel + k] = w;
+    }
+}
+
+// out = base + pesos * delta do frame (out pode ser base)
+void additiveApply(const AdditiveLayer* l, int frame, const float* base, float* out)
+{
+    const float* d = l->delta + (size_t) frame * l->numChannels;
+    const float* w = l->weights;
+    int n = l->numChannels, c = 0;
+#ifdef __SSE__
+    for(; c+4 <= n; c+=4)
+        _mm_storeu_ps(out + c, _mm_add_ps(_mm_loadu_ps(base + c),
+                                          _mm_mul_ps(_mm_loadu_ps(w + c), _mm_loadu_ps(d + c))));
+#endif
+    for(; c<n; c++)
+        out[c] = base[c] + w[c] * d[c];
+}
+
+void additiveFree(AdditiveLayer* l)
+{
+    if(l->delta)
+        memAdd(MEM_FRAMES, -(long long) ((size_t) l->numFrames * l->numChannels + l->numChannels) * sizeof(float));
+    free(l->delta);
+    free(l->weights);
+    memset(l, 0, sizeof(AdditiveLayer));
+}
@@ -0,0 +1,29 @@
+// **********************************************************************
+//	additive.h
+//  Camadas aditivas: a diferenca de cada frame de um clip para uma pose
+//  de referencia e pre-calculada por canal (trilhas delta) e somada a
+//  outro clip do mesmo esqueleto com um peso por junta (mascara x peso),
+//  ao custo de uma multiplicacao-soma por canal
+// **********************************************************************
+
+#ifndef ADDITIVE_H
+#define ADDITIVE_H
+
+#include "bvh.h"
+
+typedef struct {
+    Clip* clip;          // clip de origem das trilhas (nao pertence a camada)
+    int numFrames;
+    int numChannels;
+    float* delta;        // numFrames x numChannels
+    float* weights;      // peso de cada canal
+} AdditiveLayer;
+
+int additiveBuild(AdditiveLayer* l, Clip* clip, const float* reference);
+int additiveCompatible(const AdditiveLayer* l, Clip* clip);
+int additiveMask(Clip* clip, const char* joint, float* jointWeights);
+void additiveSetWeights(AdditiveLayer* l, const float* jointWeights, float weight);
+void additiveApply(const AdditiveLayer* l, int frame, const float* base, float* out);
+void additiveFree(AdditiveLayer* l);
+
+#endif
@@ -0,0 +1,116 @@
+// **********************************************************************
+//	alloc.c
+//  Interceptacao de malloc/calloc/realloc/free (ligar com
+//  -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free)
+//  So as chamadas feitas pelo nosso codigo passam por aqui: alocacoes
+//  internas da libc, do OpenGL e do GLUT nao sao contadas
+// **********************************************************************
+
+#ifdef BVH_ALLOC_TRACK
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+// Contadores globais (qualquer thread pode alocar)
+static atomic_llong allocs[NUM_STAGES+1];
+static atomic_llong frees[NUM_STAGES+1];
+static atomic_llong bytes[NUM_STAGES+1];
+
+// Contagem de alocacoes no inicio do frame atual e no frame anterior
+static long long frameStart[NUM_STAGES+1];
+static int lastFrame[NUM_STAGES+1];
+
+// Etapa em andamento na thread (-1: nenhuma)
+static _Thread_local int curStage = -1;
+
+static void countAlloc(size_t size)
+{
+    int s = curStage < 0 ? ALLOC_OUTSIDE : curStage;
+    atomic_fetch_add_explicit(&allocs[s], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes[s], (long long) size, memory_order_relaxed);
+}
+
+static void countFree()
+{
+    int s = curStage < 0 ? ALLOC_OUTSIDE : curStage;
+    atomic_fetch_add_explicit(&frees[s], 1, memory_order_relaxed);
+}
+
+void* __wrap_malloc(size_t size)
+{
+    countAlloc(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    countAlloc(num * size);
+    return __real_calloc(num, size);
+}
+
+// Um realloc pode mover o bloco: conta sempre como alocacao
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    if(ptr)
+        countFree();
+    if(size)
+        countAlloc(size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr)
+{
+    if(ptr)
+        countFree();
+    __real_free(ptr);
+}
+
+void allocEnter(int stage)
+{
+    curStage = stage;
+}
+
+void allocLeave()
+{
+    curStage = -1;
+}
+
+// Guarda quantas alocacoes cada etapa fez no frame que terminou
+void allocFrameEnd()
+{
+    for(int s=0; s<=NUM_STAGES; s++) {
+        long long n = atomic_load_explicit(&allocs[s], memory_order_relaxed);
+        lastFrame[s] = (int) (n - frameStart[s]);
+        frameStart[s] = n;
+    }
+}
+
+// Total de alocacoes ate agora, em todas as etapas
+long long allocCount()
+{
+    long long n = 0;
+    for(int s=0; s<=NUM_STAGES; s++)
+        n += atomic_load_explicit(&allocs[s], memory_order_relaxed);
+    return n;
+}
+
+void allocGetStats(int stage, AllocStats* st)
+{
+    st->allocs = atomic_load_explicit(&allocs[stage], memory_order_relaxed);
+    st->frees = atomic_load_explicit(&frees[stage], memory_order_relaxed);
+    st->bytes = atomic_load_explicit(&bytes[stage], memory_order_relaxed);
+}
+
+int allocLastFrame(int stage)
+{
+    return lastFrame[stage];
+}
+
+#endif
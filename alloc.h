@@ -0,0 +1,49 @@
+// **********************************************************************
+//	alloc.h
+//  Contagem de alocacoes no heap por etapa do frame
+//  Ativa so com -DBVH_ALLOC_TRACK (builds de depuracao): malloc, calloc,
+//  realloc e free sao interceptados com --wrap do ligador GNU
+// **********************************************************************
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "perf.h"
+
+// Alocacoes fora de qualquer etapa caem neste indice
+#define ALLOC_OUTSIDE NUM_STAGES
+
+// Contadores acumulados de uma etapa
+typedef struct {
+    long long allocs;    // malloc, calloc e realloc
+    long long frees;
+    long long bytes;     // bytes pedidos
+} AllocStats;
+
+#ifdef BVH_ALLOC_TRACK
+
+void allocEnter(int stage);
+void allocLeave();
+void allocFrameEnd();
+
+long long allocCount();
+void allocGetStats(int stage, AllocStats* st);
+int allocLastFrame(int stage);
+
+#define allocAvailable()   1
+#define ALLOC_ENTER(s)     allocEnter(s)
+#define ALLOC_LEAVE()      allocLeave()
+#define ALLOC_FRAME_END()  allocFrameEnd()
+
+#else
+
+#define allocAvailable()   0
+#define allocCount()       0LL
+#define allocLastFrame(s)  0
+#define ALLOC_ENTER(s)     do {} while(0)
+#define ALLOC_LEAVE()      do {} while(0)
+#define ALLOC_FRAME_END()  do {} while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,495 @@
+// **********************************************************************
+//	arrow.c
+//  Escritor minimo do formato de arquivo IPC do Arrow:
+//    "ARROW1\0\0" | mensagem Schema | mensagens RecordBatch (+ corpo)
+//    | Footer | tamanho do Footer | "ARROW1"
+//  Os metadados sao flatbuffers, montados aqui da frente para tras: cada
+//  objeto e gravado antes dos que ele referencia e os offsets sao
+//  corrigidos quando o objeto referenciado e criado. Os buffers do
+//  corpo ficam alinhados em 64 bytes, para leitura sem copia via mmap
+// **********************************************************************
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+
+#include "arrow.h"
+
+// Valores dos enums e unions de Schema.fbs / Message.fbs / File.fbs
+#define MD_VERSION_V5      4
+#define HEADER_SCHEMA      1
+#define HEADER_RECORDBATCH 3
+#define TYPE_INT           2
+#define TYPE_FLOAT         3
+#define PRECISION_HALF     0
+#define PRECISION_SINGLE   1
+
+#define BODY_ALIGN 64
+
+// **********************************************************************
+//  Flatbuffer montado em memoria. As posicoes sao relativas ao inicio
+//  do buffer, que fica alinhado em 8 bytes no arquivo
+// **********************************************************************
+typedef struct {
+    unsigned char* data;
+    int len;
+    int cap;
+} FbBuf;
+
+// Campo de uma tabela: escalar de 1, 2, 4 ou 8 bytes, ou offset (4)
+typedef struct {
+    int id;              // indice do campo no .fbs
+    int size;
+    long long value;
+    int pos;             // posicao no buffer, preenchida por fbTable()
+} FbField;
+
+// Campos por tabela (o maior schema usado tem 6)
+#define FB_MAX_FIELDS 16
+
+// Acrescenta n bytes zerados e retorna a posicao do primeiro
+static int fbReserve(FbBuf* b, int n)
+{
+    if(b->len + n > b->cap) {
+        while(b->len + n > b->cap)
+            b->cap = b->cap ? b->cap*2 : 1024;
+        b->data = realloc(b->data, b->cap);
+    }
+    int pos = b->len;
+    memset(b->data + pos, 0, n);
+    b->len += n;
+    return pos;
+}
+
+static void fbPad(FbBuf* b, int align)
+{
+    if(b->len % align)
+        fbReserve(b, align - b->len % align);
+}
+
+static void fbSet(FbBuf* b, int pos, long long value, int size)
+{
+    // Little-endian, como o proprio formato
+    for(int i=0; i<size; i++)
+        b->data[pos+i] = (unsigned char) (value >> (8*i));
+}
+
+// Faz o offset gravado em 'at' apontar para 'target' (sempre adiante)
+static void fbPatch(FbBuf* b, int at, int target)
+{
+    fbSet(b, at, target - at, 4);
+}
+
+// **********************************************************************
+//  Grava a vtable e a tabela com os campos dados. Os campos sao
+//  dispostos do maior para o menor, logo apos o soffset da vtable,
+//  e a tabela e posicionada de modo que os de 8 bytes fiquem alinhados
+//  Retorna a posicao da tabela
+// **********************************************************************
+static int fbTable(FbBuf* b, FbField* f, int n)
+{
+    int maxId = -1, has8 = 0, size = 4;
+    int offs[FB_MAX_FIELDS] = { 0 };
+    assert(n <= FB_MAX_FIELDS);
+    for(int i=0; i<n; i++) {
+        assert(f[i].size == 1 || f[i].size == 2 || f[i].size == 4 || f[i].size == 8);
+        if(f[i].id > maxId)
+            maxId = f[i].id;
+        has8 |= f[i].size == 8;
+    }
+    for(int s=8; s>=1; s/=2)
+        for(int i=0; i<n; i++)
+            if(f[i].size == s) {
+                offs[i] = size;
+                size += s;
+            }
+
+    fbPad(b, 2);
+    int vsize = 4 + 2*(maxId+1);
+    int vt = fbReserve(b, vsize);
+    fbSet(b, vt, vsize, 2);
+    fbSet(b, vt+2, size, 2);
+    for(int i=0; i<n; i++)
+        fbSet(b, vt + 4 + 2*f[i].id, offs[i], 2);
+
+    while(b->len % 4 || (has8 && b->len % 8 != 4))
+        fbReserve(b, 1);
+    int t = fbReserve(b, size);
+    fbSet(b, t, t - vt, 4);
+    for(int i=0; i<n; i++) {
+        f[i].pos = t + offs[i];
+        fbSet(b, f[i].pos, f[i].value, f[i].size);
+    }
+    return t;
+}
+
+// Vetor de escalares ou structs (elems pode ser NULL: zerado)
+static int fbVector(FbBuf* b, const void* elems, int count, int elemSize, int align)
+{
+    if(align < 4)
+        align = 4;
+    while((b->len + 4) % align)
+        fbReserve(b, 1);
+    int v = fbReserve(b, 4);
+    fbSet(b, v, count, 4);
+    int e = fbReserve(b, count * elemSize);
+    if(elems)
+        memcpy(b->data + e, elems, count * elemSize);
+    return v;
+}
+
+static int fbString(FbBuf* b, const char* str)
+{
+    int len = (int) strlen(str);
+    fbPad(b, 4);
+    int v = fbReserve(b, 4 + len + 1);
+    fbSet(b, v, len, 4);
+    memcpy(b->data + v + 4, str, len);
+    return v;
+}
+
+// **********************************************************************
+//  Colunas exportadas
+// **********************************************************************
+enum { COL_FRAME, COL_LOCAL, COL_WORLD };
+
+typedef struct {
+    char name[48];
+    int kind;
+    int index;           // canal no frame (COL_LOCAL) ou nodo*3+eixo
+    float scale;         // ARROW_Q16
+    float offset;
+} Column;
+
+static int columnBytes(Column* c, int encoding)
+{
+    if(c->kind == COL_FRAME)
+        return 4;
+    return encoding == ARROW_F32 ? 4 : 2;
+}
+
+// KeyValue { key, value }
+static int fbKeyValue(FbBuf* b, const char* key, const char* value)
+{
+    FbField kv[2] = { { 0, 4, 0, 0 }, { 1, 4, 0, 0 } };
+    int t = fbTable(b, kv, 2);
+    fbPatch(b, kv[0].pos, fbString(b, key));
+    fbPatch(b, kv[1].pos, fbString(b, value));
+    return t;
+}
+
+// Field { name, nullable, type_type, type, children, custom_metadata }
+static int fbColumn(FbBuf* b, Column* c, int encoding)
+{
+    int isInt = c->kind == COL_FRAME || encoding == ARROW_Q16;
+    int quant = c->kind != COL_FRAME && encoding == ARROW_Q16;
+    FbField f[6] = {
+        { 0, 4, 0, 0 },                                  // name
+        { 1, 1, 0, 0 },                                  // nullable
+        { 2, 1, isInt ? TYPE_INT : TYPE_FLOAT, 0 },      // type_type
+        { 3, 4, 0, 0 },                                  // type
+        { 5, 4, 0, 0 },                                  // children
+        { 6, 4, 0, 0 },                                  // custom_metadata
+    };
+    int t = fbTable(b, f, quant ? 6 : 5);
+    fbPatch(b, f[0].pos, fbString(b, c->name));
+    if(isInt) {
+        FbField it[2] = { { 0, 4, c->kind == COL_FRAME ? 32 : 16, 0 }, { 1, 1, 1, 0 } };
+        fbPatch(b, f[3].pos, fbTable(b, it, 2));
+    }
+    else {
+        FbField fp[1] = { { 0, 2, encoding == ARROW_F16 ? PRECISION_HALF : PRECISION_SINGLE, 0 } };
+        fbPatch(b, f[3].pos, fbTable(b, fp, 1));
+    }
+    fbPatch(b, f[4].pos, fbVector(b, NULL, 0, 4, 4));
+    if(quant) {
+        char scale[32], offset[32];
+        snprintf(scale, sizeof(scale), "%.9g", c->scale);
+        snprintf(offset, sizeof(offset), "%.9g", c->offset);
+        int v = fbVector(b, NULL, 2, 4, 4);
+        fbPatch(b, f[5].pos, v);
+        fbPatch(b, v+4, fbKeyValue(b, "scale", scale));
+        fbPatch(b, v+8, fbKeyValue(b, "offset", offset));
+    }
+    return t;
+}
+
+// Schema { endianness, fields }
+static int fbSchema(FbBuf* b, Column* cols, int numCols, int encoding)
+{
+    FbField s[2] = { { 0, 2, 0, 0 }, { 1, 4, 0, 0 } };
+    int t = fbTable(b, s, 2);
+    int v = fbVector(b, NULL, numCols, 4, 4);
+    fbPatch(b, s[1].pos, v);
+    for(int i=0; i<numCols; i++)
+        fbPatch(b, v + 4 + 4*i, fbColumn(b, &cols[i], encoding));
+    return t;
+}
+
+// Message { version, header_type, header, bodyLength }; retorna a
+// posicao do campo header, a ser corrigida por quem chamou
+static int fbMessage(FbBuf* b, int headerType, long long bodyLength)
+{
+    int root = fbReserve(b, 4);
+    FbField m[4] = {
+        { 0, 2, MD_VERSION_V5, 0 },
+        { 1, 1, headerType, 0 },
+        { 2, 4, 0, 0 },
+        { 3, 8, bodyLength, 0 },
+    };
+    fbPatch(b, root, fbTable(b, m, 4));
+    return m[2].pos;
+}
+
+// **********************************************************************
+//  Arquivo: grava os metadados encapsulados (marcador de continuacao,
+//  tamanho e flatbuffer, completado ate o fim ficar alinhado em align)
+//  Retorna os bytes gravados
+// **********************************************************************
+typedef struct {
+    FILE* fp;
+    long long pos;
+    int ok;
+} ArrowFile;
+
+static void fileWrite(ArrowFile* f, const void* data, long long n)
+{
+    if(n > 0 && fwrite(data, 1, n, f->fp) != (size_t) n)
+        f->ok = 0;
+    f->pos += n;
+}
+
+static void filePad(ArrowFile* f, int align)
+{
+    static const unsigned char zeros[BODY_ALIGN] = { 0 };
+    if(f->pos % align)
+        fileWrite(f, zeros, align - f->pos % align);
+}
+
+static int writeMessage(ArrowFile* f, FbBuf* b, int align)
+{
+    unsigned char prefix[8];
+    // Completa o flatbuffer para o que vem depois (corpo) ficar alinhado
+    fbPad(b, 8);
+    while((f->pos + 8 + b->len) % align)
+        fbReserve(b, 8);
+    memset(prefix, 0xff, 4);
+    for(int i=0; i<4; i++)
+        prefix[4+i] = (unsigned char) (b->len >> (8*i));
+    fileWrite(f, prefix, 8);
+    fileWrite(f, b->data, b->len);
+    return 8 + b->len;
+}
+
+// Valor da coluna no frame f; pos: posicoes globais do frame (3 por nodo)
+static float columnValue(Clip* clip, Column* c, int f, const float* pos)
+{
+    if(c->kind == COL_LOCAL)
+        return clipFrame(clip, f)[c->index];
+    return pos[c->index];
+}
+
+// FK do frame f, guardando so as posicoes globais
+static void framePositions(Clip* clip, int f, float* world, float* pos)
+{
+    forwardKinematicsSimd(clip, clipFrame(clip, f), world);
+    for(int j=0; j<clip->numNodes; j++)
+        memcpy(pos + j*3, world + j*16 + 12, 3 * sizeof(float));
+}
+
+// Monta a lista de colunas: frame, canais locais e posicoes globais
+static Column* buildColumns(Clip* clip, int* numCols)
+{
+    static const char axes[3] = { 'x', 'y', 'z' };
+    Column* cols = calloc(1 + clip->numChannels + 3 * clip->numNodes, sizeof(Column));
+    int n = 0;
+    snprintf(cols[n].name, sizeof(cols[n].name), "frame");
+    cols[n++].kind = COL_FRAME;
+    for(int j=0; j<clip->numNodes; j++) {
+        Node* node = clip->nodes[j];
+        for(int c=0; c<node->channels; c++) {
+            snprintf(cols[n].name, sizeof(cols[n].name), "%s.%s", node->name, channelName(node->channelType[c]));
+            cols[n].kind = COL_LOCAL;
+            cols[n++].index = node->firstChannel + c;
+        }
+    }
+    for(int j=0; j<clip->numNodes; j++)
+        for(int a=0; a<3; a++) {
+            snprintf(cols[n].name, sizeof(cols[n].name), "%s.world_%c", clip->nodes[j]->name, axes[a]);
+            cols[n].kind = COL_WORLD;
+            cols[n++].index = j*3 + a;
+        }
+    *numCols = n;
+    return cols;
+}
+
+// Faixa de cada coluna sobre o clip todo (passada extra, so para Q16)
+static void computeRanges(Clip* clip, Column* cols, int numCols, float* world, float* pos)
+{
+    float* lo = malloc(numCols * sizeof(float));
+    float* hi = malloc(numCols * sizeof(float));
+    for(int i=0; i<numCols; i++) {
+        lo[i] = FLT_MAX;
+        hi[i] = -FLT_MAX;
+    }
+    for(int f=0; f<clip->numFrames; f++) {
+        framePositions(clip, f, world, pos);
+        for(int i=1; i<numCols; i++) {
+            float v = columnValue(clip, &cols[i], f, pos);
+            if(v < lo[i]) lo[i] = v;
+            if(v > hi[i]) hi[i] = v;
+        }
+    }
+    for(int i=1; i<numCols; i++) {
+        if(clip->numFrames == 0)
+            lo[i] = hi[i] = 0;
+        cols[i].scale = hi[i] > lo[i] ? (hi[i] - lo[i]) / 65535.0f : 1;
+        cols[i].offset = lo[i] + 32768.0f * cols[i].scale;
+    }
+    free(hi);
+    free(lo);
+}
+
+// **********************************************************************
+//  Grava o clip (frames em memoria) em fp, a partir do inicio do
+//  arquivo. As posicoes globais sao calculadas a cada batch de
+//  ARROW_BATCH frames. Retorna 0 em erro
+// **********************************************************************
+int writeArrow(FILE* fp, Clip* clip, int encoding)
+{
+    int numCols;
+    Column* cols = buildColumns(clip, &numCols);
+    int batchRows = clip->numFrames < ARROW_BATCH ? clip->numFrames : ARROW_BATCH;
+    if(batchRows < 1)
+        batchRows = 1;
+    float* world = malloc(clip->numNodes * 16 * sizeof(float));
+    float* pos = malloc((size_t) batchRows * clip->numNodes * 3 * sizeof(float));
+    unsigned char* colData = malloc((size_t) batchRows * 4);
+    int numBatches = (clip->numFrames + ARROW_BATCH - 1) / ARROW_BATCH;
+    long long* blocks = calloc(numBatches > 0 ? numBatches : 1, 3 * sizeof(long long));
+    FbBuf b = { NULL, 0, 0 };
+
+    if(encoding == ARROW_Q16)
+        computeRanges(clip, cols, numCols, world, pos);
+
+    ArrowFile f = { fp, 0, 1 };
+    fileWrite(&f, "ARROW1\0\0", 8);
+
+    b.len = 0;
+    int header = fbMessage(&b, HEADER_SCHEMA, 0);
+    fbPatch(&b, header, fbSchema(&b, cols, numCols, encoding));
+    writeMessage(&f, &b, 8);
+
+    for(int batch=0; batch<numBatches; batch++) {
+        int first = batch * ARROW_BATCH;
+        int rows = clip->numFrames - first < ARROW_BATCH ? clip->numFrames - first : ARROW_BATCH;
+
+        // Corpo: por coluna, um buffer de validade vazio (sem nulos) e
+        // os valores, cada um comecando em multiplo de BODY_ALIGN
+        long long* nodes = malloc(numCols * 2 * sizeof(long long));
+        long long* buffers = malloc(numCols * 4 * sizeof(long long));
+        long long body = 0;
+        for(int i=0; i<numCols; i++) {
+            long long len = (long long) rows * columnBytes(&cols[i], encoding);
+            nodes[i*2] = rows;
+            nodes[i*2+1] = 0;
+            buffers[i*4] = body;
+            buffers[i*4+1] = 0;
+            buffers[i*4+2] = body;
+            buffers[i*4+3] = len;
+            body += (len + BODY_ALIGN - 1) / BODY_ALIGN * BODY_ALIGN;
+        }
+
+        // RecordBatch { length, nodes, buffers }
+        b.len = 0;
+        header = fbMessage(&b, HEADER_RECORDBATCH, body);
+        FbField rb[3] = { { 0, 8, rows, 0 }, { 1, 4, 0, 0 }, { 2, 4, 0, 0 } };
+        fbPatch(&b, header, fbTable(&b, rb, 3));
+        fbPatch(&b, rb[1].pos, fbVector(&b, nodes, numCols, 16, 8));
+        fbPatch(&b, rb[2].pos, fbVector(&b, buffers, numCols * 2, 16, 8));
+        free(buffers);
+        free(nodes);
+
+        filePad(&f, 8);
+        blocks[batch*3] = f.pos;
+        blocks[batch*3+1] = writeMessage(&f, &b, BODY_ALIGN);
+        blocks[batch*3+2] = body;
+
+        for(int r=0; r<rows; r++)
+            framePositions(clip, first + r, world, pos + (size_t) r * clip->numNodes * 3);
+
+        long long start = f.pos;
+        for(int i=0; i<numCols; i++) {
+            Column* c = &cols[i];
+            for(int r=0; r<rows; r++) {
+                const float* p = pos + (size_t) r * clip->numNodes * 3;
+                if(c->kind == COL_FRAME) {
+                    int32_t v = first + r;
+                    memcpy(colData + r*4, &v, 4);
+                    continue;
+                }
+                float v = columnValue(clip, c, first + r, p);
+                if(encoding == ARROW_F32)
+                    memcpy(colData + r*4, &v, 4);
+                else if(encoding == ARROW_F16) {
+                    uint16_t h = floatToHalf(v);
+                    memcpy(colData + r*2, &h, 2);
+                }
+                else {
+                    float q = roundf((v - c->offset) / c->scale);
+                    int16_t s = (int16_t) (q < -32768 ? -32768 : q > 32767 ? 32767 : q);
+                    memcpy(colData + r*2, &s, 2);
+                }
+            }
+            fileWrite(&f, colData, (long long) rows * columnBytes(c, encoding));
+            filePad(&f, BODY_ALIGN);
+        }
+        if(f.pos - start != body)
+            f.ok = 0;
+    }
+
+    // Footer { version, schema, dictionaries, recordBatches }
+    // Block { offset: long, metaDataLength: int, bodyLength: long }
+    b.len = 0;
+    int root = fbReserve(&b, 4);
+    FbField ft[4] = { { 0, 2, MD_VERSION_V5, 0 }, { 1, 4, 0, 0 }, { 2, 4, 0, 0 }, { 3, 4, 0, 0 } };
+    fbPatch(&b, root, fbTable(&b, ft, 4));
+    fbPatch(&b, ft[1].pos, fbSchema(&b, cols, numCols, encoding));
+    fbPatch(&b, ft[2].pos, fbVector(&b, NULL, 0, 24, 8));
+    int v = fbVector(&b, NULL, numBatches, 24, 8);
+    fbPatch(&b, ft[3].pos, v);
+    for(int i=0; i<numBatches; i++) {
+        fbSet(&b, v + 4 + i*24, blocks[i*3], 8);
+        fbSet(&b, v + 4 + i*24 + 8, blocks[i*3+1], 4);
+        fbSet(&b, v + 4 + i*24 + 16, blocks[i*3+2], 8);
+    }
+    filePad(&f, 8);
+    fileWrite(&f, b.data, b.len);
+    unsigned char len[4];
+    for(int i=0; i<4; i++)
+        len[i] = (unsigned char) (b.len >> (8*i));
+    fileWrite(&f, len, 4);
+    fileWrite(&f, "ARROW1", 6);
+
+    free(b.data);
+    free(blocks);
+    free(colData);
+    free(pos);
+    free(world);
+    free(cols);
+    return f.ok;
+}
+
+int saveArrow(Clip* clip, const char* fileName, int encoding)
+{
+    FILE* fp = fopen(fileName, "wb");
+    if(!fp)
+        return 0;
+    int ok = writeArrow(fp, clip, encoding) && !ferror(fp);
+    ok = !fclose(fp) && ok;
+    return ok;
+}
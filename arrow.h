@@ -0,0 +1,27 @@
+// **********************************************************************
+//	arrow.h
+//  Exportacao de um clip em colunas no formato de arquivo IPC do Apache
+//  Arrow (.arrow), sem depender da biblioteca: uma coluna por canal
+//  local de cada junta e uma por coordenada da posicao global (FK)
+// **********************************************************************
+
+#ifndef ARROW_H
+#define ARROW_H
+
+#include "bvh.h"
+
+// Codificacao das colunas de valores
+typedef enum {
+    ARROW_F32,     // float32
+    ARROW_F16,     // float16 (meia precisao)
+    ARROW_Q16      // int16 quantizado: valor = q * scale + offset, com
+                   // scale e offset nos metadados de cada campo
+} ArrowEncoding;
+
+// Frames por record batch
+#define ARROW_BATCH 16384
+
+int writeArrow(FILE* fp, Clip* clip, int encoding);
+int saveArrow(Clip* clip, const char* fileName, int encoding);
+
+#endif
@@ -0,0 +1,983 @@
+// **********************************************************************
+//	bench.c
+//  Benchmarks de leitura, cache binario, apply, FK, montagem dos
+//  vertices dos ossos, transicao entre clips (crossfade), arvore de blend
+//  (andar/correr pela velocidade, misturado a outro clip), camada aditiva
+//  (bracos balancando sobre o andar), formato compactado, leitura por
+//  janela mapeada do cache binario e busca de poses (motion matching:
+//  kd-tree contra forca bruta) sobre todos os arquivos de um diretorio
+//  (bvh/)
+//  Roda sem janela (nao usa GLUT)
+//
+//  Uso: bvh_bench [-d dir] [-w warmup] [-i iteracoes] [-f filtro] [-o saida.json]
+//                 [-b referencia.json [-t limite%] [-T limites.txt] [-a alfa]] [-p] [-z]
+//                 [-s f32|f16|q16]
+//
+//  Com -s, os frames ficam na memoria em float16 ou em 16 bits
+//  quantizados, e a economia e o erro de cada clip sao impressos
+//
+//  Com -p, tambem mede contadores de hardware (ciclos, instrucoes, falhas
+//  de cache L1D/LLC e de desvio) e reporta IPC e falhas por item
+//
+//  Com -b, compara com a execucao de referencia e imprime a tabela de
+//  diferencas; sai com status 3 se houver regressao significativa
+//
+//  Com -z, em vez dos benchmarks, verifica que a reproducao em regime
+//  (avancar o frame, apply, FK e vertices dos ossos) nao faz nenhuma
+//  alocacao no heap; sai com status 4 se fizer. Requer BVH_ALLOC_TRACK
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "additive.h"
+#include "alloc.h"
+#include "bvh.h"
+#include "benchcmp.h"
+#include "blend.h"
+#include "blendtree.h"
+#include "clipmap.h"
+#include "compress.h"
+#include "hwcount.h"
+#include "match.h"
+#include "timer.h"
+
+// Repeticoes de cada micro-benchmark por iteracao
+#define MICRO_REPS 1000
+
+// Consultas de motion matching por iteracao
+#define MATCH_QUERIES 256
+
+typedef struct {
+    const char* name;
+    void (*run)();       // executa uma iteracao
+    const char* unit;    // unidade de 'items'
+} Benchmark;
+
+// Corpus carregado
+static char** files;
+static char** caches;
+static char** compressed;   // .bvhz de cada clip
+static Clip** clips;
+static int numFiles;
+static long totalFrames;
+
+// Buffers de trabalho (dimensionados para o maior clip)
+static float** worlds;   // FK de todos os frames de cada clip
+static float* world;
+static float* verts;
+
+// Indice de motion matching e consultas (frames do corpus com ruido)
+static MatchDb* matchDb;
+
+// Transicao do primeiro clip para outro do mesmo esqueleto
+#define FADE_FRAMES 30
+static Crossfade fade;
+
+// Arvore de blend de exemplo e seus parametros
+enum { PARAM_SPEED, PARAM_ARMS };
+static BlendProgram* tree;
+
+// Camada aditiva (bracos, da Spine1 para cima) sobre o andar
+static AdditiveLayer layer;
+static Clip* layerBase;
+static float* layered;
+static float* matchQueries;
+
+// Caches abertos por janela mapeada, pequena para a janela mudar
+// varias vezes em cada clip do corpus
+#define BENCH_MAP_WINDOW (16 << 10)
+static Clip** mapped;
+
+// Primeiro clip compactado (decodificacao de um frame)
+static CompressedClip* zClip;
+static Pose zPose;
+
+// Usado para o compilador nao descartar resultados
+static volatile float sink;
+
+static long items;       // items processados na ultima iteracao
+
+static int useCounters;  // contadores de hardware disponiveis (-p)
+
+static int storage = FRAMES_F32;   // formato dos frames na memoria (-s)
+
+// **********************************************************************
+//  Macro-benchmarks: uma passada por todo o corpus
+// **********************************************************************
+static void benchParse()
+{
+    for(int i=0; i<numFiles; i++) {
+        Clip* c = loadBvh(files[i]);
+        sink += c->frames[0];
+        freeClip(c);
+    }
+    items = numFiles;
+}
+
+static void benchCacheLoad()
+{
+    for(int i=0; i<numFiles; i++) {
+        Clip* c = loadClipCache(caches[i]);
+        sink += c->frames[0];
+        freeClip(c);
+    }
+    items = numFiles;
+}
+
+// Leitura do formato compactado (sem decodificar)
+static void benchCompressedLoad()
+{
+    for(int i=0; i<numFiles; i++) {
+        CompressedClip* z = loadCompressed(compressed[i]);
+        sink += z->data[0];
+        freeCompressed(z);
+    }
+    items = numFiles;
+}
+
+// Leitura e decodificacao de todos os frames em poses
+static void benchCompressedDecode()
+{
+    for(int i=0; i<numFiles; i++) {
+        CompressedClip* z = loadCompressed(compressed[i]);
+        Pose p;
+        poseInit(&p, z->clip->numNodes);
+        for(int f=0; f<z->clip->numFrames; f++)
+            compressedPose(z, f, &p);
+        sink += p.pos[0];
+        poseFree(&p);
+        freeCompressed(z);
+    }
+    items = totalFrames;
+}
+
+// Reproducao de cada cache mapeado do inicio ao fim
+static void benchMapPlay()
+{
+    for(int i=0; i<numFiles; i++)
+        for(int f=0; f<mapped[i]->numFrames; f++)
+            sink += clipFrame(mapped[i], f)[0];
+    items = totalFrames;
+}
+
+// Do fim ao inicio (voltar a timeline)
+static void benchMapScrub()
+{
+    for(int i=0; i<numFiles; i++)
+        for(int f=mapped[i]->numFrames-1; f>=0; f--)
+            sink += clipFrame(mapped[i], f)[0];
+    items = totalFrames;
+}
+
+static void benchApply()
+{
+    for(int i=0; i<numFiles; i++)
+        for(int f=0; f<clips[i]->numFrames; f++)
+            applyFrame(clips[i], f);
+    sink += clips[0]->root->channelData[0];
+    items = totalFrames;
+}
+
+static void benchFk()
+{
+    for(int i=0; i<numFiles; i++)
+        for(int f=0; f<clips[i]->numFrames; f++)
+            forwardKinematics(clips[i], clipFrame(clips[i], f), world);
+    sink += world[12];
+    items = totalFrames;
+}
+
+static void benchFkSimd()
+{
+    for(int i=0; i<numFiles; i++)
+        for(int f=0; f<clips[i]->numFrames; f++)
+            forwardKinematicsSimd(clips[i], clipFrame(clips[i], f), world);
+    sink += world[12];
+    items = totalFrames;
+}
+
+static void benchBones()
+{
+    for(int i=0; i<numFiles; i++) {
+        int stride = clips[i]->numNodes * 16;
+        for(int f=0; f<clips[i]->numFrames; f++)
+            buildBoneVertices(clips[i], worlds[i] + (size_t) f * stride, verts);
+    }
+    sink += verts[0];
+    items = totalFrames;
+}
+
+// **********************************************************************
+//  Micro-benchmarks: a mesma operacao repetida sobre um unico frame
+//  (dados quentes na cache), no primeiro clip do corpus
+// **********************************************************************
+static void benchApplyFrame()
+{
+    for(int r=0; r<MICRO_REPS; r++)
+        applyFrame(clips[0], r % clips[0]->numFrames);
+    sink += clips[0]->root->channelData[0];
+    items = MICRO_REPS;
+}
+
+static void benchFkFrame()
+{
+    const float* frame = clipFrame(clips[0], 0);
+    for(int r=0; r<MICRO_REPS; r++)
+        forwardKinematics(clips[0], frame, world);
+    sink += world[12];
+    items = MICRO_REPS;
+}
+
+static void benchFkSimdFrame()
+{
+    const float* frame = clipFrame(clips[0], 0);
+    for(int r=0; r<MICRO_REPS; r++)
+        forwardKinematicsSimd(clips[0], frame, world);
+    sink += world[12];
+    items = MICRO_REPS;
+}
+
+static void benchBonesFrame()
+{
+    for(int r=0; r<MICRO_REPS; r++)
+        buildBoneVertices(clips[0], worlds[0], verts);
+    sink += verts[0];
+    items = MICRO_REPS;
+}
+
+// Um frame da transicao: as duas poses, slerp por junta e FK
+static void benchCrossfade()
+{
+    for(int r=0; r<MICRO_REPS; r++) {
+        fade.step = r % FADE_FRAMES;
+        crossfadeEval(&fade, world);
+    }
+    sink += world[12];
+    items = MICRO_REPS;
+}
+
+// Um frame da arvore: parametros variando, avanco das fases e programa
+static void benchBlendTree()
+{
+    for(int r=0; r<MICRO_REPS; r++) {
+        btSetParam(tree, PARAM_SPEED, (r % 100) / 99.0f);
+        btSetParam(tree, PARAM_ARMS, 0.5f);
+        btUpdate(tree, 1 / 60.0f);
+        btEval(tree, world);
+    }
+    sink += world[12];
+    items = MICRO_REPS;
+}
+
+// Um frame do clip base com a camada somada
+static void benchAdditive()
+{
+    for(int r=0; r<MICRO_REPS; r++)
+        additiveApply(&layer, r % layer.numFrames, clipFrame(layerBase, r % layerBase->numFrames), layered);
+    sink += layered[0];
+    items = MICRO_REPS;
+}
+
+// Um frame qualquer do clip compactado (saltos entre blocos)
+static void benchCompressedFrame()
+{
+    int frames = zClip->clip->numFrames;
+    for(int r=0; r<MICRO_REPS; r++)
+        compressedPose(zClip, (r * 37) % frames, &zPose);
+    sink += zPose.pos[0];
+    items = MICRO_REPS;
+}
+
+// **********************************************************************
+//  Motion matching: as mesmas consultas pela kd-tree e por forca bruta
+// **********************************************************************
+static void benchMatchKd()
+{
+    float d;
+    for(int q=0; q<MATCH_QUERIES; q++)
+        matchNearest(matchDb, matchQueries + q * MATCH_DIMS, &d);
+    sink += d;
+    items = MATCH_QUERIES;
+}
+
+static void benchMatchBrute()
+{
+    float d;
+    for(int q=0; q<MATCH_QUERIES; q++)
+        matchNearestBrute(matchDb, matchQueries + q * MATCH_DIMS, &d);
+    sink += d;
+    items = MATCH_QUERIES;
+}
+
+static Benchmark benchmarks[] = {
+    { "macro/parse_text",   benchParse,       "files" },
+    { "macro/cache_load",   benchCacheLoad,   "files" },
+    { "macro/z_load",       benchCompressedLoad,   "files" },
+    { "macro/z_decode",     benchCompressedDecode, "frames" },
+    { "macro/map_play",     benchMapPlay,     "frames" },
+    { "macro/map_scrub",    benchMapScrub,    "frames" },
+    { "macro/apply",        benchApply,       "frames" },
+    { "macro/fk_scalar",    benchFk,          "frames" },
+    { "macro/fk_simd",      benchFkSimd,      "frames" },
+    { "macro/bone_verts",   benchBones,       "frames" },
+    { "micro/apply_frame",  benchApplyFrame,  "frames" },
+    { "micro/fk_scalar",    benchFkFrame,     "frames" },
+    { "micro/fk_simd",      benchFkSimdFrame, "frames" },
+    { "micro/bone_verts",   benchBonesFrame,  "frames" },
+    { "micro/crossfade",    benchCrossfade,   "frames" },
+    { "micro/blend_tree",   benchBlendTree,   "frames" },
+    { "micro/additive",     benchAdditive,    "frames" },
+    { "micro/z_decode",     benchCompressedFrame,  "frames" },
+    { "match/kdtree",       benchMatchKd,     "queries" },
+    { "match/brute",        benchMatchBrute,  "queries" },
+};
+#define NUM_BENCHMARKS ((int) (sizeof(benchmarks) / sizeof(benchmarks[0])))
+
+// **********************************************************************
+//  Reproduz cada clip do corpus do inicio ao fim como o visualizador,
+//  depois de alguns frames de aquecimento, contando as alocacoes.
+//  Retorna quantos clips alocaram
+// **********************************************************************
+static int checkAllocations(int warmup)
+{
+    int failed = 0;
+    for(int i=0; i<numFiles; i++) {
+        Clip* clip = clips[i];
+        int cur = 0;
+        for(int f=0; f<warmup+clip->numFrames; f++) {
+            if(f == warmup)
+                ALLOC_ENTER(STAGE_FRAME);
+            long long before = allocCount();
+            cur = (cur + 1) % clip->numFrames;
+            applyFrame(clip, cur);
+            forwardKinematics(clip, clipFrame(clip, cur), world);
+            forwardKinematicsSimd(clip, clipFrame(clip, cur), world);
+            buildBoneVertices(clip, world, verts);
+            long long n = allocCount() - before;
+            if(f >= warmup && n > 0) {
+                fprintf(stderr, "%s: %lld alocacao(oes) no frame %d\n", files[i], n, cur);
+                failed++;
+                break;
+            }
+        }
+        ALLOC_LEAVE();
+    }
+    return failed;
+}
+
+// **********************************************************************
+//  Preparacao do corpus
+// **********************************************************************
+static int cmpString(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Lista os arquivos .bvh de dir, em ordem alfabetica
+static int listFiles(const char* dir)
+{
+    DIR* d = opendir(dir);
+    if(!d)
+        return 0;
+    int cap = 0;
+    struct dirent* e;
+    while((e = readdir(d))) {
+        size_t len = strlen(e->d_name);
+        if(len < 4 || strcmp(e->d_name + len - 4, ".bvh"))
+            continue;
+        if(numFiles == cap) {
+            cap = cap ? cap*2 : 64;
+            files = realloc(files, cap * sizeof(char*));
+        }
+        files[numFiles] = malloc(strlen(dir) + len + 2);
+        sprintf(files[numFiles++], "%s/%s", dir, e->d_name);
+    }
+    closedir(d);
+    qsort(files, numFiles, sizeof(char*), cmpString);
+    return numFiles;
+}
+
+// Indexa o corpus para motion matching e sorteia as consultas: frames
+// espalhados pelo corpus, com ruido gaussiano repetivel (desvio 0.1)
+// somado as caracteristicas normalizadas, como a pose corrente e a
+// trajetoria pedida durante a reproducao. Confere a kd-tree com a forca
+// bruta
+static int buildMatchIndex()
+{
+    double t0 = timerNow();
+    matchDb = matchBuild(clips, numFiles);
+    double elapsed = timerNow() - t0;
+    if(matchDb->numRows == 0) {
+        fprintf(stderr, "bvh_bench: nenhum clip com as juntas do motion matching\n");
+        return 0;
+    }
+
+    unsigned int seed = 1;
+    matchQueries = malloc(MATCH_QUERIES * MATCH_DIMS * sizeof(float));
+    for(int q=0; q<MATCH_QUERIES; q++) {
+        float* dst = matchQueries + q * MATCH_DIMS;
+        int row = (int) ((long long) q * matchDb->numRows / MATCH_QUERIES);
+        memcpy(dst, matchDb->features + (size_t) row * MATCH_DIMS, MATCH_DIMS * sizeof(float));
+        for(int d=0; d<MATCH_USED; d++) {
+            seed = seed * 1103515245 + 12345;
+            float u = ((seed >> 8) + 1) / 16777217.0f;
+            seed = seed * 1103515245 + 12345;
+            float v = (seed >> 8) / 16777216.0f;
+            dst[d] += 0.1f * sqrtf(-2 * logf(u)) * cosf(6.2831853f * v);
+        }
+    }
+
+    int wrong = 0;
+    for(int q=0; q<MATCH_QUERIES; q++) {
+        float dk, db;
+        matchNearest(matchDb, matchQueries + q * MATCH_DIMS, &dk);
+        matchNearestBrute(matchDb, matchQueries + q * MATCH_DIMS, &db);
+        wrong += dk != db;
+    }
+    fprintf(stderr, "motion matching: %d frames x %d dimensoes, %d nos, indexado em %.1f ms\n",
+            matchDb->numRows, MATCH_USED, matchDb->numNodes, elapsed);
+    if(wrong) {
+        fprintf(stderr, "bvh_bench: kd-tree difere da forca bruta em %d de %d consultas\n",
+                wrong, MATCH_QUERIES);
+        return 0;
+    }
+    return 1;
+}
+
+// Prepara a transicao do primeiro clip para o proximo de mesmo esqueleto
+// (ou para ele mesmo) e confere os extremos com a FK: no inicio a pose e
+// a do clip de origem, no fim a do destino alinhado
+static int prepareCrossfade()
+{
+    Clip* to = clips[0];
+    for(int i=1; i<numFiles; i++)
+        if(sameHierarchy(clips[0], clips[i])) {
+            to = clips[i];
+            break;
+        }
+    RootAlign none;
+    rootAlignIdentity(&none);
+    int fromFrame = clips[0]->numFrames / 2;
+    crossfadeStart(&fade, clips[0], fromFrame, &none, to, 0, FADE_FRAMES);
+
+    int n = to->numNodes * 16;
+    float* ref = malloc(n * sizeof(float));
+    float err = 0;
+    for(int end=0; end<2; end++) {
+        fade.step = end ? FADE_FRAMES : 0;
+        crossfadeEval(&fade, world);
+        if(end) {
+            forwardKinematics(to, clipFrame(to, 0), ref);
+            alignWorld(&fade.toAlign, to->numNodes, ref);
+        }
+        else
+            forwardKinematics(clips[0], clipFrame(clips[0], fromFrame), ref);
+        for(int k=0; k<n; k++)
+            err = fmaxf(err, fabsf(world[k] - ref[k]));
+    }
+    free(ref);
+    if(err > 1e-2f) {
+        fprintf(stderr, "bvh_bench: crossfade difere da FK (%g)\n", err);
+        return 0;
+    }
+    return 1;
+}
+
+// Clip do corpus cujo nome contem name (ou o primeiro)
+static Clip* findClip(const char* name)
+{
+    for(int i=0; i<numFiles; i++)
+        if(strstr(files[i], name))
+            return clips[i];
+    return clips[0];
+}
+
+// Arvore de exemplo: espaco de blend andar (0) / correr (1) pela
+// velocidade, com a camada dos bracos balancando da Spine1 para cima
+// (precisa de prepareAdditive)
+static int prepareBlendTree()
+{
+    Clip* space[2] = { findClip("_B3_Walk."), findClip("_C03_Run.") };
+    float positions[2] = { 0, 1 };
+    float* mask = malloc(layer.clip->numNodes * sizeof(float));
+    BlendNode* root = btAdditive(btBlendSpace(PARAM_SPEED, space, positions, 2), &layer,
+                                 additiveMask(layer.clip, "Spine1", mask) ? mask : NULL, PARAM_ARMS);
+    free(mask);
+    char err[128];
+    tree = btCompile(root, err, sizeof(err));
+    btFreeNode(root);
+    if(!tree) {
+        fprintf(stderr, "bvh_bench: arvore de blend: %s\n", err);
+        return 0;
+    }
+    fprintf(stderr, "arvore de blend: %d operacoes, %d poses\n", btNumOps(tree), btNumRegs(tree));
+    return 1;
+}
+
+// Camada de exemplo: bracos balancando, da Spine1 para cima, sobre o
+// andar (ou sobre o proprio clip, se os esqueletos forem diferentes)
+static int prepareAdditive()
+{
+    Clip* arms = findClip("_A3_SwingArms.");
+    layerBase = findClip("_B3_Walk.");
+    if(!additiveBuild(&layer, arms, NULL))
+        return 0;
+    if(!additiveCompatible(&layer, layerBase))
+        layerBase = arms;
+    float* mask = malloc(arms->numNodes * sizeof(float));
+    additiveSetWeights(&layer, additiveMask(arms, "Spine1", mask) ? mask : NULL, 1);
+    free(mask);
+    layered = malloc(arms->numChannels * sizeof(float));
+    return 1;
+}
+
+// Le de volta os clips compactados e compara a FK das poses
+// decodificadas com a dos frames originais (maior distancia entre as
+// posicoes globais de uma junta)
+static int checkCompressed()
+{
+    long long raw = 0, packed = 0;
+    float err = 0;
+    for(int i=0; i<numFiles; i++) {
+        CompressedClip* z = loadCompressed(compressed[i]);
+        if(!z)
+            return 0;
+        Pose p;
+        int stride = clips[i]->numNodes * 16;
+        poseInit(&p, z->clip->numNodes);
+        for(int f=0; f<z->clip->numFrames; f++) {
+            compressedPose(z, f, &p);
+            poseWorld(z->clip, &p, world);
+            const float* ref = worlds[i] + (size_t) f * stride;
+            for(int j=0; j<clips[i]->numNodes; j++) {
+                float d = 0;
+                for(int x=12; x<15; x++)
+                    d += (world[j*16+x] - ref[j*16+x]) * (world[j*16+x] - ref[j*16+x]);
+                err = fmaxf(err, sqrtf(d));
+            }
+        }
+        poseFree(&p);
+        raw += (long long) clips[i]->numFrames * clips[i]->numChannels * sizeof(float);
+        packed += compressedBytes(z);
+        if(i == 0)
+            zClip = z;
+        else
+            freeCompressed(z);
+    }
+    poseInit(&zPose, zClip->clip->numNodes);
+    fprintf(stderr, "compactado: %.1f MB -> %.1f MB (%.1fx), erro maximo %.3f\n",
+            raw / 1048576.0, packed / 1048576.0, (double) raw / packed, err);
+    return 1;
+}
+
+// Abre os caches por janela mapeada e confere os frames com os do clip
+// para frente, para tras e aos saltos
+static int openMapped()
+{
+    long long remaps = 0;
+    mapped = calloc(numFiles, sizeof(Clip*));
+    for(int i=0; i<numFiles; i++) {
+        Clip* clip = clips[i];
+        int frames = clip->numFrames, wrong = 0;
+        size_t bytes = clip->numChannels * sizeof(float);
+        if(!(mapped[i] = loadClipMapped(caches[i], BENCH_MAP_WINDOW)))
+            return 0;
+        for(int f=0; f<frames; f++)
+            wrong += memcmp(clipFrame(mapped[i], f), clipFrame(clip, f), bytes) != 0;
+        remaps += mapRemaps(mapped[i]->map);
+        for(int f=frames-1; f>=0; f--)
+            wrong += memcmp(clipFrame(mapped[i], f), clipFrame(clip, f), bytes) != 0;
+        for(int k=0; k<frames; k++) {
+            int f = (int) ((long long) k * 7919 % frames);
+            wrong += memcmp(clipFrame(mapped[i], f), clipFrame(clip, f), bytes) != 0;
+        }
+        if(wrong) {
+            fprintf(stderr, "bvh_bench: %s mapeado difere em %d frames\n", caches[i], wrong);
+            return 0;
+        }
+    }
+    fprintf(stderr, "cache mapeado: janela de %d KB, %lld janelas em uma passada pelo corpus\n",
+            BENCH_MAP_WINDOW >> 10, remaps);
+    return 1;
+}
+
+// Converte os frames de cada clip para o formato de -s e imprime a
+// memoria dos frames antes e depois, o maior erro de um canal (unidades
+// ou graus) e o da posicao de uma junta pela FK
+static int prepareStorage()
+{
+    long long before = 0, after = 0;
+    float maxChannel = 0, maxJoint = 0;
+    for(int i=0; i<numFiles; i++) {
+        Clip* clip = clips[i];
+        int nc = clip->numChannels, stride = clip->numNodes * 16;
+        float* original = malloc((size_t) clip->numFrames * nc * sizeof(float));
+        for(int f=0; f<clip->numFrames; f++)
+            memcpy(original + (size_t) f * nc, clipFrame(clip, f), nc * sizeof(float));
+        long long bytes[NUM_MEM], old;
+        clipMemory(clip, bytes);
+        old = bytes[MEM_FRAMES];
+        if(!clipSetStorage(clip, storage)) {
+            fprintf(stderr, "bvh_bench: erro ao converter %s\n", files[i]);
+            free(original);
+            return 0;
+        }
+        clipMemory(clip, bytes);
+        float errChannel = 0, errJoint = 0;
+        for(int f=0; f<clip->numFrames; f++) {
+            const float* frame = clipFrame(clip, f);
+            for(int c=0; c<nc; c++)
+                errChannel = fmaxf(errChannel, fabsf(frame[c] - original[(size_t) f * nc + c]));
+            forwardKinematicsSimd(clip, frame, world);
+            const float* ref = worlds[i] + (size_t) f * stride;
+            for(int j=0; j<clip->numNodes; j++) {
+                float d = 0;
+                for(int x=12; x<15; x++)
+                    d += (world[j*16+x] - ref[j*16+x]) * (world[j*16+x] - ref[j*16+x]);
+                errJoint = fmaxf(errJoint, sqrtf(d));
+            }
+        }
+        free(original);
+        fprintf(stderr, "%s: %.1f KB -> %.1f KB, erro %.4f no canal, %.4f na junta\n",
+                files[i], old / 1024.0, bytes[MEM_FRAMES] / 1024.0, errChannel, errJoint);
+        before += old;
+        after += bytes[MEM_FRAMES];
+        maxChannel = fmaxf(maxChannel, errChannel);
+        maxJoint = fmaxf(maxJoint, errJoint);
+    }
+    fprintf(stderr, "frames: %.2f MB -> %.2f MB, erro maximo %.4f no canal, %.4f na junta\n",
+            before / 1048576.0, after / 1048576.0, maxChannel, maxJoint);
+    return 1;
+}
+
+// Carrega o corpus como o visualizador (sem os canais constantes na
+// matriz de frames), grava os caches binarios e pre-calcula a FK
+static int loadCorpus(const char* cacheDir)
+{
+    int maxNodes = 0, channels = 0, removed = 0, minRemoved = 0, maxRemoved = 0;
+    long long before = 0, after = 0;
+    clips = calloc(numFiles, sizeof(Clip*));
+    caches = calloc(numFiles, sizeof(char*));
+    compressed = calloc(numFiles, sizeof(char*));
+    worlds = calloc(numFiles, sizeof(float*));
+    for(int i=0; i<numFiles; i++) {
+        clips[i] = loadBvh(files[i]);
+        if(!clips[i] || clips[i]->numFrames == 0) {
+            fprintf(stderr, "bvh_bench: erro em %s\n", files[i]);
+            return 0;
+        }
+        long long bytes[NUM_MEM];
+        clipMemory(clips[i], bytes);
+        before += bytes[MEM_FRAMES];
+        int k = clipPackChannels(clips[i]);
+        clipMemory(clips[i], bytes);
+        after += bytes[MEM_FRAMES];
+        channels += clips[i]->numChannels;
+        removed += k;
+        minRemoved = i == 0 || k < minRemoved ? k : minRemoved;
+        maxRemoved = k > maxRemoved ? k : maxRemoved;
+        caches[i] = malloc(strlen(cacheDir) + 32);
+        sprintf(caches[i], "%s/%d.bvhc", cacheDir, i);
+        if(!saveClipCache(clips[i], caches[i])) {
+            fprintf(stderr, "bvh_bench: erro ao gravar %s\n", caches[i]);
+            return 0;
+        }
+        compressed[i] = malloc(strlen(cacheDir) + 32);
+        sprintf(compressed[i], "%s/%d.bvhz", cacheDir, i);
+        if(!saveCompressed(clips[i], compressed[i])) {
+            fprintf(stderr, "bvh_bench: erro ao gravar %s\n", compressed[i]);
+            return 0;
+        }
+        totalFrames += clips[i]->numFrames;
+        if(clips[i]->numNodes > maxNodes)
+            maxNodes = clips[i]->numNodes;
+
+        int stride = clips[i]->numNodes * 16;
+        worlds[i] = malloc((size_t) clips[i]->numFrames * stride * sizeof(float));
+        for(int f=0; f<clips[i]->numFrames; f++)
+            forwardKinematics(clips[i], clipFrame(clips[i], f), worlds[i] + (size_t) f * stride);
+    }
+    world = malloc(maxNodes * 16 * sizeof(float));
+    verts = malloc(maxNodes * 6 * sizeof(float));
+    fprintf(stderr, "canais constantes: %d de %d (%d a %d por clip), frames %.2f MB -> %.2f MB\n",
+            removed, channels, minRemoved, maxRemoved, before / 1048576.0, after / 1048576.0);
+    if(!openMapped() || (storage != FRAMES_F32 && !prepareStorage()))
+        return 0;
+    return checkCompressed() && prepareCrossfade() && prepareAdditive() && prepareBlendTree()
+        && buildMatchIndex();
+}
+
+static void freeCorpus()
+{
+    for(int i=0; i<numFiles; i++) {
+        if(mapped)
+            freeClip(mapped[i]);
+        if(caches && caches[i])
+            remove(caches[i]);
+        free(caches ? caches[i] : NULL);
+        if(compressed && compressed[i])
+            remove(compressed[i]);
+        free(compressed ? compressed[i] : NULL);
+        free(files[i]);
+        if(clips) {
+            free(worlds[i]);
+            freeClip(clips[i]);
+        }
+    }
+    free(caches);
+    free(compressed);
+    free(mapped);
+    free(files);
+    free(worlds);
+    free(clips);
+    free(world);
+    free(verts);
+    crossfadeFree(&fade);
+    btFree(tree);
+    additiveFree(&layer);
+    free(layered);
+    matchFree(matchDb);
+    free(matchQueries);
+    freeCompressed(zClip);
+    poseFree(&zPose);
+}
+
+// **********************************************************************
+//  Execucao e estatisticas
+// **********************************************************************
+static int cmpDouble(const void* a, const void* b)
+{
+    double da = *(const double*) a;
+    double db = *(const double*) b;
+    return (da > db) - (da < db);
+}
+
+// Roda o benchmark, guarda as amostras em res e grava o resultado
+// (JSON, uma linha) em out, se houver
+static void runBenchmark(Benchmark* b, int warmup, int iterations, BenchSamples* res, FILE* out, int first)
+{
+    double* samples = malloc(iterations * sizeof(double));
+    double* sorted = malloc(iterations * sizeof(double));
+
+    for(int i=0; i<warmup; i++)
+        b->run();
+    long long hw[NUM_HW_COUNTERS];
+    if(useCounters)
+        hwStart();
+    for(int i=0; i<iterations; i++) {
+        double t0 = timerNow();
+        b->run();
+        samples[i] = timerNow() - t0;
+    }
+    if(useCounters) {
+        hwStop();
+        hwRead(hw);
+    }
+
+    double mean = 0, var = 0;
+    for(int i=0; i<iterations; i++)
+        mean += samples[i];
+    mean /= iterations;
+    for(int i=0; i<iterations; i++)
+        var += (samples[i] - mean) * (samples[i] - mean);
+    double stddev = iterations > 1 ? sqrt(var / (iterations - 1)) : 0;
+    memcpy(sorted, samples, iterations * sizeof(double));
+    qsort(sorted, iterations, sizeof(double), cmpDouble);
+    double median = iterations % 2 ? sorted[iterations/2]
+        : (sorted[iterations/2 - 1] + sorted[iterations/2]) / 2;
+    double minimum = sorted[0];
+    double nsPerItem = median * 1e6 / items;
+
+    fprintf(stderr, "%-20s median %9.3f ms  min %9.3f ms  stddev %7.3f ms  %10.1f ns/%s\n",
+            b->name, median, minimum, stddev, nsPerItem, b->unit);
+
+    // Contadores totais das iteracoes medidas, divididos por item
+    double perItem[NUM_HW_COUNTERS] = { 0 };
+    double ipc = -1;
+    if(useCounters) {
+        for(int c=0; c<NUM_HW_COUNTERS; c++)
+            perItem[c] = hw[c] >= 0 ? (double) hw[c] / ((double) iterations * items) : -1;
+        if(hw[HW_CYCLES] > 0 && hw[HW_INSTRUCTIONS] >= 0)
+            ipc = (double) hw[HW_INSTRUCTIONS] / hw[HW_CYCLES];
+        fprintf(stderr, "%-20s IPC %5.2f  por %s: L1D %8.1f  LLC %7.2f  desvios %7.2f\n", "",
+                ipc, b->unit, perItem[HW_L1D_MISSES], perItem[HW_LLC_MISSES], perItem[HW_BRANCH_MISSES]);
+    }
+
+    snprintf(res->name, sizeof(res->name), "%s", b->name);
+    res->samples = samples;
+    res->numSamples = iterations;
+    free(sorted);
+    if(!out)
+        return;
+
+    fprintf(out, "%s{\"name\":\"%s\",\"unit\":\"ms\",\"iterations\":%d,\"items\":%ld,\"item\":\"%s\","
+            "\"median\":%.6f,\"min\":%.6f,\"mean\":%.6f,\"stddev\":%.6f,\"ns_per_item\":%.3f,",
+            first ? "" : ",\n", b->name, iterations, items, b->unit,
+            median, minimum, mean, stddev, nsPerItem);
+    if(useCounters) {
+        fprintf(out, "\"counters\":{");
+        for(int c=0; c<NUM_HW_COUNTERS; c++)
+            if(hw[c] >= 0)
+                fprintf(out, "\"%s\":%lld,\"%s_per_item\":%.3f,", hwName(c), hw[c], hwName(c), perItem[c]);
+        fprintf(out, "\"ipc\":%.3f},", ipc);
+    }
+    fprintf(out, "\"samples\":[");
+    for(int i=0; i<iterations; i++)
+        fprintf(out, "%s%.6f", i ? "," : "", samples[i]);
+    fprintf(out, "]}");
+}
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvh_bench [-d dir] [-w warmup] [-i iteracoes] [-f filtro] [-o saida.json]\n"
+                    "                 [-b referencia.json [-t limite%%] [-T limites.txt] [-a alfa]] [-p] [-z]\n"
+                    "                 [-s f32|f16|q16]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* dir = "bvh";
+    const char* filter = NULL;
+    const char* outName = NULL;
+    const char* baseName = NULL;
+    int warmup = 2, iterations = 10;
+    CompareOptions cmp = { 0.05, 5.0, NULL, 0 };
+    int allocCheck = 0;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-p")) {
+            useCounters = 1;
+            continue;
+        }
+        if(!strcmp(argv[i], "-z")) {
+            allocCheck = 1;
+            continue;
+        }
+        if(i+1 >= argc)
+            usage();
+        if(!strcmp(argv[i], "-d"))
+            dir = argv[++i];
+        else if(!strcmp(argv[i], "-w"))
+            warmup = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-i"))
+            iterations = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-f"))
+            filter = argv[++i];
+        else if(!strcmp(argv[i], "-o"))
+            outName = argv[++i];
+        else if(!strcmp(argv[i], "-b"))
+            baseName = argv[++i];
+        else if(!strcmp(argv[i], "-t"))
+            cmp.defaultPct = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-a"))
+            cmp.alpha = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-s")) {
+            const char* e = argv[++i];
+            if(!strcmp(e, "f32")) storage = FRAMES_F32;
+            else if(!strcmp(e, "f16")) storage = FRAMES_F16;
+            else if(!strcmp(e, "q16")) storage = FRAMES_Q16;
+            else usage();
+        }
+        else if(!strcmp(argv[i], "-T")) {
+            if(!loadThresholds(argv[++i], &cmp)) {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else
+            usage();
+    }
+    if(iterations < 1 || warmup < 0)
+        usage();
+    if(allocCheck && !allocAvailable()) {
+        fprintf(stderr, "bvh_bench: -z requer compilar com BVH_ALLOC_TRACK\n");
+        return 2;
+    }
+
+    BenchSamples* base = NULL;
+    int numBase = 0;
+    if(baseName && (numBase = loadBenchResults(baseName, &base)) < 0) {
+        perror(baseName);
+        return 1;
+    }
+
+    if(!listFiles(dir)) {
+        fprintf(stderr, "bvh_bench: nenhum arquivo .bvh em %s\n", dir);
+        return 1;
+    }
+    char cacheDir[] = "/tmp/bvh_bench.XXXXXX";
+    if(!mkdtemp(cacheDir)) {
+        perror("bvh_bench");
+        return 1;
+    }
+    int ok = loadCorpus(cacheDir);
+    if(allocCheck) {
+        int failed = ok ? checkAllocations(warmup) : 0;
+        if(ok)
+            fprintf(stderr, "%d arquivos, %ld frames: %d clip(s) alocaram em regime\n",
+                    numFiles, totalFrames, failed);
+        freeCorpus();
+        rmdir(cacheDir);
+        freeBenchResults(base, numBase);
+        free(cmp.thresholds);
+        return !ok ? 1 : failed ? 4 : 0;
+    }
+    if(useCounters) {
+        int n = hwOpen();
+        if(n == 0) {
+            fprintf(stderr, "bvh_bench: contadores de hardware indisponiveis, medindo so o tempo\n");
+            useCounters = 0;
+        }
+        else if(n < NUM_HW_COUNTERS)
+            fprintf(stderr, "bvh_bench: %d de %d contadores de hardware disponiveis\n", n, NUM_HW_COUNTERS);
+    }
+    int regressions = 0;
+    // Na comparacao, o JSON so e gravado se pedido com -o
+    FILE* out = baseName ? NULL : stdout;
+    if(ok && outName && !(out = fopen(outName, "w"))) {
+        perror(outName);
+        ok = 0;
+    }
+    if(ok) {
+        BenchSamples* cur = calloc(NUM_BENCHMARKS, sizeof(BenchSamples));
+        int numCur = 0;
+        fprintf(stderr, "%d arquivos, %ld frames, %d iteracoes (+%d de aquecimento)\n",
+                numFiles, totalFrames, iterations, warmup);
+        if(out)
+            fprintf(out, "{\"corpus\":\"%s\",\"files\":%d,\"frames\":%ld,\"benchmarks\":[\n",
+                    dir, numFiles, totalFrames);
+        for(int b=0; b<NUM_BENCHMARKS; b++) {
+            if(filter && !strstr(benchmarks[b].name, filter))
+                continue;
+            runBenchmark(&benchmarks[b], warmup, iterations, &cur[numCur], out, numCur == 0);
+            numCur++;
+        }
+        if(out) {
+            fprintf(out, "\n]}\n");
+            if(out != stdout)
+                fclose(out);
+        }
+        if(baseName) {
+            regressions = compareBench(base, numBase, cur, numCur, &cmp, stdout);
+            printf("%d regressao(oes) (alfa %.3f, limite padrao %.1f%%)\n",
+                   regressions, cmp.alpha, cmp.defaultPct);
+        }
+        freeBenchResults(cur, numCur);
+    }
+    hwClose();
+    freeCorpus();
+    rmdir(cacheDir);
+    freeBenchResults(base, numBase);
+    free(cmp.thresholds);
+    if(!ok)
+        return 1;
+    return regressions ? 3 : 0;
+}
@@ -0,0 +1,234 @@
+// **********************************************************************
+//	benchcmp.c
+//  Le um arquivo de resultados do bvh_bench (referencia), compara as
+//  amostras de cada benchmark com as da execucao atual pelo teste de
+//  Mann-Whitney e aponta as regressoes significativas
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "benchcmp.h"
+
+// **********************************************************************
+//  Leitura do JSON gerado pelo bvh_bench (um benchmark por linha)
+//  Retorna a quantidade de benchmarks, ou -1 em caso de erro
+// **********************************************************************
+int loadBenchResults(const char* fileName, BenchSamples** results)
+{
+    FILE* fp = fopen(fileName, "r");
+    if(!fp)
+        return -1;
+
+    int num = 0, cap = 0;
+    size_t lineCap = 0;
+    char* line = NULL;
+    *results = NULL;
+    while(getline(&line, &lineCap, fp) > 0) {
+        char* p = strstr(line, "\"name\":\"");
+        char* s = strstr(line, "\"samples\":[");
+        if(!p || !s)
+            continue;
+        if(num == cap) {
+            cap = cap ? cap*2 : 16;
+            *results = realloc(*results, cap * sizeof(BenchSamples));
+        }
+        BenchSamples* r = &(*results)[num++];
+        p += 8;
+        int n = 0;
+        while(*p && *p != '"' && n < BENCH_NAME-1)
+            r->name[n++] = *p++;
+        r->name[n] = 0;
+
+        // Conta e le os valores da lista de amostras
+        s += 11;
+        int count = 1;
+        for(char* c = s; *c && *c != ']'; c++)
+            if(*c == ',')
+                count++;
+        r->samples = malloc(count * sizeof(double));
+        r->numSamples = 0;
+        while(*s && *s != ']') {
+            char* end;
+            double v = strtod(s, &end);
+            if(end == s)
+                break;
+            r->samples[r->numSamples++] = v;
+            s = end;
+            if(*s == ',')
+                s++;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return num;
+}
+
+void freeBenchResults(BenchSamples* results, int num)
+{
+    for(int i=0; i<num; i++)
+        free(results[i].samples);
+    free(results);
+}
+
+// **********************************************************************
+//  Limites por benchmark: uma linha "nome porcentagem" por benchmark,
+//  '#' inicia comentario. Retorna 0 se o arquivo nao pode ser lido
+// **********************************************************************
+int loadThresholds(const char* fileName, CompareOptions* opt)
+{
+    char line[256], name[BENCH_NAME];
+    double pct;
+    FILE* fp = fopen(fileName, "r");
+    if(!fp)
+        return 0;
+    while(fgets(line, sizeof(line), fp)) {
+        char* hash = strchr(line, '#');
+        if(hash)
+            *hash = 0;
+        if(sscanf(line, "%63s %lf", name, &pct) != 2)
+            continue;
+        opt->thresholds = realloc(opt->thresholds, (opt->numThresholds+1) * sizeof(BenchThreshold));
+        strcpy(opt->thresholds[opt->numThresholds].name, name);
+        opt->thresholds[opt->numThresholds++].pct = pct;
+    }
+    fclose(fp);
+    return 1;
+}
+
+static double thresholdFor(CompareOptions* opt, const char* name)
+{
+    for(int i=0; i<opt->numThresholds; i++)
+        if(!strcmp(opt->thresholds[i].name, name))
+            return opt->thresholds[i].pct;
+    return opt->defaultPct;
+}
+
+// **********************************************************************
+//  Teste de Mann-Whitney (aproximacao normal, com correcao de empates
+//  e de continuidade). Retorna o p-valor unilateral da hipotese de que
+//  as amostras de b tendem a ser maiores que as de a
+// **********************************************************************
+typedef struct {
+    double v;
+    int group;
+} Ranked;
+
+static int cmpRanked(const void* x, const void* y)
+{
+    double a = ((const Ranked*) x)->v, b = ((const Ranked*) y)->v;
+    return (a > b) - (a < b);
+}
+
+double mannWhitneyGreater(const double* a, int na, const double* b, int nb)
+{
+    int n = na + nb;
+    if(na == 0 || nb == 0)
+        return 1;
+    Ranked* all = malloc(n * sizeof(Ranked));
+    for(int i=0; i<na; i++) {
+        all[i].v = a[i];
+        all[i].group = 0;
+    }
+    for(int i=0; i<nb; i++) {
+        all[na+i].v = b[i];
+        all[na+i].group = 1;
+    }
+    qsort(all, n, sizeof(Ranked), cmpRanked);
+
+    // Soma dos postos de b (empates recebem o posto medio)
+    double rankSum = 0, ties = 0;
+    for(int i=0; i<n; ) {
+        int j = i;
+        while(j < n && all[j].v == all[i].v)
+            j++;
+        double rank = (i + 1 + j) / 2.0;
+        for(int k=i; k<j; k++)
+            if(all[k].group)
+                rankSum += rank;
+        double t = j - i;
+        ties += t*t*t - t;
+        i = j;
+    }
+    free(all);
+
+    double u = rankSum - nb * (nb + 1) / 2.0;
+    double mu = na * (double) nb / 2.0;
+    double var = na * (double) nb / 12.0 * ((n + 1) - ties / ((double) n * (n - 1)));
+    if(var <= 0)
+        return 1;
+    double z = (u - mu - 0.5) / sqrt(var);
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+static double median(const double* v, int n)
+{
+    double* s = malloc(n * sizeof(double));
+    memcpy(s, v, n * sizeof(double));
+    // insercao: poucas amostras
+    for(int i=1; i<n; i++)
+        for(int j=i; j>0 && s[j-1] > s[j]; j--) {
+            double t = s[j]; s[j] = s[j-1]; s[j-1] = t;
+        }
+    double m = n % 2 ? s[n/2] : (s[n/2-1] + s[n/2]) / 2;
+    free(s);
+    return m;
+}
+
+// **********************************************************************
+//  Imprime a tabela de diferencas entre base e cur
+//  Um benchmark regrediu se a mediana subiu mais que o seu limite e o
+//  teste indica aumento com p < alpha. Retorna o total de regressoes
+// **********************************************************************
+int compareBench(BenchSamples* base, int numBase, BenchSamples* cur, int numCur,
+                 CompareOptions* opt, FILE* out)
+{
+    int regressions = 0;
+    fprintf(out, "%-22s %12s %12s %9s %9s %7s  %s\n",
+            "benchmark", "base (ms)", "atual (ms)", "delta", "p", "limite", "status");
+    for(int i=0; i<numCur; i++) {
+        BenchSamples* c = &cur[i];
+        BenchSamples* b = NULL;
+        for(int j=0; j<numBase && !b; j++)
+            if(!strcmp(base[j].name, c->name))
+                b = &base[j];
+        double mc = median(c->samples, c->numSamples);
+        if(!b || b->numSamples == 0) {
+            fprintf(out, "%-22s %12s %12.3f %9s %9s %7s  novo\n", c->name, "-", mc, "-", "-", "-");
+            continue;
+        }
+
+        double mb = median(b->samples, b->numSamples);
+        double delta = mb > 0 ? (mc - mb) / mb * 100 : 0;
+        double limit = thresholdFor(opt, c->name);
+        double pSlower = mannWhitneyGreater(b->samples, b->numSamples, c->samples, c->numSamples);
+        double pFaster = mannWhitneyGreater(c->samples, c->numSamples, b->samples, b->numSamples);
+        const char* status = "ok";
+        double p = pSlower;
+        if(delta > limit && pSlower < opt->alpha) {
+            status = "REGRESSAO";
+            regressions++;
+        }
+        else if(delta < -limit && pFaster < opt->alpha) {
+            status = "melhora";
+            p = pFaster;
+        }
+        else if(delta < 0)
+            p = pFaster;
+        fprintf(out, "%-22s %12.3f %12.3f %+8.1f%% %9.4f %6.1f%%  %s\n",
+                c->name, mb, mc, delta, p, limit, status);
+    }
+    for(int j=0; j<numBase; j++) {
+        int found = 0;
+        for(int i=0; i<numCur && !found; i++)
+            found = !strcmp(base[j].name, cur[i].name);
+        if(!found)
+            fprintf(out, "%-22s %12.3f %12s %9s %9s %7s  ausente\n", base[j].name,
+                    median(base[j].samples, base[j].numSamples), "-", "-", "-", "-");
+    }
+    return regressions;
+}
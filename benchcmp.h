@@ -0,0 +1,40 @@
+// **********************************************************************
+//	benchcmp.h
+//  Comparacao de resultados do bvh_bench com uma execucao de referencia
+// **********************************************************************
+
+#ifndef BENCHCMP_H
+#define BENCHCMP_H
+
+#include <stdio.h>
+
+#define BENCH_NAME 64
+
+// Amostras (ms por iteracao) de um benchmark
+typedef struct {
+    char name[BENCH_NAME];
+    double* samples;
+    int numSamples;
+} BenchSamples;
+
+// Limite de regressao (aumento da mediana, em %) por benchmark
+typedef struct {
+    char name[BENCH_NAME];
+    double pct;
+} BenchThreshold;
+
+typedef struct {
+    double alpha;              // nivel de significancia do teste
+    double defaultPct;         // limite para quem nao esta na tabela
+    BenchThreshold* thresholds;
+    int numThresholds;
+} CompareOptions;
+
+int loadBenchResults(const char* fileName, BenchSamples** results);
+void freeBenchResults(BenchSamples* results, int num);
+int loadThresholds(const char* fileName, CompareOptions* opt);
+double mannWhitneyGreater(const double* a, int na, const double* b, int nb);
+int compareBench(BenchSamples* base, int numBase, BenchSamples* cur, int numCur,
+                 CompareOptions* opt, FILE* out);
+
+#endif
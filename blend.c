@@ -0,0 +1,387 @@
+// **********************************************************************
+//	blend.c
+//  Convencoes iguais as da FK de bvh.c: rotacao local = produto das
+//  rotacoes dos canais na ordem do arquivo, e canais de posicao
+//  substituem o offset. Matrizes 4x4 por colunas
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "blend.h"
+
+#define DEG2RAD 0.017453292519943295f
+
+// **********************************************************************
+//  Quaternios (x, y, z, w)
+// **********************************************************************
+
+// c = a * b (c pode ser a ou b)
+static void quatMult(const float* a, const float* b, float* c)
+{
+    float x = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+    float y = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+    float z = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+    float w = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+    c[0] = x; c[1] = y; c[2] = z; c[3] = w;
+}
+
+// Direcao (angulo em torno de y) do eixo z local da rotacao q
+static float quatHeading(const float* q)
+{
+    float x = 2 * (q[0]*q[2] + q[3]*q[1]);
+    float z = 1 - 2 * (q[0]*q[0] + q[1]*q[1]);
+    return atan2f(x, z);
+}
+
+// Slerp de a ate b (quaternios unitarios) por w; q pode ser a ou b
+static void quatSlerp(const float* a, const float* b, float w, float* q)
+{
+    float d = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+    // Menor arco: q e -q sao a mesma rotacao
+    float sign = d < 0 ? -1.0f : 1.0f;
+    d *= sign;
+    float s0, s1;
+    if(d > 0.9995f) {
+        // Quase iguais: interpolacao linear normalizada
+        s0 = 1 - w;
+        s1 = w;
+    }
+    else {
+        float theta = acosf(d);
+        float inv = 1 / sinf(theta);
+        s0 = sinf((1 - w) * theta) * inv;
+        s1 = sinf(w * theta) * inv;
+    }
+    s1 *= sign;
+    float r[4];
+    float len = 0;
+    for(int k=0; k<4; k++) {
+        r[k] = s0*a[k] + s1*b[k];
+        len += r[k]*r[k];
+    }
+    len = 1 / sqrtf(len);
+    for(int k=0; k<4; k++)
+        q[k] = r[k] * len;
+}
+
+// Matriz 4x4 (por colunas) da rotacao q seguida da translacao t
+static void quatMatrix(const float* q, const float* t, float* m)
+{
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    m[0] = 1 - 2*(y*y + z*z); m[1] = 2*(x*y + w*z);     m[2] = 2*(x*z - w*y);     m[3] = 0;
+    m[4] = 2*(x*y - w*z);     m[5] = 1 - 2*(x*x + z*z); m[6] = 2*(y*z + w*x);     m[7] = 0;
+    m[8] = 2*(x*z + w*y);     m[9] = 2*(y*z - w*x);     m[10] = 1 - 2*(x*x + y*y); m[11] = 0;
+    m[12] = t[0];             m[13] = t[1];             m[14] = t[2];             m[15] = 1;
+}
+
+// c = a * b (4x4 por colunas)
+static void multMatrix(const float* a, const float* b, float* c)
+{
+    for(int j=0; j<4; j++)
+        for(int i=0; i<4; i++)
+            c[j*4+i] = a[i]*b[j*4] + a[4+i]*b[j*4+1] + a[8+i]*b[j*4+2] + a[12+i]*b[j*4+3];
+}
+
+// **********************************************************************
+//  Poses
+// **********************************************************************
+
+void poseInit(Pose* p, int numNodes)
+{
+    p->rot = malloc(numNodes * 4 * sizeof(float));
+    p->pos = malloc(numNodes * 3 * sizeof(float));
+    p->numNodes = numNodes;
+}
+
+void poseFree(Pose* p)
+{
+    free(p->rot);
+    free(p->pos);
+    p->rot = p->pos = NULL;
+    p->numNodes = 0;
+}
+
+// Rotacao dos canais ch de n (produto na ordem dos canais)
+static void channelsQuat(Node* n, const float* ch, float* q)
+{
+    q[0] = q[1] = q[2] = 0;
+    q[3] = 1;
+    for(int c=0; c<n->channels; c++) {
+        int type = n->channelType[c];
+        if(type <= CH_ZPOS)
+            continue;
+        float r[4] = { 0, 0, 0, cosf(ch[c] * DEG2RAD * 0.5f) };
+        r[type - CH_XROT] = sinf(ch[c] * DEG2RAD * 0.5f);
+        quatMult(q, r, q);
+    }
+}
+
+// Canais de um frame -> pose (p precisa ter clip->numNodes nodos)
+void poseFromFrame(Clip* clip, const float* frame, Pose* p)
+{
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        const float* ch = frame + n->firstChannel;
+        float* t = p->pos + i*3;
+        channelsQuat(n, ch, p->rot + i*4);
+        memcpy(t, n->offset, 3 * sizeof(float));
+        for(int c=0; c<n->channels; c++)
+            if(n->channelType[c] <= CH_ZPOS)
+                t[n->channelType[c]] = ch[c];
+    }
+}
+
+// Gira a raiz da pose em torno de y e a desloca
+void poseAlign(Pose* p, const RootAlign* align)
+{
+    float c = cosf(align->yaw), s = sinf(align->yaw);
+    float yaw[4] = { 0, sinf(align->yaw * 0.5f), 0, cosf(align->yaw * 0.5f) };
+    float* t = p->pos;
+    float x = t[0], z = t[2];
+    quatMult(yaw, p->rot, p->rot);
+    t[0] = x*c + z*s + align->offset[0];
+    t[1] += align->offset[1];
+    t[2] = -x*s + z*c + align->offset[2];
+}
+
+// out = a ate b por w (0..1): slerp das rotacoes, interpolacao linear das
+// translacoes. out pode ser a ou b
+void poseBlend(const Pose* a, const Pose* b, float w, Pose* out)
+{
+    for(int i=0; i<a->numNodes; i++) {
+        quatSlerp(a->rot + i*4, b->rot + i*4, w, out->rot + i*4);
+        const float* ta = a->pos + i*3;
+        const float* tb = b->pos + i*3;
+        for(int k=0; k<3; k++)
+            out->pos[i*3+k] = ta[k] + (tb[k] - ta[k]) * w;
+    }
+}
+
+// out = base somada a diferenca de layer para ref (camada aditiva): cada
+// rotacao local vira base * ref^-1 * layer e cada translacao, base +
+// (layer - ref). out pode ser base
+void poseAdd(const Pose* base, const Pose* ref, const Pose* layer, Pose* out)
+{
+    for(int i=0; i<base->numNodes; i++) {
+        const float* r = ref->rot + i*4;
+        float d[4] = { -r[0], -r[1], -r[2], r[3] };
+        quatMult(d, layer->rot + i*4, d);
+        quatMult(base->rot + i*4, d, out->rot + i*4);
+        for(int k=0; k<3; k++)
+            out->pos[i*3+k] = base->pos[i*3+k] + layer->pos[i*3+k] - ref->pos[i*3+k];
+    }
+}
+
+// FK de uma pose: world recebe uma matriz por nodo, como forwardKinematics
+void poseWorld(Clip* clip, const Pose* p, float* world)
+{
+    float local[16];
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        quatMatrix(p->rot + i*4, p->pos + i*3, local);
+        if(n->parent)
+            multMatrix(world + n->parent->index*16, local, world + i*16);
+        else
+            memcpy(world + i*16, local, sizeof(local));
+    }
+}
+
+// **********************************************************************
+//  Interpolacao de frames de canais
+// **********************************************************************
+
+// Angulo equivalente a a (graus) mais proximo de ref
+static float nearestAngle(float a, float ref)
+{
+    return ref + remainderf(a - ref, 360);
+}
+
+// Decompoe q nos angulos (graus) de tres canais de rotacao de eixos
+// distintos i, j, k, aplicados nessa ordem (R = Ri Rj Rk). Perto do
+// travamento (angulo do meio em +-90 graus) so a soma ou a diferenca
+// do primeiro e do ultimo e definida: o ultimo fica em angles[2] (valor
+// de referencia) e o primeiro e calculado a partir dele
+static void quatEuler(const float* q, const int* axis, float* angles)
+{
+    float m[16], t[3] = { 0, 0, 0 };
+    quatMatrix(q, t, m);
+    int i = axis[0], j = axis[1], k = axis[2];
+    // M[linha][coluna] = m[coluna*4 + linha]; s: ordem ciclica (xyz, yzx, zxy)
+    float s = (j - i + 3) % 3 == 1 ? 1.0f : -1.0f;
+    float sb = s * m[k*4 + i];
+    sb = sb > 1 ? 1 : sb < -1 ? -1 : sb;
+    angles[1] = asinf(sb) / DEG2RAD;
+    if(fabsf(sb) < 0.999999f) {
+        angles[0] = atan2f(-s * m[k*4 + j], m[k*4 + k]) / DEG2RAD;
+        angles[2] = atan2f(-s * m[j*4 + i], m[i*4 + i]) / DEG2RAD;
+        return;
+    }
+    // Coluna j de M Rk(-gama) = Ri(alfa) Rj(beta) ej, que so depende de alfa
+    float g = angles[2] * DEG2RAD;
+    float sg = s * sinf(g), cg = cosf(g);
+    float cj = sg * m[i*4 + j] + cg * m[j*4 + j];
+    float ck = sg * m[i*4 + k] + cg * m[j*4 + k];
+    angles[0] = atan2f(s * ck, cj) / DEG2RAD;
+}
+
+// **********************************************************************
+//  out = frame a ate frame b por u (0..1): canais de posicao por
+//  interpolacao linear; em nodos com tres rotacoes de eixos distintos,
+//  slerp dos quaternios decomposto de volta na ordem dos canais; nos
+//  demais, cada angulo pelo menor arco. Os angulos de saida ficam
+//  proximos dos interpolados canal a canal, sem saltos de 360 graus
+// **********************************************************************
+void frameSlerp(Clip* clip, const float* a, const float* b, float u, float* out)
+{
+    for(int c=0; c<clip->numChannels; c++) {
+        float d = b[c] - a[c];
+        out[c] = a[c] + u * d;
+    }
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        int fc = n->firstChannel;
+        int rot[3], axis[3], numRot = 0, seen = 0;
+        for(int c=0; c<n->channels; c++) {
+            int type = n->channelType[c];
+            if(type < CH_XROT)
+                continue;
+            float d = remainderf(b[fc+c] - a[fc+c], 360);
+            out[fc+c] = a[fc+c] + u * d;
+            if(numRot < 3) {
+                rot[numRot] = fc + c;
+                axis[numRot++] = type - CH_XROT;
+            }
+            seen |= 1 << (type - CH_XROT);
+        }
+        if(numRot != 3 || seen != 7)
+            continue;
+        float qa[4], qb[4], angles[3];
+        channelsQuat(n, a + fc, qa);
+        channelsQuat(n, b + fc, qb);
+        quatSlerp(qa, qb, u, qa);
+        angles[2] = out[rot[2]];
+        quatEuler(qa, axis, angles);
+        for(int k=0; k<3; k++)
+            out[rot[k]] = nearestAngle(angles[k], out[rot[k]]);
+    }
+}
+
+// **********************************************************************
+//  Alinhamento da raiz
+// **********************************************************************
+
+void rootAlignIdentity(RootAlign* align)
+{
+    align->yaw = 0;
+    align->offset[0] = align->offset[1] = align->offset[2] = 0;
+}
+
+// Aplica o alinhamento as matrizes globais ja calculadas (clip sem
+// transicao em andamento, mas mostrado alinhado ao anterior)
+void alignWorld(const RootAlign* align, int numNodes, float* world)
+{
+    if(align->yaw == 0 && align->offset[0] == 0 && align->offset[1] == 0 && align->offset[2] == 0)
+        return;
+    float c = cosf(align->yaw), s = sinf(align->yaw);
+    for(int i=0; i<numNodes; i++)
+        for(int j=0; j<4; j++) {
+            float* col = world + i*16 + j*4;
+            float x = col[0], z = col[2];
+            col[0] = x*c + z*s;
+            col[2] = -x*s + z*c;
+            if(j == 3)
+                for(int k=0; k<3; k++)
+                    col[k] += align->offset[k];
+        }
+}
+
+// **********************************************************************
+//  Crossfade
+// **********************************************************************
+
+// Mesmos nomes e pais (os offsets podem variar entre capturas)
+int sameHierarchy(Clip* a, Clip* b)
+{
+    if(a->numNodes != b->numNodes)
+        return 0;
+    for(int i=0; i<a->numNodes; i++) {
+        Node* na = a->nodes[i];
+        Node* nb = b->nodes[i];
+        if(strcmp(na->name, nb->name) || (na->parent ? na->parent->index : -1) != (nb->parent ? nb->parent->index : -1))
+            return 0;
+    }
+    return 1;
+}
+
+// **********************************************************************
+//  Inicia a transicao de from (no frame fromFrame, mostrado com
+//  fromAlign) para to (a partir de toFrame) em length frames. A raiz de
+//  to e alinhada a de from: mesma direcao e posicao no chao (xz)
+//  Retorna 0 se os esqueletos forem diferentes
+// **********************************************************************
+int crossfadeStart(Crossfade* x, Clip* from, int fromFrame, const RootAlign* fromAlign,
+                   Clip* to, int toFrame, int length)
+{
+    if(!sameHierarchy(from, to) || from->numFrames == 0 || to->numFrames == 0)
+        return 0;
+    if(x->out.numNodes != to->numNodes) {
+        crossfadeFree(x);
+        poseInit(&x->a, to->numNodes);
+        poseInit(&x->b, to->numNodes);
+        poseInit(&x->out, to->numNodes);
+    }
+    x->from = from;
+    x->to = to;
+    x->fromFrame = fromFrame < from->numFrames ? fromFrame : from->numFrames - 1;
+    x->toFrame = toFrame < to->numFrames ? toFrame : to->numFrames - 1;
+    x->step = 0;
+    x->length = length > 0 ? length : 1;
+    x->fromAlign = *fromAlign;
+
+    poseFromFrame(from, clipFrame(from, x->fromFrame), &x->a);
+    poseAlign(&x->a, fromAlign);
+    poseFromFrame(to, clipFrame(to, x->toFrame), &x->b);
+    float yaw = quatHeading(x->a.rot) - quatHeading(x->b.rot);
+    float c = cosf(yaw), s = sinf(yaw);
+    const float* pa = x->a.pos;
+    const float* pb = x->b.pos;
+    x->toAlign.yaw = yaw;
+    x->toAlign.offset[0] = pa[0] - (pb[0]*c + pb[2]*s);
+    x->toAlign.offset[1] = 0;
+    x->toAlign.offset[2] = pa[2] - (-pb[0]*s + pb[2]*c);
+    return 1;
+}
+
+// Matrizes globais do frame corrente da transicao (esqueleto de to)
+void crossfadeEval(Crossfade* x, float* world)
+{
+    float u = (float) x->step / x->length;
+    float w = u * u * (3 - 2*u);
+    poseFromFrame(x->from, clipFrame(x->from, x->fromFrame), &x->a);
+    poseAlign(&x->a, &x->fromAlign);
+    poseFromFrame(x->to, clipFrame(x->to, x->toFrame), &x->b);
+    poseAlign(&x->b, &x->toAlign);
+    poseBlend(&x->a, &x->b, w, &x->out);
+    poseWorld(x->to, &x->out, world);
+}
+
+// Avanca um frame nos dois clips (o ultimo se repete). Retorna 0 quando
+// a transicao termina
+int crossfadeStep(Crossfade* x)
+{
+    if(x->fromFrame < x->from->numFrames - 1)
+        x->fromFrame++;
+    if(x->toFrame < x->to->numFrames - 1)
+        x->toFrame++;
+    return ++x->step < x->length;
+}
+
+void crossfadeFree(Crossfade* x)
+{
+    poseFree(&x->a);
+    poseFree(&x->b);
+    poseFree(&x->out);
+}
@@ -0,0 +1,59 @@
+// **********************************************************************
+//	blend.h
+//  Poses com rotacoes em quaternios, interpolacao (slerp) entre duas
+//  poses e transicao suave (crossfade) entre dois clips do mesmo
+//  esqueleto, com a raiz do clip novo alinhada (posicao e direcao) a do
+//  clip anterior. Tambem interpola frames de canais (reamostragem)
+// **********************************************************************
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include "bvh.h"
+
+// Rotacao e translacao locais de cada nodo
+typedef struct {
+    float* rot;          // numNodes x (x, y, z, w)
+    float* pos;          // numNodes x 3
+    int numNodes;
+} Pose;
+
+// Giro em torno de y seguido de translacao, aplicado a raiz de um clip
+typedef struct {
+    float yaw;           // radianos
+    float offset[3];
+} RootAlign;
+
+typedef struct {
+    Clip* from;
+    Clip* to;
+    int fromFrame;       // frames correntes de cada clip
+    int toFrame;
+    int step;            // frames ja mostrados da transicao
+    int length;          // duracao da transicao (frames)
+    RootAlign fromAlign; // alinhamento com que o clip anterior era mostrado
+    RootAlign toAlign;   // alinhamento do clip novo (vale depois da transicao)
+    Pose a, b, out;
+} Crossfade;
+
+void poseInit(Pose* p, int numNodes);
+void poseFree(Pose* p);
+void poseFromFrame(Clip* clip, const float* frame, Pose* p);
+void poseAlign(Pose* p, const RootAlign* align);
+void poseBlend(const Pose* a, const Pose* b, float w, Pose* out);
+void poseAdd(const Pose* base, const Pose* ref, const Pose* layer, Pose* out);
+void poseWorld(Clip* clip, const Pose* p, float* world);
+
+void frameSlerp(Clip* clip, const float* a, const float* b, float u, float* out);
+
+void rootAlignIdentity(RootAlign* align);
+void alignWorld(const RootAlign* align, int numNodes, float* world);
+
+int sameHierarchy(Clip* a, Clip* b);
+int crossfadeStart(Crossfade* x, Clip* from, int fromFrame, const RootAlign* fromAlign,
+                   Clip* to, int toFrame, int length);
+void crossfadeEval(Crossfade* x, float* world);
+int crossfadeStep(Crossfade* x);
+void crossfadeFree(Crossfade* x);
+
+#endif
@@ -0,0 +1,521 @@
+// **********************************************************************
+//	blendtree.c
+//  Compilacao: a arvore e percorrida uma vez e cada nodo vira operacoes
+//  sobre registradores (poses), alocados como pilha: o resultado de um
+//  nodo fica no registrador recebido e os seguintes servem de rascunho
+//
+//  Um espaco de blend de n clips vira uma cadeia de n-1 misturas; para
+//  um valor do parametro so um elo fica entre 0 e 1 (os anteriores valem
+//  1 e os seguintes 0). Os clips de um espaco de blend andam sincronizados
+//  pela fase (0..1), com a duracao do ciclo ponderada pelos pesos
+//
+//  A raiz de cada clip e amostrada em relacao a sua posicao no chao (xz)
+//  no primeiro frame, para que clips gravados em lugares diferentes
+//  possam ser misturados
+//
+//  Uma camada aditiva usa as trilhas delta de additive.c: o frame da
+//  camada e a referencia + delta x (mascara x peso), e a diferenca entre
+//  a pose dele e a da referencia e somada a pose da entrada (poseAdd).
+//  A camada roda em loop na sua propria velocidade
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "blendtree.h"
+
+enum { BT_CLIP, BT_BLEND, BT_SPACE, BT_ADDITIVE };
+
+struct BlendNode {
+    int type;
+    Clip* clips[BT_MAX_CHILDREN];  // BT_CLIP: clips[0]
+    float positions[BT_MAX_CHILDREN];
+    int numClips;
+    float rate;
+    BlendNode* a;
+    BlendNode* b;
+    int param;
+    const AdditiveLayer* layer;    // BT_ADDITIVE: camada somada a a
+    float* mask;                   // peso de cada junta (NULL: todas 1)
+};
+
+enum { OP_SAMPLE, OP_BLEND, OP_ADDITIVE };
+
+typedef struct {
+    unsigned char code;
+    unsigned char dst, a, b;     // registradores (em OP_SAMPLE e OP_ADDITIVE, b e o rascunho)
+    short sample;                // OP_SAMPLE: indice em samples; OP_ADDITIVE: em layers
+    short weight;                // OP_BLEND e OP_ADDITIVE: indice em weights
+} BtOp;
+
+// Clip amostrado: fase do timer -> frame
+typedef struct {
+    Clip* clip;
+    int timer;
+    float origin[2];             // raiz (xz) no primeiro frame
+} BtSample;
+
+// Peso de uma mistura: parametro mapeado de [lo, hi] para [0, 1]
+typedef struct {
+    int param;
+    float lo, hi;
+    float w;
+} BtWeight;
+
+// Camada aditiva: trilhas da camada com os pesos de canal deste nodo
+// (mascara x peso, refeitos a cada btUpdate)
+typedef struct {
+    AdditiveLayer view;          // delta da camada; weights e do programa
+    int timer;
+    float* mask;                 // numNodes
+    float* ref;                  // frame de referencia das trilhas
+    float* frame;                // referencia + delta ponderado
+    Pose refPose;
+} BtLayer;
+
+// Fase de um clip ou dos clips de um espaco de blend; os pesos dos clips
+// 1..n-1 estao em weights[firstWeight ..]
+typedef struct {
+    float phase;
+    int numClips;
+    int firstWeight;
+    float duration[BT_MAX_CHILDREN];
+} BtTimer;
+
+struct BlendProgram {
+    BtOp ops[BT_MAX_OPS];
+    int numOps;
+    BtSample samples[BT_MAX_OPS];
+    int numSamples;
+    BtWeight weights[BT_MAX_OPS];
+    int numWeights;
+    BtTimer timers[BT_MAX_OPS];
+    int numTimers;
+    BtLayer layers[BT_MAX_LAYERS];
+    int numLayers;
+    float params[BT_MAX_PARAMS];
+    Clip* skeleton;              // esqueleto comum (primeiro clip)
+    Pose regs[BT_MAX_REGS];
+    int numRegs;
+    float* arena;                // memoria de todas as poses
+};
+
+// **********************************************************************
+//  Montagem da arvore
+// **********************************************************************
+
+static BlendNode* newNode(int type)
+{
+    BlendNode* n = calloc(1, sizeof(BlendNode));
+    n->type = type;
+    n->rate = 1;
+    return n;
+}
+
+// Clip em loop; rate multiplica a velocidade de reproducao
+BlendNode* btClip(Clip* clip, float rate)
+{
+    BlendNode* n = newNode(BT_CLIP);
+    n->clips[0] = clip;
+    n->numClips = 1;
+    n->rate = rate;
+    return n;
+}
+
+// Mistura de a (parametro 0) ate b (parametro 1)
+BlendNode* btBlend(BlendNode* a, BlendNode* b, int param)
+{
+    BlendNode* n = newNode(BT_BLEND);
+    n->a = a;
+    n->b = b;
+    n->param = param;
+    return n;
+}
+
+// Espaco de blend 1D: clips[i] vale sozinho quando o parametro esta em
+// positions[i] (crescentes); entre duas posicoes, os vizinhos se misturam
+BlendNode* btBlendSpace(int param, Clip** clips, const float* positions, int n)
+{
+    BlendNode* node = newNode(BT_SPACE);
+    node->param = param;
+    node->numClips = n < BT_MAX_CHILDREN ? n : BT_MAX_CHILDREN;
+    memcpy(node->clips, clips, node->numClips * sizeof(Clip*));
+    memcpy(node->positions, positions, node->numClips * sizeof(float));
+    return node;
+}
+
+// Camada aditiva sobre base (trilhas de additiveBuild, que precisam
+// continuar existindo enquanto o programa for usado). jointMask tem um
+// peso por junta (ex.: additiveMask) e e copiada; NULL: todas as juntas.
+// O parametro vai de 0 (so base) a 1 (camada inteira)
+BlendNode* btAdditive(BlendNode* base, const AdditiveLayer* layer, const float* jointMask, int param)
+{
+    BlendNode* n = newNode(BT_ADDITIVE);
+    n->a = base;
+    n->layer = layer;
+    n->param = param;
+    n->clips[0] = layer->clip;
+    n->numClips = 1;
+    if(jointMask) {
+        size_t size = layer->clip->numNodes * sizeof(float);
+        n->mask = malloc(size);
+        memcpy(n->mask, jointMask, size);
+    }
+    return n;
+}
+
+void btFreeNode(BlendNode* node)
+{
+    if(!node)
+        return;
+    btFreeNode(node->a);
+    btFreeNode(node->b);
+    free(node->mask);
+    free(node);
+}
+
+// **********************************************************************
+//  Compilacao
+// **********************************************************************
+
+typedef struct {
+    BlendProgram* p;
+    char* err;
+    int errSize;
+} Compiler;
+
+static int fail(Compiler* c, const char* msg)
+{
+    if(c->err)
+        snprintf(c->err, c->errSize, "%s", msg);
+    return 0;
+}
+
+static int useReg(Compiler* c, int reg)
+{
+    if(reg >= BT_MAX_REGS)
+        return fail(c, "arvore muito profunda");
+    if(reg >= c->p->numRegs)
+        c->p->numRegs = reg + 1;
+    return 1;
+}
+
+static BtOp* emit(Compiler* c, int code, int dst, int a, int b)
+{
+    BlendProgram* p = c->p;
+    if(p->numOps == BT_MAX_OPS || p->numSamples == BT_MAX_OPS || p->numWeights == BT_MAX_OPS) {
+        fail(c, "arvore muito grande");
+        return NULL;
+    }
+    BtOp* op = &p->ops[p->numOps++];
+    op->code = code;
+    op->dst = dst;
+    op->a = a;
+    op->b = b;
+    return op;
+}
+
+// Amostra clip em reg (reg+1 de rascunho)
+static int emitSample(Compiler* c, Clip* clip, int timer, int reg)
+{
+    BlendProgram* p = c->p;
+    if(clip->numFrames == 0)
+        return fail(c, "clip sem frames");
+    if(!p->skeleton)
+        p->skeleton = clip;
+    else if(!sameHierarchy(p->skeleton, clip))
+        return fail(c, "clips com esqueletos diferentes");
+    if(!useReg(c, reg + 1))
+        return 0;
+    BtOp* op = emit(c, OP_SAMPLE, reg, reg, reg + 1);
+    if(!op)
+        return 0;
+    BtSample* s = &p->samples[p->numSamples];
+    op->sample = p->numSamples++;
+    s->clip = clip;
+    s->timer = timer;
+    const float* f = clipFrame(clip, 0);
+    Node* root = clip->root;
+    s->origin[0] = root->offset[0];
+    s->origin[1] = root->offset[2];
+    for(int k=0; k<root->channels; k++) {
+        if(root->channelType[k] == CH_XPOS)
+            s->origin[0] = f[root->firstChannel + k];
+        else if(root->channelType[k] == CH_ZPOS)
+            s->origin[1] = f[root->firstChannel + k];
+    }
+    return 1;
+}
+
+// Peso de op pelo parametro, mapeado de [lo, hi] para [0, 1]
+static void newWeight(BlendProgram* p, BtOp* op, int param, float lo, float hi)
+{
+    BtWeight* w = &p->weights[p->numWeights];
+    op->weight = p->numWeights++;
+    w->param = param;
+    w->lo = lo;
+    w->hi = hi;
+}
+
+// Mistura reg com reg+1 em reg, pelo peso slot
+static int emitBlend(Compiler* c, int reg, int param, float lo, float hi)
+{
+    if(param < 0 || param >= BT_MAX_PARAMS)
+        return fail(c, "parametro invalido");
+    BtOp* op = emit(c, OP_BLEND, reg, reg, reg + 1);
+    if(!op)
+        return 0;
+    newWeight(c->p, op, param, lo, hi);
+    return 1;
+}
+
+// Soma a camada de node a pose em reg (reg+1 de rascunho)
+static int emitAdditive(Compiler* c, BlendNode* node, int timer, int reg)
+{
+    BlendProgram* p = c->p;
+    const AdditiveLayer* l = node->layer;
+    if(node->param < 0 || node->param >= BT_MAX_PARAMS)
+        return fail(c, "parametro invalido");
+    if(!l->delta || l->numFrames == 0)
+        return fail(c, "camada aditiva vazia");
+    if(!additiveCompatible(l, p->skeleton))
+        return fail(c, "camada aditiva com esqueleto diferente");
+    if(p->numLayers == BT_MAX_LAYERS)
+        return fail(c, "camadas aditivas demais");
+    if(!useReg(c, reg + 1))
+        return 0;
+    BtOp* op = emit(c, OP_ADDITIVE, reg, reg, reg + 1);
+    if(!op)
+        return 0;
+    newWeight(p, op, node->param, 0, 1);
+
+    // Referencia das trilhas: primeiro frame menos o seu delta
+    BtLayer* bl = &p->layers[p->numLayers];
+    op->sample = p->numLayers++;
+    Clip* clip = l->clip;
+    int nc = l->numChannels;
+    bl->view = *l;
+    bl->view.weights = malloc(nc * sizeof(float));
+    bl->timer = timer;
+    bl->mask = malloc(clip->numNodes * sizeof(float));
+    bl->ref = malloc(nc * sizeof(float));
+    bl->frame = malloc(nc * sizeof(float));
+    poseInit(&bl->refPose, clip->numNodes);
+    const float* f = clipFrame(clip, 0);
+    for(int k=0; k<nc; k++)
+        bl->ref[k] = f[k] - l->delta[k];
+    poseFromFrame(clip, bl->ref, &bl->refPose);
+    for(int j=0; j<clip->numNodes; j++)
+        bl->mask[j] = node->mask ? node->mask[j] : 1;
+    return 1;
+}
+
+static int newTimer(Compiler* c, BlendNode* node)
+{
+    BlendProgram* p = c->p;
+    if(p->numTimers == BT_MAX_OPS)
+        return fail(c, "arvore muito grande") - 1;
+    BtTimer* t = &p->timers[p->numTimers];
+    t->numClips = node->numClips;
+    t->firstWeight = p->numWeights;
+    for(int i=0; i<node->numClips; i++)
+        t->duration[i] = node->clips[i]->numFrames * node->clips[i]->frameTime / node->rate;
+    return p->numTimers++;
+}
+
+// Emite as operacoes que deixam o resultado de node em reg
+static int compileNode(Compiler* c, BlendNode* node, int reg)
+{
+    if(!node)
+        return fail(c, "nodo vazio");
+    if(!useReg(c, reg))
+        return 0;
+    switch(node->type) {
+    case BT_CLIP: {
+        if(node->rate <= 0)
+            return fail(c, "velocidade invalida");
+        int timer = newTimer(c, node);
+        return timer >= 0 && emitSample(c, node->clips[0], timer, reg);
+    }
+    case BT_BLEND:
+        return compileNode(c, node->a, reg) && compileNode(c, node->b, reg + 1)
+            && emitBlend(c, reg, node->param, 0, 1);
+    case BT_SPACE: {
+        if(node->numClips < 1)
+            return fail(c, "espaco de blend vazio");
+        for(int i=1; i<node->numClips; i++)
+            if(node->positions[i] <= node->positions[i-1])
+                return fail(c, "posicoes do espaco de blend devem ser crescentes");
+        int timer = newTimer(c, node);
+        if(timer < 0 || !emitSample(c, node->clips[0], timer, reg))
+            return 0;
+        for(int i=1; i<node->numClips; i++)
+            if(!emitSample(c, node->clips[i], timer, reg + 1)
+               || !emitBlend(c, reg, node->param, node->positions[i-1], node->positions[i]))
+                return 0;
+        return 1;
+    }
+    case BT_ADDITIVE: {
+        if(!compileNode(c, node->a, reg))
+            return 0;
+        int timer = newTimer(c, node);
+        return timer >= 0 && emitAdditive(c, node, timer, reg);
+    }
+    }
+    return fail(c, "nodo invalido");
+}
+
+static void freeLayers(BlendProgram* p)
+{
+    for(int i=0; i<p->numLayers; i++) {
+        BtLayer* l = &p->layers[i];
+        free(l->view.weights);
+        free(l->mask);
+        free(l->ref);
+        free(l->frame);
+        poseFree(&l->refPose);
+    }
+}
+
+// Compila a arvore (que continua pertencendo a quem chama). Retorna NULL
+// e a mensagem em err se houver erro
+BlendProgram* btCompile(BlendNode* root, char* err, int errSize)
+{
+    BlendProgram* p = calloc(1, sizeof(BlendProgram));
+    Compiler c = { p, err, errSize };
+    if(!compileNode(&c, root, 0)) {
+        freeLayers(p);
+        free(p);
+        return NULL;
+    }
+    int n = p->skeleton->numNodes;
+    p->arena = malloc((size_t) p->numRegs * n * 7 * sizeof(float));
+    for(int r=0; r<p->numRegs; r++) {
+        p->regs[r].rot = p->arena + (size_t) r * n * 7;
+        p->regs[r].pos = p->regs[r].rot + n * 4;
+        p->regs[r].numNodes = n;
+    }
+    memAdd(MEM_POSES, (long long) p->numRegs * n * 7 * sizeof(float));
+    btUpdate(p, 0);
+    return p;
+}
+
+// **********************************************************************
+//  Avaliacao
+// **********************************************************************
+
+void btSetParam(BlendProgram* p, int param, float value)
+{
+    if(param >= 0 && param < BT_MAX_PARAMS)
+        p->params[param] = value;
+}
+
+// Recalcula os pesos pelos parametros e avanca as fases dt segundos
+void btUpdate(BlendProgram* p, float dt)
+{
+    for(int i=0; i<p->numWeights; i++) {
+        BtWeight* w = &p->weights[i];
+        float u = (p->params[w->param] - w->lo) / (w->hi - w->lo);
+        w->w = u < 0 ? 0 : u > 1 ? 1 : u;
+    }
+    for(int i=0; i<p->numOps; i++)
+        if(p->ops[i].code == OP_ADDITIVE) {
+            BtLayer* l = &p->layers[p->ops[i].sample];
+            additiveSetWeights(&l->view, l->mask, p->weights[p->ops[i].weight].w);
+        }
+    for(int i=0; i<p->numTimers; i++) {
+        BtTimer* t = &p->timers[i];
+        // Peso efetivo de cada clip na cadeia: o seu elo vezes o que os
+        // elos seguintes deixam passar
+        float duration = 0, rest = 1;
+        for(int k=t->numClips-1; k>=0; k--) {
+            float w = k ? p->weights[t->firstWeight + k-1].w : 1;
+            duration += w * rest * t->duration[k];
+            rest *= 1 - w;
+        }
+        if(duration > 0) {
+            t->phase += dt / duration;
+            t->phase -= floorf(t->phase);
+        }
+    }
+}
+
+// Executa o programa; se world nao for NULL, tambem calcula as matrizes
+// globais (FK). Retorna a pose resultante
+const Pose* btEval(BlendProgram* p, float* world)
+{
+    size_t poseBytes = (size_t) p->skeleton->numNodes * 7 * sizeof(float);
+    for(int i=0; i<p->numOps; i++) {
+        const BtOp* op = &p->ops[i];
+        Pose* dst = &p->regs[op->dst];
+        switch(op->code) {
+        case OP_SAMPLE: {
+            // Interpola os dois frames vizinhos da fase (sem passar do
+            // ultimo para o primeiro)
+            const BtSample* s = &p->samples[op->sample];
+            Clip* clip = s->clip;
+            float f = p->timers[s->timer].phase * clip->numFrames;
+            int f0 = (int) f;
+            if(f0 > clip->numFrames - 1)
+                f0 = clip->numFrames - 1;
+            int f1 = f0 < clip->numFrames - 1 ? f0 + 1 : f0;
+            poseFromFrame(clip, clipFrame(clip, f0), dst);
+            if(f1 != f0) {
+                Pose* next = &p->regs[op->b];
+                poseFromFrame(clip, clipFrame(clip, f1), next);
+                poseBlend(dst, next, f - f0, dst);
+            }
+            dst->pos[0] -= s->origin[0];
+            dst->pos[2] -= s->origin[1];
+            break;
+        }
+        case OP_BLEND: {
+            float w = p->weights[op->weight].w;
+            if(w >= 1)
+                memcpy(dst->rot, p->regs[op->b].rot, poseBytes);
+            else if(w > 0)
+                poseBlend(&p->regs[op->a], &p->regs[op->b], w, dst);
+            break;
+        }
+        case OP_ADDITIVE: {
+            // Frame da camada pela fase (sem interpolar: as trilhas ja
+            // sao densas), ponderado canal a canal sobre a referencia
+            if(p->weights[op->weight].w <= 0)
+                break;
+            BtLayer* l = &p->layers[op->sample];
+            int f = (int) (p->timers[l->timer].phase * l->view.numFrames);
+            if(f > l->view.numFrames - 1)
+                f = l->view.numFrames - 1;
+            additiveApply(&l->view, f, l->ref, l->frame);
+            poseFromFrame(l->view.clip, l->frame, &p->regs[op->b]);
+            poseAdd(dst, &l->refPose, &p->regs[op->b], dst);
+            break;
+        }
+        }
+    }
+    if(world)
+        poseWorld(p->skeleton, &p->regs[0], world);
+    return &p->regs[0];
+}
+
+int btNumOps(BlendProgram* p)
+{
+    return p->numOps;
+}
+
+int btNumRegs(BlendProgram* p)
+{
+    return p->numRegs;
+}
+
+void btFree(BlendProgram* p)
+{
+    if(!p)
+        return;
+    memAdd(MEM_POSES, -(long long) p->numRegs * p->skeleton->numNodes * 7 * sizeof(float));
+    freeLayers(p);
+    free(p->arena);
+    free(p);
+}
@@ -0,0 +1,42 @@
+// **********************************************************************
+//	blendtree.h
+//  Arvores de blend: clips, misturas de duas entradas, espacos de blend
+//  1D (ex.: andar/correr pela velocidade) e camadas aditivas com mascara
+//  por junta (ex.: bracos sobre o andar) montados uma vez e compilados
+//  em um programa linear de operacoes sobre poses pre-alocadas. A
+//  avaliacao por frame e um laco sobre as operacoes, sem alocacao. Nao
+//  ha maquina de estados: trocar de arvore ou de clip fica com o
+//  crossfade (blend.h)
+// **********************************************************************
+
+#ifndef BLENDTREE_H
+#define BLENDTREE_H
+
+#include "additive.h"
+#include "blend.h"
+
+#define BT_MAX_PARAMS 8
+#define BT_MAX_OPS 64
+#define BT_MAX_REGS 16       // poses intermediarias (profundidade da arvore)
+#define BT_MAX_CHILDREN 8    // clips de um espaco de blend
+#define BT_MAX_LAYERS 8      // camadas aditivas
+
+typedef struct BlendNode BlendNode;
+typedef struct BlendProgram BlendProgram;
+
+// Montagem da arvore (os nodos passam a pertencer ao pai)
+BlendNode* btClip(Clip* clip, float rate);
+BlendNode* btBlend(BlendNode* a, BlendNode* b, int param);
+BlendNode* btBlendSpace(int param, Clip** clips, const float* positions, int n);
+BlendNode* btAdditive(BlendNode* base, const AdditiveLayer* layer, const float* jointMask, int param);
+void btFreeNode(BlendNode* node);
+
+BlendProgram* btCompile(BlendNode* root, char* err, int errSize);
+void btSetParam(BlendProgram* p, int param, float value);
+void btUpdate(BlendProgram* p, float dt);
+const Pose* btEval(BlendProgram* p, float* world);
+int btNumOps(BlendProgram* p);
+int btNumRegs(BlendProgram* p);
+void btFree(BlendProgram* p);
+
+#endif
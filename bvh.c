@@ -0,0 +1,1074 @@
+// **********************************************************************
+//	bvh.c
+//  Leitura de arquivos BVH (BioVision), cache binario e FK
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include "bvh.h"
+#include "clipmap.h"
+#include "trace.h"
+
+#define DEG2RAD 0.017453292519943295f
+
+// Tamanho do buffer de leitura do arquivo texto
+#define READ_BUF 65536
+
+struct BvhReader {
+    FILE* fp;
+    char buf[READ_BUF];
+    int pos, len;
+    Clip* clip;
+    int frame;           // proximo frame a ser lido
+};
+
+// Nomes dos canais, na ordem dos tipos CH_*
+static const char* channelNames[6] = { "Xposition", "Yposition", "Zposition",
+                                       "Xrotation", "Yrotation", "Zrotation" };
+
+// Cabecalho do cache binario
+#define CACHE_MAGIC "BVHC"
+#define CACHE_VERSION 1
+
+// **********************************************************************
+//  Cria um nodo novo para a hierarquia, fazendo também a ligacao com
+//  o seu pai (se houver)
+//  Parametros:
+//  - name: string com o nome do nodo
+//  - parent: ponteiro para o nodo pai (NULL se for a raiz)
+//  - numChannels: quantidade de canais de transformacao (3 ou 6)
+//  - ofx, ofy, ofz: offset (deslocamento) lido do arquivo
+//  - numChildren: quantidade de filhos que serao inseridos posteriormente
+// **********************************************************************
+Node* createNode(char name[20], Node* parent, int numChannels, float ofx, float ofy, float ofz, int numChildren)
+{
+    // Ordem padrao dos canais (a dos arquivos de exemplo)
+    static const unsigned char order6[6] = { CH_XPOS, CH_YPOS, CH_ZPOS, CH_ZROT, CH_XROT, CH_YROT };
+    static const unsigned char order3[3] = { CH_ZROT, CH_XROT, CH_YROT };
+
+    Node* aux = malloc(sizeof(Node));
+    aux->channels = numChannels;
+    aux->channelData = calloc(sizeof(float), numChannels);
+    strcpy(aux->name, name);
+    aux->offset[0] = ofx;
+    aux->offset[1] = ofy;
+    aux->offset[2] = ofz;
+    aux->numChildren = numChildren;
+    if(numChildren > 0)
+        aux->children = calloc(sizeof(Node*), numChildren);
+    else
+        aux->children = NULL;
+    aux->parent = parent;
+    if(parent)
+        for(int i=0; i<parent->numChildren; i++)
+            if(!parent->children[i]) {
+//                printf("Insert at parent: %d\n", i);
+                parent->children[i] = aux;
+                break;
+            }
+    memset(aux->channelType, 0, sizeof(aux->channelType));
+    if(numChannels == 6)
+        memcpy(aux->channelType, order6, 6);
+    else if(numChannels == 3)
+        memcpy(aux->channelType, order3, 3);
+    aux->index = 0;
+    aux->firstChannel = 0;
+//    printf("Created %s\n", name);
+    return aux;
+}
+
+void freeNode(Node* node)
+{
+    //printf("Freeing %s %p\n", node->name,node->children);
+    if(node == NULL) return;
+    //printf("Freeing children...\n");
+    for(int i=0; i<node->numChildren; i++) {
+        //printf(">>> child %d\n", i);
+        freeNode(node->children[i]);
+    }
+    //printf("Freeing channel data...\n");
+    free(node->channelData);
+    if(node->numChildren>0) {
+        //printf("Freeing children array...\n");
+        free(node->children);
+    }
+    free(node);
+}
+
+// Acrescenta um filho a um nodo ja criado (quando o total nao e conhecido)
+static void addChild(Node* parent, Node* child)
+{
+    parent->children = realloc(parent->children, (parent->numChildren+1) * sizeof(Node*));
+    parent->children[parent->numChildren++] = child;
+    child->parent = parent;
+}
+
+// **********************************************************************
+//  Cria um nodo e o acrescenta ao clip, como filho de parent (ou como
+//  raiz, se parent for NULL). Os nodos devem ser criados em pre-ordem;
+//  os canais do nodo vao para o fim do vetor do frame
+//  name e truncado em 19 caracteres
+//  types: tipo de cada canal (CH_*), ou NULL para a ordem padrao
+// **********************************************************************
+Node* clipAddNode(Clip* clip, Node* parent, const char* name, int numChannels,
+                  const unsigned char* types, float ofx, float ofy, float ofz)
+{
+    char nodeName[20];
+    snprintf(nodeName, sizeof(nodeName), "%s", name);
+    Node* node = createNode(nodeName, NULL, numChannels, ofx, ofy, ofz, 0);
+    if(types)
+        memcpy(node->channelType, types, numChannels);
+    if(parent)
+        addChild(parent, node);
+    else if(!clip->root)
+        clip->root = node;
+
+    // Capacidade dobra a cada potencia de 2 (a partir de 32)
+    int n = clip->numNodes;
+    if(n == 0 || (n >= 32 && !(n & (n-1))))
+        clip->nodes = realloc(clip->nodes, (n ? n*2 : 32) * sizeof(Node*));
+    node->index = n;
+    node->firstChannel = clip->numChannels;
+    clip->nodes[clip->numNodes++] = node;
+    clip->numChannels += numChannels;
+    return node;
+}
+
+// **********************************************************************
+//  Leitura do arquivo texto
+// **********************************************************************
+
+// Le o proximo token (separado por espacos) para tok; 0 no fim do arquivo
+static int nextToken(BvhReader* r, char* tok, int size)
+{
+    int n = 0;
+    for(;;) {
+        if(r->pos == r->len) {
+            r->len = fread(r->buf, 1, READ_BUF, r->fp);
+            r->pos = 0;
+            if(r->len <= 0) {
+                r->len = 0;
+                break;
+            }
+        }
+        char c = r->buf[r->pos];
+        if(c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            r->pos++;
+            if(n > 0)
+                break;
+            continue;
+        }
+        if(n < size-1)
+            tok[n++] = c;
+        r->pos++;
+    }
+    tok[n] = 0;
+    return n;
+}
+
+static int expectToken(BvhReader* r, const char* expected)
+{
+    char tok[64];
+    nextToken(r, tok, sizeof(tok));
+    if(strcmp(tok, expected)) {
+        fprintf(stderr, "BVH: esperado '%s', encontrado '%s'\n", expected, tok);
+        return 0;
+    }
+    return 1;
+}
+
+static int readFloat(BvhReader* r, float* v)
+{
+    char tok[64], *end;
+    if(!nextToken(r, tok, sizeof(tok)))
+        return 0;
+    *v = strtof(tok, &end);
+    return *end == 0;
+}
+
+static int channelType(const char* name)
+{
+    for(int i=0; i<6; i++)
+        if(!strcmp(name, channelNames[i]))
+            return i;
+    return -1;
+}
+
+// **********************************************************************
+//  Le um JOINT (ou End Site) e, recursivamente, seus filhos
+//  O token JOINT/ROOT/End ja foi consumido
+// **********************************************************************
+static Node* parseJoint(BvhReader* r, Node* parent, int endSite)
+{
+    char tok[64], name[sizeof(tok) + 3];
+    float ofs[3];
+    unsigned char types[6];
+    int numChannels = 0;
+
+    // Nomes maiores que Node.name seriam truncados e poderiam colidir
+    // nas buscas por nome: juntas sao rejeitadas, e o End Site de um pai
+    // de nome longo passa a ser identificado pelo indice do pai
+    nextToken(r, tok, sizeof(tok));
+    if(endSite) {
+        snprintf(name, sizeof(name), "End%s", parent->name);
+        if(strlen(name) >= NODE_NAME) {
+            fprintf(stderr, "BVH: End Site de '%s' renomeado para End%d\n", parent->name, parent->index);
+            snprintf(name, sizeof(name), "End%d", parent->index);
+        }
+    }
+    else {
+        snprintf(name, sizeof(name), "%s", tok);
+        if(strlen(name) >= NODE_NAME) {
+            fprintf(stderr, "BVH: nome de junta longo demais '%s' (max %d)\n", name, NODE_NAME-1);
+            return NULL;
+        }
+    }
+
+    if(!expectToken(r, "{") || !expectToken(r, "OFFSET"))
+        return NULL;
+    for(int i=0; i<3; i++)
+        if(!readFloat(r, &ofs[i]))
+            return NULL;
+
+    if(!endSite) {
+        if(!expectToken(r, "CHANNELS"))
+            return NULL;
+        nextToken(r, tok, sizeof(tok));
+        numChannels = atoi(tok);
+        if(numChannels < 0 || numChannels > 6)
+            return NULL;
+        for(int i=0; i<numChannels; i++) {
+            nextToken(r, tok, sizeof(tok));
+            int t = channelType(tok);
+            if(t < 0) {
+                fprintf(stderr, "BVH: canal desconhecido '%s'\n", tok);
+                return NULL;
+            }
+            types[i] = t;
+        }
+    }
+
+    Node* node = clipAddNode(r->clip, parent, name, numChannels, types, ofs[0], ofs[1], ofs[2]);
+
+    for(;;) {
+        if(!nextToken(r, tok, sizeof(tok)))
+            return NULL;
+        if(!strcmp(tok, "}"))
+            break;
+        if(!strcmp(tok, "JOINT")) {
+            if(!parseJoint(r, node, 0))
+                return NULL;
+        }
+        else if(!strcmp(tok, "End")) {
+            if(!parseJoint(r, node, 1))
+                return NULL;
+        }
+        else {
+            fprintf(stderr, "BVH: token inesperado '%s' em %s\n", tok, node->name);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+// **********************************************************************
+//  Abre um arquivo BVH e le a hierarquia e o cabecalho de MOTION
+//  Os frames sao lidos depois, um a um, por readBvhFrame()
+//  Retorna NULL em caso de erro
+// **********************************************************************
+BvhReader* openBvh(const char* fileName)
+{
+    char tok[64];
+    BvhReader* r = malloc(sizeof(BvhReader));
+    r->fp = fopen(fileName, "rb");
+    if(!r->fp) {
+        fprintf(stderr, "BVH: nao foi possivel abrir %s\n", fileName);
+        free(r);
+        return NULL;
+    }
+    r->pos = r->len = 0;
+    r->frame = 0;
+    r->clip = calloc(1, sizeof(Clip));
+
+    int ok = expectToken(r, "HIERARCHY") && expectToken(r, "ROOT");
+    ok = ok && parseJoint(r, NULL, 0)
+        && expectToken(r, "MOTION") && expectToken(r, "Frames:");
+    if(ok) {
+        nextToken(r, tok, sizeof(tok));
+        r->clip->numFrames = atoi(tok);
+        ok = expectToken(r, "Frame") && expectToken(r, "Time:")
+            && readFloat(r, &r->clip->frameTime);
+    }
+    if(!ok) {
+        fprintf(stderr, "BVH: erro ao ler %s\n", fileName);
+        freeClip(r->clip);
+        fclose(r->fp);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Clip com a hierarquia lida (frames == NULL); pertence a quem chamou
+Clip* readerClip(BvhReader* r)
+{
+    return r->clip;
+}
+
+// Le o proximo frame (numChannels valores); 0 no fim ou em erro
+int readBvhFrame(BvhReader* r, float* frame)
+{
+    if(r->frame >= r->clip->numFrames)
+        return 0;
+    for(int c=0; c<r->clip->numChannels; c++)
+        if(!readFloat(r, &frame[c]))
+            return 0;
+    r->frame++;
+    return 1;
+}
+
+// Fecha o arquivo; o clip devolvido por readerClip() nao e liberado
+void closeBvh(BvhReader* r)
+{
+    fclose(r->fp);
+    free(r);
+}
+
+// **********************************************************************
+//  Carrega um arquivo BVH completo (hierarquia e todos os frames)
+//  Retorna NULL em caso de erro
+// **********************************************************************
+Clip* loadBvh(const char* fileName)
+{
+    TRACE_BEGIN("loadBvh");
+    BvhReader* r = openBvh(fileName);
+    if(!r) {
+        TRACE_END();
+        return NULL;
+    }
+    Clip* clip = readerClip(r);
+    size_t total = (size_t) clip->numFrames * clip->numChannels;
+    clip->frames = malloc(total * sizeof(float));
+    if(!clip->frames && total > 0) {
+        fprintf(stderr, "BVH: sem memoria para os %d frames de %s\n", clip->numFrames, fileName);
+        closeBvh(r);
+        freeClip(clip);
+        TRACE_END();
+        return NULL;
+    }
+    int f = 0;
+    while(f < clip->numFrames && readBvhFrame(r, clip->frames + (size_t) f * clip->numChannels))
+        f++;
+    closeBvh(r);
+    if(f < clip->numFrames) {
+        fprintf(stderr, "BVH: %s tem %d de %d frames\n", fileName, f, clip->numFrames);
+        clip->numFrames = f;
+    }
+    clipAccount(clip);
+    TRACE_END();
+    return clip;
+}
+
+// **********************************************************************
+//  Gravacao em formato texto: a hierarquia e o cabecalho de MOTION sao
+//  gravados uma vez, e os frames um a um (permite gerar arquivos
+//  maiores que a memoria)
+// **********************************************************************
+static void writeJoint(FILE* fp, Node* n, int depth)
+{
+    int ind = depth * 2;
+    if(!n->parent)
+        fprintf(fp, "ROOT %s\n", n->name);
+    else if(n->channels == 0 && n->numChildren == 0)
+        fprintf(fp, "%*sEnd Site\n", ind, "");
+    else
+        fprintf(fp, "%*sJOINT %s\n", ind, "", n->name);
+    fprintf(fp, "%*s{\n", ind, "");
+    fprintf(fp, "%*sOFFSET %g %g %g\n", ind+2, "", n->offset[0], n->offset[1], n->offset[2]);
+    if(n->channels > 0 || n->numChildren > 0) {
+        fprintf(fp, "%*sCHANNELS %d", ind+2, "", n->channels);
+        for(int c=0; c<n->channels; c++)
+            fprintf(fp, " %s", channelNames[n->channelType[c]]);
+        fprintf(fp, "\n");
+    }
+    for(int i=0; i<n->numChildren; i++)
+        writeJoint(fp, n->children[i], depth+1);
+    fprintf(fp, "%*s}\n", ind, "");
+}
+
+// Grava HIERARCHY e o cabecalho de MOTION (clip->numFrames frames)
+void writeBvhHeader(FILE* fp, Clip* clip)
+{
+    fprintf(fp, "HIERARCHY\n");
+    writeJoint(fp, clip->root, 0);
+    fprintf(fp, "MOTION\nFrames:\t%d\nFrame Time:\t%g\n", clip->numFrames, clip->frameTime);
+}
+
+void writeBvhFrame(FILE* fp, Clip* clip, const float* frame)
+{
+    for(int c=0; c<clip->numChannels; c++)
+        fprintf(fp, "%g ", frame[c]);
+    fprintf(fp, "\n");
+}
+
+int saveBvh(Clip* clip, const char* fileName)
+{
+    FILE* fp = fopen(fileName, "w");
+    if(!fp)
+        return 0;
+    writeBvhHeader(fp, clip);
+    for(int f=0; f<clip->numFrames; f++)
+        writeBvhFrame(fp, clip, clipFrame(clip, f));
+    int ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+void freeClip(Clip* clip)
+{
+    if(!clip)
+        return;
+    for(int c=0; c<NUM_MEM; c++)
+        memAdd(c, -clip->mem[c]);
+    freeNode(clip->root);
+    free(clip->nodes);
+    free(clip->frames);
+    free(clip->stored);
+    free(clip->storedData);
+    free(clip->bind);
+    free(clip->frames16);
+    free(clip->quant);
+    free(clip->row);
+    mapClose(clip->map);
+    free(clip);
+}
+
+// Nome do tipo de canal como aparece em CHANNELS
+const char* channelName(int type)
+{
+    return channelNames[type];
+}
+
+// **********************************************************************
+//  Hash (FNV-1a) da hierarquia: nomes, pais, offsets e canais. Clips
+//  com o mesmo esqueleto tem o mesmo hash
+// **********************************************************************
+static unsigned long long hashBytes(unsigned long long h, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+    for(size_t i=0; i<len; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+unsigned long long skeletonHash(Clip* clip)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        int parent = n->parent ? n->parent->index : -1;
+        h = hashBytes(h, n->name, strlen(n->name) + 1);
+        h = hashBytes(h, &parent, sizeof(int));
+        h = hashBytes(h, n->offset, sizeof(n->offset));
+        h = hashBytes(h, n->channelType, n->channels);
+    }
+    return h;
+}
+
+// **********************************************************************
+//  Contabilidade de memoria
+// **********************************************************************
+
+// Bytes ocupados pela subarvore (nodos, canais e vetores de filhos)
+long long nodeMemory(Node* node)
+{
+    if(!node)
+        return 0;
+    long long bytes = sizeof(Node) + node->channels * sizeof(float)
+        + node->numChildren * sizeof(Node*);
+    for(int i=0; i<node->numChildren; i++)
+        bytes += nodeMemory(node->children[i]);
+    return bytes;
+}
+
+// **********************************************************************
+//  Bytes ocupados pelo clip em cada categoria de mem.h (bytes pode ser
+//  NULL). Retorna o total
+// **********************************************************************
+long long clipMemory(Clip* clip, long long bytes[NUM_MEM])
+{
+    long long b[NUM_MEM] = { 0 };
+    int cap = 32;
+    while(cap < clip->numNodes)
+        cap *= 2;
+    b[MEM_SKELETON] = sizeof(Clip) + nodeMemory(clip->root)
+        + (clip->nodes ? cap * sizeof(Node*) : 0);
+    if(clip->map)
+        b[MEM_FRAMES] = mapBytes(clip->map);
+    else if(clip->frames16)
+        b[MEM_FRAMES] = (long long) clip->numFrames * clip->numStored * sizeof(unsigned short)
+            + clip->numStored * (sizeof(int) + sizeof(float*) + sizeof(float) * (clip->quant ? 3 : 1))
+            + clip->numChannels * sizeof(float);
+    else if(clip->frames && clip->stored)
+        b[MEM_FRAMES] = (long long) clip->numFrames * clip->numStored * sizeof(float)
+            + clip->numStored * (sizeof(int) + sizeof(float*)) + clip->numChannels * sizeof(float);
+    else if(clip->frames)
+        b[MEM_FRAMES] = (long long) clip->numFrames * clip->numChannels * sizeof(float);
+
+    long long total = 0;
+    for(int c=0; c<NUM_MEM; c++) {
+        total += b[c];
+        if(bytes)
+            bytes[c] = b[c];
+    }
+    return total;
+}
+
+// Atualiza os contadores globais com o tamanho atual do clip
+void clipAccount(Clip* clip)
+{
+    long long b[NUM_MEM];
+    clipMemory(clip, b);
+    for(int c=0; c<NUM_MEM; c++) {
+        memAdd(c, b[c] - clip->mem[c]);
+        clip->mem[c] = b[c];
+    }
+}
+
+// **********************************************************************
+//  Cache binario: hierarquia + matriz de frames em float, sem parsing
+// **********************************************************************
+
+// Grava o cabecalho e a hierarquia; os frames (clip->numFrames) vem
+// em seguida, cada um com numChannels floats
+void writeClipCacheHeader(FILE* fp, Clip* clip)
+{
+    int version = CACHE_VERSION;
+    fwrite(CACHE_MAGIC, 1, 4, fp);
+    fwrite(&version, sizeof(int), 1, fp);
+    fwrite(&clip->numNodes, sizeof(int), 1, fp);
+    fwrite(&clip->numChannels, sizeof(int), 1, fp);
+    fwrite(&clip->numFrames, sizeof(int), 1, fp);
+    fwrite(&clip->frameTime, sizeof(float), 1, fp);
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        int parent = n->parent ? n->parent->index : -1;
+        fwrite(n->name, 1, sizeof(n->name), fp);
+        fwrite(&parent, sizeof(int), 1, fp);
+        fwrite(n->offset, sizeof(float), 3, fp);
+        fwrite(&n->channels, sizeof(int), 1, fp);
+        fwrite(n->channelType, 1, sizeof(n->channelType), fp);
+    }
+}
+
+int saveClipCache(Clip* clip, const char* fileName)
+{
+    FILE* fp = fopen(fileName, "wb");
+    if(!fp)
+        return 0;
+    writeClipCacheHeader(fp, clip);
+    if(clip->stored || clip->map)
+        for(int f=0; f<clip->numFrames; f++)
+            fwrite(clipFrame(clip, f), sizeof(float), clip->numChannels, fp);
+    else
+        fwrite(clip->frames, sizeof(float), (size_t) clip->numFrames * clip->numChannels, fp);
+    int ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+// Le o cabecalho de um cache (esqueleto, numFrames e frameTime) a partir
+// da posicao atual de fp, deixando fp no inicio dos frames. Retorna um
+// clip sem frames, ou NULL se o cabecalho for invalido
+Clip* readClipCacheHeader(FILE* fp)
+{
+    char magic[4];
+    int version, numNodes, numChannels;
+
+    Clip* clip = calloc(1, sizeof(Clip));
+    int ok = fread(magic, 1, 4, fp) == 4 && !memcmp(magic, CACHE_MAGIC, 4)
+        && fread(&version, sizeof(int), 1, fp) == 1 && version == CACHE_VERSION
+        && fread(&numNodes, sizeof(int), 1, fp) == 1
+        && fread(&numChannels, sizeof(int), 1, fp) == 1
+        && fread(&clip->numFrames, sizeof(int), 1, fp) == 1
+        && fread(&clip->frameTime, sizeof(float), 1, fp) == 1;
+
+    for(int i=0; ok && i<numNodes; i++) {
+        char name[20];
+        int parent, channels;
+        float ofs[3];
+        unsigned char types[6];
+        ok = fread(name, 1, sizeof(name), fp) == sizeof(name)
+            && fread(&parent, sizeof(int), 1, fp) == 1
+            && fread(ofs, sizeof(float), 3, fp) == 3
+            && fread(&channels, sizeof(int), 1, fp) == 1
+            && fread(types, 1, sizeof(types), fp) == sizeof(types)
+            && parent < i && channels >= 0 && channels <= 6;
+        if(!ok)
+            break;
+        name[sizeof(name)-1] = 0;
+        if(parent < 0 && clip->root) {
+            ok = 0;
+            break;
+        }
+        clipAddNode(clip, parent >= 0 ? clip->nodes[parent] : NULL, name, channels, types,
+                    ofs[0], ofs[1], ofs[2]);
+    }
+    ok = ok && clip->root && clip->numChannels == numChannels && clip->numFrames >= 0;
+    if(!ok) {
+        freeClip(clip);
+        return NULL;
+    }
+    return clip;
+}
+
+Clip* loadClipCache(const char* fileName)
+{
+    TRACE_BEGIN("loadClipCache");
+    FILE* fp = fopen(fileName, "rb");
+    if(!fp) {
+        TRACE_END();
+        return NULL;
+    }
+    Clip* clip = readClipCacheHeader(fp);
+    int ok = clip != NULL;
+    if(ok) {
+        size_t total = (size_t) clip->numFrames * clip->numChannels;
+        clip->frames = malloc(total * sizeof(float));
+        ok = (clip->frames || total == 0) && fread(clip->frames, sizeof(float), total, fp) == total;
+    }
+    fclose(fp);
+    if(!ok) {
+        fprintf(stderr, "BVH: cache invalido %s\n", fileName);
+        freeClip(clip);
+        clip = NULL;
+    }
+    else
+        clipAccount(clip);
+    TRACE_END();
+    return clip;
+}
+
+// **********************************************************************
+//  Canais constantes: os que variam menos que a tolerancia do seu tipo
+//  em todos os frames saem da matriz de frames e ficam em clip->bind e
+//  no channelData do nodo, gravados uma vez
+// **********************************************************************
+
+// 1 se um canal do tipo type, com valores entre lo e hi, e constante
+int constantChannel(int type, float lo, float hi)
+{
+    return hi - lo <= (type <= CH_ZPOS ? CONST_POS_TOL : CONST_ROT_TOL);
+}
+
+// Guarda na matriz de frames so as colunas dos canais que variam mais
+// que a tolerancia entre lo e hi (todas, se lo for NULL). Os outros vao
+// para clip->bind e channelData. Retorna quantas colunas ficaram, ou -1
+// se faltar memoria
+static int storeColumns(Clip* clip, const float* lo, const float* hi)
+{
+    int nc = clip->numChannels, frames = clip->numFrames;
+    int* stored = malloc(nc * sizeof(int));
+    float** storedData = malloc(nc * sizeof(float*));
+    float* bind = malloc(nc * sizeof(float));
+    if(!stored || !storedData || !bind) {
+        free(stored);
+        free(storedData);
+        free(bind);
+        return -1;
+    }
+    int ns = 0;
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        for(int k=0; k<n->channels; k++) {
+            int c = n->firstChannel + k;
+            if(lo && constantChannel(n->channelType[k], lo[c], hi[c]))
+                bind[c] = n->channelData[k] = (lo[c] + hi[c]) * 0.5f;
+            else {
+                bind[c] = n->channelData[k] = clip->frames[c];
+                storedData[ns] = &n->channelData[k];
+                stored[ns++] = c;
+            }
+        }
+    }
+    if(lo && ns == nc) {
+        free(stored);
+        free(storedData);
+        free(bind);
+        return ns;
+    }
+    // Compacta no lugar: a coluna s de um frame vem de stored[s] >= s
+    for(int f=0; f<frames && ns<nc; f++) {
+        float* dst = clip->frames + (size_t) f * ns;
+        const float* src = clip->frames + (size_t) f * nc;
+        for(int s=0; s<ns; s++)
+            dst[s] = src[stored[s]];
+    }
+    float* frames2 = realloc(clip->frames, ((size_t) frames * ns + 1) * sizeof(float));
+    if(frames2)
+        clip->frames = frames2;
+    clip->numStored = ns;
+    clip->stored = stored;
+    clip->storedData = storedData;
+    clip->bind = bind;
+    return ns;
+}
+
+// Retira da matriz de frames os canais constantes. Depois disso
+// clip->frames tem numStored colunas, e os frames completos so podem
+// ser lidos por clipFrame. Retorna quantos canais foram retirados
+int clipPackChannels(Clip* clip)
+{
+    int nc = clip->numChannels, frames = clip->numFrames;
+    if(clip->stored)
+        return nc - clip->numStored;
+    if(frames == 0 || nc == 0 || !clip->frames)
+        return 0;
+    float* lo = malloc(nc * sizeof(float));
+    float* hi = malloc(nc * sizeof(float));
+    if(!lo || !hi) {
+        free(lo);
+        free(hi);
+        return 0;
+    }
+    memcpy(lo, clip->frames, nc * sizeof(float));
+    memcpy(hi, clip->frames, nc * sizeof(float));
+    for(int f=1; f<frames; f++) {
+        const float* row = clip->frames + (size_t) f * nc;
+        for(int c=0; c<nc; c++) {
+            lo[c] = fminf(lo[c], row[c]);
+            hi[c] = fmaxf(hi[c], row[c]);
+        }
+    }
+    int ns = storeColumns(clip, lo, hi);
+    free(lo);
+    free(hi);
+    if(ns < 0 || !clip->stored)
+        return 0;
+    clipAccount(clip);
+    return nc - ns;
+}
+
+// **********************************************************************
+//  Armazenamento dos frames em 16 bits: float16 ou inteiro quantizado
+//  pela faixa de cada coluna. clipFrame e applyFrame convertem uma linha
+//  por vez de volta para float (F16C ou SSE2, se disponiveis)
+// **********************************************************************
+
+// **********************************************************************
+//  float -> float16 (IEEE 754 binario16), arredondando para o par mais
+//  proximo
+// **********************************************************************
+unsigned short floatToHalf(float v)
+{
+    uint32_t x;
+    memcpy(&x, &v, 4);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exp = (int) ((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if(((x >> 23) & 0xff) == 0xff)               // inf / NaN
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if(exp >= 31)                                // estouro: inf
+        return sign | 0x7c00;
+    if(exp <= 0) {                               // subnormal ou zero
+        if(exp < -10)
+            return sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if(rest > half || (rest == half && (h & 1)))
+            h++;
+        return sign | h;
+    }
+    uint32_t h = ((uint32_t) exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        h++;                                     // pode virar inf: correto
+    return sign | h;
+}
+
+// float16 -> float (exato)
+float halfToFloat(unsigned short h)
+{
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if(exp == 0x1f)                              // inf / NaN
+        x = sign | 0x7f800000 | (mant << 13);
+    else if(exp)
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    else {                                       // subnormal ou zero
+        float v = mant * (1.0f / 16777216.0f);
+        return sign ? -v : v;
+    }
+    float v;
+    memcpy(&v, &x, 4);
+    return v;
+}
+
+// Converte a matriz de frames (float) para storage. So a partir de
+// FRAMES_F32, e de uma vez: os valores originais sao descartados.
+// Retorna 0 se nao for possivel
+int clipSetStorage(Clip* clip, int storage)
+{
+    if(storage == clip->storage)
+        return 1;
+    if(clip->storage != FRAMES_F32 || !clip->frames || clip->numFrames == 0)
+        return 0;
+    if(!clip->stored && storeColumns(clip, NULL, NULL) < 0)
+        return 0;
+    int ns = clip->numStored, frames = clip->numFrames;
+    size_t total = (size_t) frames * ns;
+    // Folga no fim: a conversao le e grava 8 colunas por vez
+    unsigned short* data = malloc((total + 8) * sizeof(unsigned short));
+    float* quant = storage == FRAMES_Q16 ? malloc(2 * ns * sizeof(float)) : NULL;
+    float* row = malloc((ns + 8) * sizeof(float));
+    if(!data || !row || (storage == FRAMES_Q16 && !quant)) {
+        free(data);
+        free(quant);
+        free(row);
+        return 0;
+    }
+    if(storage == FRAMES_F16)
+        for(size_t i=0; i<total; i++)
+            data[i] = floatToHalf(clip->frames[i]);
+    else {
+        // valor = q * escala + minimo, com q em 0..65535
+        for(int s=0; s<ns; s++) {
+            float lo = clip->frames[s], hi = lo;
+            for(int f=1; f<frames; f++) {
+                lo = fminf(lo, clip->frames[(size_t) f * ns + s]);
+                hi = fmaxf(hi, clip->frames[(size_t) f * ns + s]);
+            }
+            float scale = (hi - lo) / 65535;
+            quant[s] = scale;
+            quant[ns + s] = lo;
+            for(int f=0; f<frames; f++) {
+                long q = scale > 0 ? lrintf((clip->frames[(size_t) f * ns + s] - lo) / scale) : 0;
+                data[(size_t) f * ns + s] = (unsigned short) (q < 0 ? 0 : q > 65535 ? 65535 : q);
+            }
+        }
+    }
+    free(clip->frames);
+    clip->frames = NULL;
+    clip->frames16 = data;
+    clip->quant = quant;
+    clip->row = row;
+    clip->storage = storage;
+    clipAccount(clip);
+    return 1;
+}
+
+// Linha frame da matriz de 16 bits -> numStored floats em out
+static void convertRow(Clip* clip, int frame, float* out)
+{
+    int ns = clip->numStored, s = 0;
+    const unsigned short* src = clip->frames16 + (size_t) frame * ns;
+    if(clip->storage == FRAMES_F16) {
+#ifdef __F16C__
+        for(; s+8 <= ns; s+=8)
+            _mm256_storeu_ps(out + s, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (src + s))));
+#endif
+        for(; s<ns; s++)
+            out[s] = halfToFloat(src[s]);
+        return;
+    }
+    const float* scale = clip->quant;
+    const float* offset = clip->quant + ns;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for(; s+4 <= ns; s+=4) {
+        __m128i q = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*) (src + s)), zero);
+        __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_loadu_ps(scale + s));
+        _mm_storeu_ps(out + s, _mm_add_ps(v, _mm_loadu_ps(offset + s)));
+    }
+#endif
+    for(; s<ns; s++)
+        out[s] = src[s] * scale[s] + offset[s];
+}
+
+// **********************************************************************
+//  Acesso aos frames
+// **********************************************************************
+
+// Canais do frame (numChannels valores). Em um clip compactado, o
+// frame e montado em clip->bind, e em um clip mapeado e copiado da
+// janela: o ponteiro vale ate a proxima chamada para o mesmo clip
+const float* clipFrame(Clip* clip, int frame)
+{
+    if(clip->map)
+        return mapFrame(clip->map, frame);
+    if(!clip->stored)
+        return clip->frames + (size_t) frame * clip->numChannels;
+    const float* row = clip->frames + (size_t) frame * clip->numStored;
+    if(clip->storage != FRAMES_F32) {
+        convertRow(clip, frame, clip->row);
+        row = clip->row;
+    }
+    for(int s=0; s<clip->numStored; s++)
+        clip->bind[clip->stored[s]] = row[s];
+    return clip->bind;
+}
+
+// Copia os canais do frame para channelData de cada nodo (em um clip
+// compactado, so os que variam)
+void applyFrame(Clip* clip, int frame)
+{
+    if(clip->stored) {
+        const float* row = clip->frames + (size_t) frame * clip->numStored;
+        if(clip->storage != FRAMES_F32) {
+            convertRow(clip, frame, clip->row);
+            row = clip->row;
+        }
+        for(int s=0; s<clip->numStored; s++)
+            *clip->storedData[s] = row[s];
+        return;
+    }
+    const float* data = clipFrame(clip, frame);
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        memcpy(n->channelData, data + n->firstChannel, n->channels * sizeof(float));
+    }
+}
+
+// **********************************************************************
+//  Cinematica direta
+//  world recebe uma matriz 4x4 por nodo (16 floats, por colunas, como
+//  no OpenGL): world = pai * T(offset) * R(canais, na ordem do arquivo)
+//  Se o nodo tem canais de posicao, eles substituem o offset (nos
+//  arquivos de exemplo a posicao da raiz ja e absoluta)
+// **********************************************************************
+
+// Transformacao local do nodo (matriz 4x4 por colunas)
+static void localMatrix(Node* n, const float* ch, float m[16])
+{
+    float r[9] = { 1,0,0, 0,1,0, 0,0,1 };  // rotacao acumulada, por linhas
+    float t[3] = { n->offset[0], n->offset[1], n->offset[2] };
+
+    for(int c=0; c<n->channels; c++) {
+        int type = n->channelType[c];
+        if(type <= CH_ZPOS) {
+            t[type] = ch[c];
+            continue;
+        }
+        float s = sinf(ch[c] * DEG2RAD), co = cosf(ch[c] * DEG2RAD);
+        // r = r * R(eixo)
+        for(int i=0; i<3; i++) {
+            float* row = &r[i*3];
+            float a, b;
+            switch(type) {
+            case CH_XROT:
+                a = row[1]; b = row[2];
+                row[1] = a*co + b*s;
+                row[2] = -a*s + b*co;
+                break;
+            case CH_YROT:
+                a = row[0]; b = row[2];
+                row[0] = a*co - b*s;
+                row[2] = a*s + b*co;
+                break;
+            default:
+                a = row[0]; b = row[1];
+                row[0] = a*co + b*s;
+                row[1] = -a*s + b*co;
+                break;
+            }
+        }
+    }
+    m[0] = r[0]; m[1] = r[3]; m[2] = r[6]; m[3] = 0;
+    m[4] = r[1]; m[5] = r[4]; m[6] = r[7]; m[7] = 0;
+    m[8] = r[2]; m[9] = r[5]; m[10] = r[8]; m[11] = 0;
+    m[12] = t[0]; m[13] = t[1]; m[14] = t[2]; m[15] = 1;
+}
+
+// c = a * b (4x4 por colunas)
+static void multMatrix(const float a[16], const float b[16], float c[16])
+{
+    for(int j=0; j<4; j++)
+        for(int i=0; i<4; i++)
+            c[j*4+i] = a[i]*b[j*4] + a[4+i]*b[j*4+1] + a[8+i]*b[j*4+2] + a[12+i]*b[j*4+3];
+}
+
+void forwardKinematics(Clip* clip, const float* frame, float* world)
+{
+    float local[16];
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        localMatrix(n, frame + n->firstChannel, local);
+        if(n->parent)
+            multMatrix(world + n->parent->index*16, local, world + i*16);
+        else
+            memcpy(world + i*16, local, sizeof(local));
+    }
+}
+
+// Mesma FK, com o produto de matrizes em SSE (uma coluna por registrador)
+void forwardKinematicsSimd(Clip* clip, const float* frame, float* world)
+{
+#ifdef __SSE__
+    float local[16];
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        localMatrix(n, frame + n->firstChannel, local);
+        float* w = world + i*16;
+        if(!n->parent) {
+            memcpy(w, local, sizeof(local));
+            continue;
+        }
+        const float* p = world + n->parent->index*16;
+        __m128 c0 = _mm_loadu_ps(p);
+        __m128 c1 = _mm_loadu_ps(p+4);
+        __m128 c2 = _mm_loadu_ps(p+8);
+        __m128 c3 = _mm_loadu_ps(p+12);
+        for(int j=0; j<4; j++) {
+            __m128 col = _mm_mul_ps(c0, _mm_set1_ps(local[j*4]));
+            col = _mm_add_ps(col, _mm_mul_ps(c1, _mm_set1_ps(local[j*4+1])));
+            col = _mm_add_ps(col, _mm_mul_ps(c2, _mm_set1_ps(local[j*4+2])));
+            col = _mm_add_ps(col, _mm_mul_ps(c3, _mm_set1_ps(local[j*4+3])));
+            _mm_storeu_ps(w + j*4, col);
+        }
+    }
+#else
+    forwardKinematics(clip, frame, world);
+#endif
+}
+
+// **********************************************************************
+//  Monta o vetor de vertices dos ossos (GL_LINES): para cada nodo com
+//  pai, a posicao do pai e a do nodo. verts precisa de 6*(numNodes-1)
+//  floats. Retorna a quantidade de vertices
+// **********************************************************************
+int buildBoneVertices(Clip* clip, const float* world, float* verts)
+{
+    int v = 0;
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        if(!n->parent)
+            continue;
+        const float* a = world + n->parent->index*16 + 12;
+        const float* b = world + i*16 + 12;
+        verts[v*3] = a[0]; verts[v*3+1] = a[1]; verts[v*3+2] = a[2];
+        v++;
+        verts[v*3] = b[0]; verts[v*3+1] = b[1]; verts[v*3+2] = b[2];
+        v++;
+    }
+    return v;
+}
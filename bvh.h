@@ -0,0 +1,117 @@
+// **********************************************************************
+//	bvh.h
+//  Hierarquia, leitura de arquivos BVH e cinematica direta (FK)
+//  Nao depende de OpenGL/GLUT
+// **********************************************************************
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdio.h>
+
+#include "mem.h"
+
+// Tipos de canal, na ordem em que aparecem em CHANNELS
+enum {
+    CH_XPOS, CH_YPOS, CH_ZPOS,
+    CH_XROT, CH_YROT, CH_ZROT
+};
+
+typedef struct Node Node;
+typedef struct ClipMap ClipMap;
+
+// Tamanho do nome de um nodo (com o terminador)
+#define NODE_NAME 20
+
+struct Node {
+    char name[NODE_NAME]; // nome
+    float offset[3];     // offset (deslocamento)
+    int channels;        // qtd de canais (3 ou 6)
+    float* channelData;  // vetor com os dados dos canais
+    int numChildren;     // qtd de filhos
+    Node** children;     // vetor de ponteiros para os filhos
+    Node* parent;        // ponteiro para o pai
+    unsigned char channelType[6]; // tipo de cada canal (CH_*)
+    int index;           // posicao em Clip.nodes
+    int firstChannel;    // indice do primeiro canal no vetor do frame
+};
+
+// Um arquivo BVH carregado: hierarquia + matriz de frames
+typedef struct {
+    Node* root;
+    Node** nodes;        // nodos em pre-ordem (pai antes dos filhos)
+    int numNodes;
+    int numChannels;     // canais por frame
+    int numFrames;
+    float frameTime;     // segundos por frame
+    float* frames;       // numFrames x numChannels (numStored, se compactado)
+    int numStored;       // canais guardados por frame (clipPackChannels)
+    int* stored;         // canal de cada coluna guardada (NULL: todos)
+    float** storedData;  // channelData correspondente a cada coluna
+    float* bind;         // numChannels: valores dos canais constantes;
+                         // clipFrame completa os outros a cada frame
+    int storage;         // FRAMES_* (clipSetStorage)
+    unsigned short* frames16; // numFrames x numStored, no lugar de frames
+    float* quant;        // FRAMES_Q16: escala e minimo de cada coluna
+    float* row;          // linha convertida para float
+    ClipMap* map;        // frames lidos do arquivo por janela (clipmap.c)
+    long long mem[NUM_MEM]; // bytes contabilizados em mem.c (clipAccount)
+} Clip;
+
+// Formato da matriz de frames na memoria
+enum {
+    FRAMES_F32,          // float
+    FRAMES_F16,          // float16 (meia precisao)
+    FRAMES_Q16           // 16 bits sem sinal na faixa de cada coluna
+};
+
+// Variacao maxima de um canal "constante" (o valor guardado e o meio da
+// faixa): abaixo da precisao com que os arquivos gravam os valores
+#define CONST_POS_TOL 0.001f     // unidades
+#define CONST_ROT_TOL 0.01f      // graus
+
+// Leitura incremental: hierarquia na abertura, frames um a um
+typedef struct BvhReader BvhReader;
+
+Node* createNode(char name[20], Node* parent, int numChannels, float ofx, float ofy, float ofz, int numChildren);
+void freeNode(Node* node);
+Node* clipAddNode(Clip* clip, Node* parent, const char* name, int numChannels,
+                  const unsigned char* types, float ofx, float ofy, float ofz);
+
+BvhReader* openBvh(const char* fileName);
+Clip* readerClip(BvhReader* r);
+int readBvhFrame(BvhReader* r, float* frame);
+void closeBvh(BvhReader* r);
+
+Clip* loadBvh(const char* fileName);
+Clip* loadClipCache(const char* fileName);
+int saveClipCache(Clip* clip, const char* fileName);
+void writeClipCacheHeader(FILE* fp, Clip* clip);
+Clip* readClipCacheHeader(FILE* fp);
+void freeClip(Clip* clip);
+
+const char* channelName(int type);
+unsigned long long skeletonHash(Clip* clip);
+
+long long nodeMemory(Node* node);
+long long clipMemory(Clip* clip, long long bytes[NUM_MEM]);
+void clipAccount(Clip* clip);
+
+void writeBvhHeader(FILE* fp, Clip* clip);
+void writeBvhFrame(FILE* fp, Clip* clip, const float* frame);
+int saveBvh(Clip* clip, const char* fileName);
+
+int constantChannel(int type, float lo, float hi);
+int clipPackChannels(Clip* clip);
+int clipSetStorage(Clip* clip, int storage);
+unsigned short floatToHalf(float v);
+float halfToFloat(unsigned short h);
+
+const float* clipFrame(Clip* clip, int frame);
+void applyFrame(Clip* clip, int frame);
+
+void forwardKinematics(Clip* clip, const float* frame, float* world);
+void forwardKinematicsSimd(Clip* clip, const float* frame, float* world);
+int buildBoneVertices(Clip* clip, const float* world, float* verts);
+
+#endif
@@ -0,0 +1,350 @@
+// **********************************************************************
+//	bvhgen.c
+//  Gera arquivos BVH sinteticos grandes para testes de escala
+//
+//  Uso: bvhgen [opcoes] saida.bvh
+//   -j juntas      quantidade de juntas do esqueleto sintetico (21)
+//   -D prof        profundidade maxima da hierarquia (8; 2 ou mais se -j > 1)
+//   -c ordem       ordem das rotacoes: ZXY, XYZ, ... ou "random" (ZXY)
+//   -f frames      quantidade de frames (1000)
+//   -t seg         tempo de cada frame (1/30; com -i, o do clip base)
+//   -v dist        distribuicao dos valores: sine, uniform ou gauss (sine)
+//   -a graus       amplitude das rotacoes (30)
+//   -k copias      replica o esqueleto (varios personagens) (1)
+//   -s semente     semente do gerador (1)
+//   -i base.bvh    deriva do clip base em vez de gerar um esqueleto:
+//   -x fator       estica o clip no tempo: a duracao e multiplicada pelo
+//                  fator, com o mesmo tempo de frame (interpolando) (1)
+//   -n graus       ruido gaussiano somado as rotacoes (0)
+//
+//  Os frames sao gerados e gravados um a um: o tamanho da saida nao
+//  depende da memoria disponivel
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bvh.h"
+
+#define PI 3.14159265358979f
+
+enum { DIST_SINE, DIST_UNIFORM, DIST_GAUSS };
+
+// Parametros de uma onda por canal (distribuicao sine)
+typedef struct {
+    float freq;     // Hz
+    float phase;
+    float amp;
+} Wave;
+
+static unsigned long long rngState = 1;
+
+// xorshift64*: repetivel entre plataformas
+static unsigned int rnd()
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (unsigned int) ((rngState * 2685821657736338717ULL) >> 32);
+}
+
+// Uniforme em [0,1)
+static float rndf()
+{
+    return rnd() / 4294967296.0f;
+}
+
+// Normal padrao (Box-Muller)
+static float rndGauss()
+{
+    float u = rndf(), v = rndf();
+    return sqrtf(-2.0f * logf(u + 1e-12f)) * cosf(2 * PI * v);
+}
+
+// Converte "ZXY" em tipos de canal; "random" sorteia uma ordem
+static int parseOrder(const char* str, unsigned char order[3])
+{
+    static const char* orders[6] = { "XYZ", "XZY", "YXZ", "YZX", "ZXY", "ZYX" };
+    if(!strcmp(str, "random"))
+        str = orders[rnd() % 6];
+    if(strlen(str) != 3)
+        return 0;
+    for(int i=0; i<3; i++) {
+        if(str[i] < 'X' || str[i] > 'Z')
+            return 0;
+        order[i] = CH_XROT + (str[i] - 'X');
+    }
+    return 1;
+}
+
+// **********************************************************************
+//  Esqueleto sintetico: uma cadeia de 'depth' juntas a partir da raiz
+//  (garante a profundidade pedida) e as demais penduradas em pais
+//  sorteados, respeitando a profundidade maxima
+// **********************************************************************
+static Clip* syntheticSkeleton(int joints, int depth, const char* orderStr)
+{
+    Clip* clip = calloc(1, sizeof(Clip));
+    int* level = malloc(joints * sizeof(int));
+    Node** parents = malloc(joints * sizeof(Node*));
+    unsigned char types[6] = { CH_XPOS, CH_YPOS, CH_ZPOS };
+    char name[20];
+
+    // Sorteia os pais antes: os nodos precisam ser criados em pre-ordem
+    int* parentOf = malloc(joints * sizeof(int));
+    parentOf[0] = -1;
+    level[0] = 0;
+    for(int i=1; i<joints; i++) {
+        int p;
+        if(i < depth)
+            p = i-1;
+        else
+            do {
+                p = rnd() % i;
+            } while(level[p] >= depth-1);
+        parentOf[i] = p;
+        level[i] = level[p] + 1;
+    }
+
+    // Pre-ordem: percorre recursivamente por uma pilha explicita
+    int* stack = malloc(joints * sizeof(int));
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        int i = stack[--top];
+        Node* parent = parentOf[i] >= 0 ? parents[parentOf[i]] : NULL;
+        float len = 5 + rndf() * 20;
+        if(!parent) {
+            parseOrder(orderStr, types + 3);
+            parents[i] = clipAddNode(clip, NULL, "Hips", 6, types, 0, 100, 0);
+        }
+        else {
+            snprintf(name, sizeof(name), "J%d", i);
+            parseOrder(orderStr, types + 3);
+            parents[i] = clipAddNode(clip, parent, name, 3, types + 3,
+                                     (rndf()-0.5f) * len, len, (rndf()-0.5f) * len);
+        }
+        int leaf = 1;
+        for(int c=joints-1; c>i; c--)
+            if(parentOf[c] == i) {
+                stack[top++] = c;
+                leaf = 0;
+            }
+        // Folhas terminam em um End Site
+        if(leaf) {
+            snprintf(name, sizeof(name), "EndJ%d", i);
+            clipAddNode(clip, parents[i], name, 0, NULL, 0, 5 + rndf() * 10, 0);
+        }
+    }
+    free(stack);
+    free(parentOf);
+    free(parents);
+    free(level);
+    return clip;
+}
+
+// **********************************************************************
+//  Replica a hierarquia de src 'copies' vezes sob uma raiz "World"
+//  (6 canais, sempre zero)
+// **********************************************************************
+static void copyJoint(Clip* dst, Node* parent, Node* n, int copy)
+{
+    char name[NODE_NAME], suffix[16];
+    if(copy > 0) {
+        // Corta o nome o quanto for preciso para o sufixo caber inteiro
+        int len = snprintf(suffix, sizeof(suffix), "_%d", copy);
+        snprintf(name, sizeof(name), "%.*s%s", NODE_NAME-1 - len, n->name, suffix);
+    }
+    else
+        snprintf(name, sizeof(name), "%s", n->name);
+    Node* c = clipAddNode(dst, parent, name, n->channels, n->channelType,
+                          n->offset[0], n->offset[1], n->offset[2]);
+    for(int i=0; i<n->numChildren; i++)
+        copyJoint(dst, c, n->children[i], copy);
+}
+
+static Clip* replicate(Clip* src, int copies)
+{
+    Clip* dst = calloc(1, sizeof(Clip));
+    Node* world = clipAddNode(dst, NULL, "World", 6, NULL, 0, 0, 0);
+    for(int k=0; k<copies; k++)
+        copyJoint(dst, world, src->root, k);
+    return dst;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvhgen [-j juntas] [-D prof] [-c ordem|random] [-f frames] [-t seg]\n"
+                    "              [-v sine|uniform|gauss] [-a graus] [-k copias] [-s semente]\n"
+                    "              [-i base.bvh [-x fator] [-n graus]] saida.bvh\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int joints = 21, depth = 8, frames = 1000, copies = 1, dist = DIST_SINE;
+    float frameTime = 1/30.0f, amp = 30, stretch = 1, noise = 0;
+    const char* order = "ZXY";
+    const char* base = NULL;
+    const char* outName = NULL;
+    int framesSet = 0, timeSet = 0;
+
+    for(int i=1; i<argc; i++) {
+        if(argv[i][0] != '-') {
+            outName = argv[i];
+            continue;
+        }
+        if(i+1 >= argc)
+            usage();
+        char opt = argv[i][1];
+        const char* val = argv[++i];
+        switch(opt) {
+        case 'j': joints = atoi(val); break;
+        case 'D': depth = atoi(val); break;
+        case 'c': order = val; break;
+        case 'f': frames = atoi(val); framesSet = 1; break;
+        case 't': frameTime = atof(val); timeSet = 1; break;
+        case 'a': amp = atof(val); break;
+        case 'k': copies = atoi(val); break;
+        case 's': rngState = strtoull(val, NULL, 10) * 0x9E3779B97F4A7C15ULL + 1; break;
+        case 'i': base = val; break;
+        case 'x': stretch = atof(val); break;
+        case 'n': noise = atof(val); break;
+        case 'v':
+            if(!strcmp(val, "sine")) dist = DIST_SINE;
+            else if(!strcmp(val, "uniform")) dist = DIST_UNIFORM;
+            else if(!strcmp(val, "gauss")) dist = DIST_GAUSS;
+            else usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    unsigned char test[3];
+    // Com prof 1 so cabe a raiz: as outras juntas nao teriam pai
+    if(!outName || joints < 1 || depth < 1 || (depth < 2 && joints > 1 && !base)
+       || frames < 1 || copies < 1 || stretch <= 0 || frameTime <= 0
+       || (strcmp(order, "random") && !parseOrder(order, test)))
+        usage();
+
+    // Esqueleto modelo: sintetico ou lido do clip base
+    Clip* model;
+    if(base) {
+        model = loadBvh(base);
+        if(!model || model->numFrames == 0) {
+            fprintf(stderr, "bvhgen: erro ao ler %s\n", base);
+            return 1;
+        }
+        if(!timeSet)
+            frameTime = model->frameTime;
+        if(!framesSet)
+            frames = (int) (model->numFrames * model->frameTime * stretch / frameTime);
+    }
+    else
+        model = syntheticSkeleton(joints, depth > joints ? joints : depth, order);
+
+    // Sem copias, out e o proprio modelo: guarda antes os frames do base
+    int baseFrames = model->numFrames;
+    Clip* out = copies > 1 ? replicate(model, copies) : model;
+    out->numFrames = frames;
+    out->frameTime = frameTime;
+
+    FILE* fp = fopen(outName, "w");
+    if(!fp) {
+        perror(outName);
+        return 1;
+    }
+    writeBvhHeader(fp, out);
+
+    // Ondas por canal e por copia (so no esqueleto sintetico)
+    int mc = model->numChannels;
+    Wave* waves = malloc((size_t) copies * mc * sizeof(Wave));
+    for(int i=0; i<copies*mc; i++) {
+        waves[i].freq = 0.2f + rndf() * 1.8f;
+        waves[i].phase = rndf() * 2 * PI;
+        waves[i].amp = amp * (0.2f + rndf() * 0.8f);
+    }
+
+    // Quais canais do modelo sao rotacoes, e o canal X da raiz (onde
+    // cada copia e deslocada para nao sobrepor as outras)
+    unsigned char* isRot = malloc(mc);
+    int rootX = -1;
+    for(int j=0; j<model->numNodes; j++) {
+        Node* n = model->nodes[j];
+        for(int c=0; c<n->channels; c++) {
+            isRot[n->firstChannel + c] = n->channelType[c] >= CH_XROT;
+            if(j == 0 && n->channelType[c] == CH_XPOS)
+                rootX = c;
+        }
+    }
+
+    float* frame = malloc(out->numChannels * sizeof(float));
+    for(long f=0; f<frames; f++) {
+        float t = f * frameTime;
+        int c = 0;
+        if(copies > 1)
+            for(; c<6; c++)
+                frame[c] = 0;
+        for(int k=0; k<copies; k++) {
+            float* dst = frame + c + (size_t) k * mc;
+            Wave* w = waves + (size_t) k * mc;
+            if(base) {
+                // Amostra o clip base (em loop) no tempo f / stretch, com
+                // deslocamento por copia
+                double src = fmod(f * (double) frameTime / (model->frameTime * stretch) + k * 37.0,
+                                  baseFrames);
+                int f0 = (int) src;
+                int f1 = (f0 + 1) % baseFrames;
+                float u = (float) (src - f0);
+                const float* a = clipFrame(model, f0);
+                const float* b = clipFrame(model, f1);
+                for(int i=0; i<mc; i++) {
+                    float d = b[i] - a[i];
+                    // Rotacoes: interpola pelo menor arco
+                    if(isRot[i]) {
+                        if(d > 180) d -= 360;
+                        if(d < -180) d += 360;
+                    }
+                    dst[i] = a[i] + u * d;
+                    if(isRot[i] && noise > 0)
+                        dst[i] += rndGauss() * noise;
+                }
+            }
+            else {
+                for(int i=0; i<mc; i++) {
+                    switch(dist) {
+                    case DIST_SINE:
+                        dst[i] = w[i].amp * sinf(2 * PI * w[i].freq * t + w[i].phase);
+                        break;
+                    case DIST_UNIFORM:
+                        dst[i] = (rndf() * 2 - 1) * amp;
+                        break;
+                    default:
+                        dst[i] = rndGauss() * amp;
+                        break;
+                    }
+                }
+                // Raiz: anda em Z com oscilacao vertical
+                dst[0] = 0;
+                dst[1] = 100 + 3 * sinf(4 * PI * t);
+                dst[2] = 120 * t;
+            }
+            if(rootX >= 0)
+                dst[rootX] += k * 150.0f;
+        }
+        writeBvhFrame(fp, out, frame);
+    }
+
+    int ok = !ferror(fp);
+    fclose(fp);
+    fprintf(stderr, "%s: %d juntas, %d canais, %d frames\n", outName, out->numNodes, out->numChannels, frames);
+    free(frame);
+    free(isRot);
+    free(waves);
+    if(out != model)
+        freeClip(out);
+    freeClip(model);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+// **********************************************************************
+//	bvhgraph.c
+//  Gera o grafo de movimento (transicoes entre clips) de uma biblioteca
+//
+//  Uso: bvhgraph [-o grafo] [-j threads] [-t dist] [-g seg] [-l] entrada...
+//   -o arquivo   grafo binario (graph.bin)
+//   -j threads   threads (todos os processadores)
+//   -t dist      custo maximo de uma transicao: distancia media por
+//                junta, em unidades do arquivo (6)
+//   -g seg       distancia minima entre frames do mesmo clip (0.5)
+//   -l           lista as transicoes (TSV) na saida padrao
+//   entrada: arquivos .bvh ou diretorios (todos os .bvh dentro deles)
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "bvh.h"
+#include "graph.h"
+#include "pool.h"
+#include "timer.h"
+
+static char** inputs;
+static int numInputs;
+static Clip** clips;
+static atomic_int failures;
+
+static void loadTask(int i, void* arg)
+{
+    (void) arg;
+    if(!(clips[i] = loadBvh(inputs[i])))
+        atomic_fetch_add(&failures, 1);
+}
+
+static void addInput(const char* path)
+{
+    static int cap = 0;
+    if(numInputs == cap) {
+        cap = cap ? cap*2 : 64;
+        inputs = realloc(inputs, cap * sizeof(char*));
+    }
+    inputs[numInputs] = malloc(strlen(path) + 1);
+    strcpy(inputs[numInputs++], path);
+}
+
+// Acrescenta path, ou os .bvh dentro dele se for um diretorio
+static void addInputs(const char* path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        addInput(path);
+        return;
+    }
+    DIR* d = opendir(path);
+    struct dirent* de;
+    char name[4096];
+    if(!d)
+        return;
+    while((de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if(len < 4 || strcmp(de->d_name + len - 4, ".bvh"))
+            continue;
+        snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+        addInput(name);
+    }
+    closedir(d);
+}
+
+static int cmpString(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvhgraph [-o grafo] [-j threads] [-t dist] [-g seg] [-l] entrada...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* outName = "graph.bin";
+    GraphOptions opt = { 6, 0.5f, poolDefaultThreads() };
+    int list = 0;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-o") && i+1 < argc)
+            outName = argv[++i];
+        else if(!strcmp(argv[i], "-j") && i+1 < argc)
+            opt.numThreads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-t") && i+1 < argc)
+            opt.threshold = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-g") && i+1 < argc)
+            opt.minGap = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-l"))
+            list = 1;
+        else if(argv[i][0] == '-')
+            usage();
+        else
+            addInputs(argv[i]);
+    }
+    if(numInputs == 0 || opt.numThreads < 1 || opt.threshold <= 0)
+        usage();
+    if(numInputs > GRAPH_MAX_CLIPS) {
+        fprintf(stderr, "bvhgraph: no maximo %d clips\n", GRAPH_MAX_CLIPS);
+        return 1;
+    }
+    qsort(inputs, numInputs, sizeof(char*), cmpString);
+
+    double start = timerNow();
+    clips = calloc(numInputs, sizeof(Clip*));
+    poolRun(opt.numThreads, numInputs, loadTask, NULL);
+    if(atomic_load(&failures)) {
+        fprintf(stderr, "bvhgraph: %d arquivo(s) com erro\n", atomic_load(&failures));
+        return 1;
+    }
+    double loaded = timerNow();
+
+    GraphStats st;
+    MotionGraph* g = graphBuild(clips, numInputs, &opt, &st);
+    double built = timerNow();
+
+    long long frames = 0;
+    for(int c=0; c<numInputs; c++)
+        frames += clips[c]->numFrames;
+    fprintf(stderr, "bvhgraph: %d clips, %lld frames, %lld pares, %.1f M distancias\n",
+            numInputs, frames, st.pairs, st.distances / 1e6);
+    fprintf(stderr, "  tempo: leitura %.0f ms, poses %.0f ms, matrizes %.0f ms (%.1f ns/distancia), total %.0f ms, %d threads\n",
+            loaded - start, st.featureMs, st.matrixMs,
+            st.distances ? st.matrixMs * 1e6 / st.distances : 0, built - start, opt.numThreads);
+    fprintf(stderr, "  memoria: poses %.1f MB, blocos %d KB por thread, grafo %.1f KB (%d transicoes, %d bytes cada)\n",
+            st.featureBytes / 1048576.0, (int) ((GRAPH_TILE+2) * (GRAPH_TILE+2) * sizeof(float) / 1024),
+            st.graphBytes / 1024.0, g->numEdges, (int) sizeof(GraphEdge));
+
+    if(list) {
+        printf("origem\tframe\tdestino\tframe\tcusto\n");
+        for(int c=0; c<g->numClips; c++)
+            for(int e=g->first[c]; e<g->first[c+1]; e++) {
+                GraphEdge* ed = &g->edges[e];
+                printf("%s\t%d\t%s\t%d\t%.2f\n", inputs[c], ed->srcFrame,
+                       inputs[ed->dstClip], ed->dstFrame, ed->cost / 100.0f);
+            }
+    }
+    int ok = graphSave(g, inputs, outName);
+    if(!ok)
+        perror(outName);
+
+    graphFree(g);
+    for(int c=0; c<numInputs; c++) {
+        freeClip(clips[c]);
+        free(inputs[c]);
+    }
+    free(clips);
+    free(inputs);
+    return ok ? 0 : 1;
+}
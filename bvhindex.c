@@ -0,0 +1,80 @@
+// **********************************************************************
+//	bvhindex.c
+//  Gera ou atualiza o catalogo de uma biblioteca de clips
+//
+//  Uso: bvhindex [-o catalogo] [-j threads] [-H] dir
+//   -o arquivo     catalogo (dir/catalog.tsv)
+//   -j threads     threads de leitura (todos os processadores)
+//   -H             so os cabecalhos: sem distancia percorrida e bbox
+//
+//  So os arquivos novos ou modificados (data ou tamanho) desde a
+//  ultima execucao sao lidos
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalog.h"
+#include "pool.h"
+#include "timer.h"
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvhindex [-o catalogo] [-j threads] [-H] dir\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* dir = NULL;
+    const char* outName = NULL;
+    char defaultName[1024];
+    int threads = poolDefaultThreads();
+    int headersOnly = 0;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-H"))
+            headersOnly = 1;
+        else if(!strcmp(argv[i], "-o") && i+1 < argc)
+            outName = argv[++i];
+        else if(!strcmp(argv[i], "-j") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(argv[i][0] != '-')
+            dir = argv[i];
+        else
+            usage();
+    }
+    if(!dir || threads < 1)
+        usage();
+    if(!outName) {
+        snprintf(defaultName, sizeof(defaultName), "%s/%s", dir, CATALOG_FILE);
+        outName = defaultName;
+    }
+
+    double start = timerNow();
+    Catalog cat;
+    int previous = catalogLoad(outName, &cat);
+    int indexed = catalogUpdate(&cat, dir, threads, headersOnly);
+    if(!catalogSave(outName, &cat)) {
+        perror(outName);
+        catalogFree(&cat);
+        return 1;
+    }
+
+    int failed = 0;
+    double duration = 0;
+    for(int i=0; i<cat.numEntries; i++) {
+        if(!cat.entries[i].ok)
+            failed++;
+        duration += cat.entries[i].duration;
+    }
+    fprintf(stderr, "%s: %d arquivos (%d lidos, %d do catalogo anterior, %d com erro), "
+            "%.1f min de animacao, %.0f ms, %d threads\n",
+            outName, cat.numEntries, indexed, previous < 0 ? 0 : cat.numEntries - indexed,
+            failed, duration / 60, timerNow() - start, threads);
+    catalogFree(&cat);
+    return 0;
+}
@@ -0,0 +1,182 @@
+// **********************************************************************
+//	bvhkeys.c
+//  Reduz os keyframes de uma biblioteca com erro limitado e relata, por
+//  clip, a taxa de compressao, o erro maximo nas extremidades e o tempo
+//  de reconstrucao de um frame
+//
+//  Uso: bvhkeys [-t erro] [-j threads] entrada...
+//   -t erro      distancia maxima das extremidades (End Sites) as
+//                posicoes originais, em unidades do arquivo (1)
+//   -j threads   threads (todos os processadores)
+//   entrada: arquivos .bvh ou diretorios (todos os .bvh dentro deles)
+//
+//  Saida (TSV): clip, frames, canais, keys, bytes originais, bytes
+//  reduzidos, taxa, erro maximo, passadas, ns por frame reconstruido
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "bvh.h"
+#include "keys.h"
+#include "pool.h"
+#include "timer.h"
+
+typedef struct {
+    int ok;
+    int frames;
+    int channels;
+    int keys;
+    long long rawBytes;
+    long long keyBytes;
+    KeyStats stats;
+    double decodeNs;
+} ClipReport;
+
+static char** inputs;
+static int numInputs;
+static float tolerance = 1;
+static ClipReport* reports;
+static atomic_int failures;
+
+// Reduz inputs[i] e mede a reconstrucao de todos os frames
+static void reduceTask(int i, void* arg)
+{
+    (void) arg;
+    ClipReport* rep = &reports[i];
+    Clip* clip = loadBvh(inputs[i]);
+    KeyClip k;
+    if(!clip || !keysReduce(clip, tolerance, &k, &rep->stats)) {
+        atomic_fetch_add(&failures, 1);
+        if(clip)
+            freeClip(clip);
+        return;
+    }
+    rep->ok = 1;
+    rep->frames = clip->numFrames;
+    rep->channels = clip->numChannels;
+    rep->keys = k.numKeys;
+    rep->rawBytes = (long long) clip->numFrames * clip->numChannels * sizeof(float);
+    rep->keyBytes = keysBytes(&k);
+
+    float* frame = malloc(clip->numChannels * sizeof(float));
+    volatile float sink = 0;
+    int reps = 1 + 10000 / clip->numFrames;
+    double start = timerNow();
+    for(int r=0; r<reps; r++)
+        for(int f=0; f<clip->numFrames; f++) {
+            keysDecode(&k, f, frame);
+            sink += frame[0];
+        }
+    rep->decodeNs = (timerNow() - start) * 1e6 / ((double) reps * clip->numFrames);
+    free(frame);
+    keysFree(&k);
+    freeClip(clip);
+}
+
+static void addInput(const char* path)
+{
+    static int cap = 0;
+    if(numInputs == cap) {
+        cap = cap ? cap*2 : 64;
+        inputs = realloc(inputs, cap * sizeof(char*));
+    }
+    inputs[numInputs] = malloc(strlen(path) + 1);
+    strcpy(inputs[numInputs++], path);
+}
+
+// Acrescenta path, ou os .bvh dentro dele se for um diretorio
+static void addInputs(const char* path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        addInput(path);
+        return;
+    }
+    DIR* d = opendir(path);
+    struct dirent* de;
+    char name[4096];
+    if(!d)
+        return;
+    while((de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if(len < 4 || strcmp(de->d_name + len - 4, ".bvh"))
+            continue;
+        snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+        addInput(name);
+    }
+    closedir(d);
+}
+
+static int cmpString(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvhkeys [-t erro] [-j threads] entrada...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int threads = poolDefaultThreads();
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-t") && i+1 < argc)
+            tolerance = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(argv[i][0] == '-')
+            usage();
+        else
+            addInputs(argv[i]);
+    }
+    if(numInputs == 0 || threads < 1 || tolerance <= 0)
+        usage();
+    qsort(inputs, numInputs, sizeof(char*), cmpString);
+
+    reports = calloc(numInputs, sizeof(ClipReport));
+    double start = timerNow();
+    poolRun(threads, numInputs, reduceTask, NULL);
+    double elapsed = timerNow() - start;
+
+    long long raw = 0, reduced = 0, frames = 0, keys = 0, values = 0;
+    float worst = 0;
+    printf("clip\tframes\tcanais\tkeys\tbytes\treduzido\ttaxa\terro\tpassadas\tns/frame\n");
+    for(int i=0; i<numInputs; i++) {
+        ClipReport* r = &reports[i];
+        if(!r->ok) {
+            fprintf(stderr, "bvhkeys: erro em %s\n", inputs[i]);
+            continue;
+        }
+        printf("%s\t%d\t%d\t%d\t%lld\t%lld\t%.2f\t%.4f\t%d\t%.0f\n", inputs[i], r->frames, r->channels,
+               r->keys, r->rawBytes, r->keyBytes, (double) r->rawBytes / r->keyBytes,
+               r->stats.maxError, r->stats.passes, r->decodeNs);
+        raw += r->rawBytes;
+        reduced += r->keyBytes;
+        frames += r->frames;
+        keys += r->keys;
+        values += (long long) r->frames * r->channels;
+        if(r->stats.maxError > worst)
+            worst = r->stats.maxError;
+    }
+    fprintf(stderr, "bvhkeys: %d clips, %lld frames, %lld de %lld valores mantidos como keys (%.1f%%)\n",
+            numInputs, frames, keys, values, values ? 100.0 * keys / values : 0);
+    fprintf(stderr, "  %.1f KB -> %.1f KB (%.2fx), erro maximo %.4f (limite %g), %.0f ms, %d threads\n",
+            raw / 1024.0, reduced / 1024.0, reduced ? (double) raw / reduced : 0, worst, tolerance,
+            elapsed, threads);
+
+    for(int i=0; i<numInputs; i++)
+        free(inputs[i]);
+    free(inputs);
+    free(reports);
+    return atomic_load(&failures) ? 1 : 0;
+}
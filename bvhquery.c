@@ -0,0 +1,223 @@
+// **********************************************************************
+//	bvhquery.c
+//  Procura frames por predicados sobre as posicoes globais das juntas
+//
+//  Uso: bvhquery [-j threads] [-e expr]... [-s] entrada...
+//   -e expr      consulta (pode repetir); sem -e, le uma consulta por
+//                linha da entrada padrao
+//   -j threads   threads (todos os processadores)
+//   -s           so o resumo de cada consulta, sem as faixas
+//   entrada: arquivos .bvh ou diretorios (todos os .bvh dentro deles)
+//
+//  Exemplos (unidades do arquivo; nos clips de exemplo, centimetros):
+//   bvhquery -e "LeftHand.y > Head.y" bvh
+//   bvhquery -e "root.hspeed > 300" bvh
+//   bvhquery -e "dist(LeftHand, RightHand) < 10 && root.vy < -50" bvh
+//
+//  Os clips sao lidos e pre-calculados (FK) uma vez; cada consulta
+//  percorre so as colunas das juntas citadas, em paralelo entre clips
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "bvh.h"
+#include "pool.h"
+#include "query.h"
+#include "timer.h"
+
+// Resultado de uma consulta em um clip
+typedef struct {
+    FrameRange* ranges;
+    int numRanges;       // -1 se o clip nao tem as juntas citadas
+} Result;
+
+static char** inputs;
+static int numInputs;
+static Tracks* tracks;
+static atomic_int failures;
+static Query* query;
+static Result* results;
+
+// Le e pre-calcula inputs[i]; chamada pelas threads do pool
+static void bakeTask(int i, void* arg)
+{
+    (void) arg;
+    Clip* clip = loadBvh(inputs[i]);
+    if(!clip || !bakeTracks(clip, &tracks[i]))
+        atomic_fetch_add(&failures, 1);
+    else {
+        tracks[i].path = inputs[i];
+        inputs[i] = NULL;
+    }
+    if(clip)
+        freeClip(clip);
+}
+
+static void queryTask(int i, void* arg)
+{
+    (void) arg;
+    results[i].ranges = NULL;
+    results[i].numRanges = tracks[i].pos ? queryRun(query, &tracks[i], &results[i].ranges) : -1;
+}
+
+// Compila, executa e imprime uma consulta. Retorna 0 em erro de sintaxe
+static int runQuery(const char* expr, int threads, int summary)
+{
+    char err[256];
+    query = queryCompile(expr, err, sizeof(err));
+    if(!query) {
+        fprintf(stderr, "bvhquery: %s: %s\n", expr, err);
+        return 0;
+    }
+
+    double start = timerNow();
+    poolRun(threads, numInputs, queryTask, NULL);
+    double elapsed = timerNow() - start;
+
+    int clips = 0, ranges = 0, missing = 0;
+    long long frames = 0;
+    for(int i=0; i<numInputs; i++) {
+        Result* r = &results[i];
+        if(r->numRanges < 0) {
+            missing += tracks[i].pos != NULL;
+            continue;
+        }
+        if(r->numRanges == 0)
+            continue;
+        clips++;
+        ranges += r->numRanges;
+        if(!summary)
+            printf("%s:", tracks[i].path);
+        for(int k=0; k<r->numRanges; k++) {
+            frames += r->ranges[k].last - r->ranges[k].first + 1;
+            if(!summary)
+                printf(" %d-%d", r->ranges[k].first, r->ranges[k].last);
+        }
+        if(!summary)
+            printf("\n");
+        free(r->ranges);
+    }
+    printf("# %s: %d clips, %d faixas, %lld frames", expr, clips, ranges, frames);
+    if(missing)
+        printf(" (%d clips sem as juntas)", missing);
+    printf(", %.2f ms\n", elapsed);
+    fflush(stdout);
+    queryFree(query);
+    return 1;
+}
+
+static void addInput(const char* path)
+{
+    static int cap = 0;
+    if(numInputs == cap) {
+        cap = cap ? cap*2 : 64;
+        inputs = realloc(inputs, cap * sizeof(char*));
+    }
+    inputs[numInputs] = malloc(strlen(path) + 1);
+    strcpy(inputs[numInputs++], path);
+}
+
+// Acrescenta path, ou os .bvh dentro dele se for um diretorio
+static void addInputs(const char* path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        addInput(path);
+        return;
+    }
+    DIR* d = opendir(path);
+    struct dirent* de;
+    char name[4096];
+    if(!d)
+        return;
+    while((de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if(len < 4 || strcmp(de->d_name + len - 4, ".bvh"))
+            continue;
+        snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+        addInput(name);
+    }
+    closedir(d);
+}
+
+static int cmpString(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvhquery [-j threads] [-e expr]... [-s] entrada...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int threads = poolDefaultThreads();
+    int summary = 0;
+    const char** exprs = malloc(argc * sizeof(char*));
+    int numExprs = 0;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-e") && i+1 < argc)
+            exprs[numExprs++] = argv[++i];
+        else if(!strcmp(argv[i], "-j") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-s"))
+            summary = 1;
+        else if(argv[i][0] == '-')
+            usage();
+        else
+            addInputs(argv[i]);
+    }
+    if(numInputs == 0 || threads < 1)
+        usage();
+    qsort(inputs, numInputs, sizeof(char*), cmpString);
+
+    tracks = calloc(numInputs, sizeof(Tracks));
+    results = calloc(numInputs, sizeof(Result));
+    double start = timerNow();
+    poolRun(threads, numInputs, bakeTask, NULL);
+    double elapsed = timerNow() - start;
+
+    long long frames = 0;
+    for(int i=0; i<numInputs; i++)
+        frames += tracks[i].numFrames;
+    fprintf(stderr, "bvhquery: %d clips, %lld frames, %.1f MB de poses, %d com erro, %.0f ms, %d threads\n",
+            numInputs, frames, memUsage(MEM_POSES) / 1048576.0, atomic_load(&failures), elapsed, threads);
+
+    int ok = 1;
+    if(numExprs > 0) {
+        for(int e=0; e<numExprs; e++)
+            ok &= runQuery(exprs[e], threads, summary);
+    }
+    else {
+        // Uma consulta por linha; linhas vazias e comentarios (#) ignorados
+        char* line = NULL;
+        size_t cap = 0;
+        while(getline(&line, &cap, stdin) > 0) {
+            line[strcspn(line, "\r\n")] = 0;
+            const char* s = line + strspn(line, " \t");
+            if(*s && *s != '#')
+                ok &= runQuery(s, threads, summary);
+        }
+        free(line);
+    }
+
+    for(int i=0; i<numInputs; i++) {
+        freeTracks(&tracks[i]);
+        free(inputs[i]);
+    }
+    free(tracks);
+    free(results);
+    free(inputs);
+    free(exprs);
+    return ok && !atomic_load(&failures) ? 0 : 1;
+}
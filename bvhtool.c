@@ -0,0 +1,486 @@
+// **********************************************************************
+//	bvhtool.c
+//  Conversao de clips em lote, sem janela
+//
+//  Uso: bvhtool comando [-o dir] [-j threads] [-r fps [-b]] [-e cod]
+//                 [-l camada.bvh [-m junta] [-w peso]] [-T] entrada...
+//   comandos:
+//    cache       BVH -> cache binario (.bvhc)
+//    csv         posicoes globais das juntas por frame (.csv)
+//    json        idem, em JSON (.json)
+//    resample    BVH reamostrado para -r fps (_<fps>hz.bvh), rotacoes por
+//                slerp; com -b, em cache binario (_<fps>hz.bvhc)
+//    arrow       canais locais e posicoes globais em colunas, no formato
+//                IPC do Apache Arrow (.arrow); -e f32|f16|q16
+//    compress    formato compactado (.bvhz): quaternios em 32 bits e
+//                translacoes em diferencas de 16 bits, em blocos
+//    additive    soma a camada aditiva -l (diferenca de cada frame para o
+//                primeiro, em loop) com peso -w (1), so na junta -m e em
+//                seus descendentes (todas) (_add.bvh)
+//   -o dir       diretorio de saida, criado se nao existir (o mesmo de
+//                cada entrada)
+//   -j threads   threads (todos os processadores)
+//   -T           grava o trace (trace.json, no diretorio -o se houver)
+//   entrada: arquivos .bvh ou diretorios (todos os .bvh dentro deles)
+//
+//  Os arquivos sao distribuidos por um pool com roubo de tarefas e
+//  lidos e gravados frame a frame: a memoria usada nao depende do
+//  tamanho dos clips (exceto arrow e compress, que precisam do clip
+//  inteiro). Com -T, cada arquivo convertido gera um marcador no trace
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "additive.h"
+#include "arrow.h"
+#include "blend.h"
+#include "bvh.h"
+#include "compress.h"
+#include "pool.h"
+#include "timer.h"
+#include "trace.h"
+
+typedef int (*Converter)(BvhReader* r, Clip* clip, FILE* out);
+
+typedef struct {
+    const char* name;
+    Converter convert;
+    const char* ext;     // sufixo do arquivo gerado
+    const char* mode;    // modo do fopen
+} Command;
+
+static char** inputs;
+static int numInputs;
+static const char* outDir;
+static float targetFps = 60;
+static int binaryOut;
+static int tracing;
+static int arrowEncoding = ARROW_F32;
+static AdditiveLayer layer;
+static Command* command;
+static atomic_int failures;
+static atomic_llong framesDone;
+
+// **********************************************************************
+//  Conversores: leem os frames restantes de r e gravam em out
+//  Retornam a quantidade de frames lidos, ou -1 em erro
+// **********************************************************************
+
+// Cache binario; se o arquivo tiver menos frames que o cabecalho
+// declara, a contagem e corrigida no final
+static int toCache(BvhReader* r, Clip* clip, FILE* out)
+{
+    float* frame = malloc(clip->numChannels * sizeof(float));
+    int declared = clip->numFrames;
+    int f = 0;
+    writeClipCacheHeader(out, clip);
+    while(readBvhFrame(r, frame)) {
+        fwrite(frame, sizeof(float), clip->numChannels, out);
+        f++;
+    }
+    if(f != declared) {
+        // numFrames fica depois de magic, version, numNodes e numChannels
+        fseek(out, 4 + 3*sizeof(int), SEEK_SET);
+        fwrite(&f, sizeof(int), 1, out);
+    }
+    free(frame);
+    return f;
+}
+
+static int toPositions(BvhReader* r, Clip* clip, FILE* out, int json)
+{
+    float* frame = malloc(clip->numChannels * sizeof(float));
+    float* world = malloc(clip->numNodes * 16 * sizeof(float));
+    int f = 0;
+
+    if(json) {
+        fprintf(out, "{\"frameTime\":%g,\"joints\":[", clip->frameTime);
+        for(int i=0; i<clip->numNodes; i++)
+            fprintf(out, "%s\"%s\"", i ? "," : "", clip->nodes[i]->name);
+        fprintf(out, "],\"frames\":[");
+    }
+    else {
+        fprintf(out, "frame,time");
+        for(int i=0; i<clip->numNodes; i++) {
+            const char* n = clip->nodes[i]->name;
+            fprintf(out, ",%s_x,%s_y,%s_z", n, n, n);
+        }
+        fprintf(out, "\n");
+    }
+    while(readBvhFrame(r, frame)) {
+        forwardKinematicsSimd(clip, frame, world);
+        if(json)
+            fprintf(out, "%s\n[", f ? "," : "");
+        else
+            fprintf(out, "%d,%g", f, f * clip->frameTime);
+        for(int i=0; i<clip->numNodes; i++) {
+            const float* p = world + i*16 + 12;
+            fprintf(out, "%s%g,%g,%g", json && i == 0 ? "" : ",", p[0], p[1], p[2]);
+        }
+        fprintf(out, json ? "]" : "\n");
+        f++;
+    }
+    if(json)
+        fprintf(out, "]}\n");
+    free(world);
+    free(frame);
+    return f;
+}
+
+static int toCsv(BvhReader* r, Clip* clip, FILE* out)
+{
+    return toPositions(r, clip, out, 0);
+}
+
+static int toJson(BvhReader* r, Clip* clip, FILE* out)
+{
+    return toPositions(r, clip, out, 1);
+}
+
+// **********************************************************************
+//  Reamostragem: cada frame de saida interpola os dois frames de
+//  entrada vizinhos (frameSlerp: quaternios por junta), com uma janela
+//  de dois frames. Se o arquivo acabar antes do declarado, o ultimo
+//  frame lido e repetido para manter a saida valida
+// **********************************************************************
+static int toResampled(BvhReader* r, Clip* clip, FILE* out)
+{
+    int nc = clip->numChannels;
+    float* a = malloc(nc * sizeof(float));
+    float* b = malloc(nc * sizeof(float));
+    float* o = malloc(nc * sizeof(float));
+
+    int srcFrames = clip->numFrames;
+    float srcDt = clip->frameTime, dstDt = 1.0f / targetFps;
+    int dstFrames = srcFrames > 0 ? (int) floor((srcFrames-1) * (double) srcDt / dstDt + 0.01) + 1 : 0;
+    clip->numFrames = dstFrames;
+    clip->frameTime = dstDt;
+    if(binaryOut)
+        writeClipCacheHeader(out, clip);
+    else
+        writeBvhHeader(out, clip);
+
+    // a = frame 'loaded-1', b = frame 'loaded'
+    int loaded = 0, read = 0;
+    if(readBvhFrame(r, a)) {
+        read++;
+        memcpy(b, a, nc * sizeof(float));
+        if(readBvhFrame(r, b))
+            read++, loaded = 1;
+    }
+    for(int k=0; k<dstFrames; k++) {
+        // Tolerancia de 1% de frame: o Frame Time do arquivo e
+        // arredondado, e frames que coincidem nao podem cair no fim do
+        // intervalo anterior (u = 1 com o angulo do menor arco)
+        double t = k * (double) dstDt / srcDt;
+        int f0 = (int) (t + 0.01);
+        if(t < f0)
+            t = f0;
+        while(f0 >= loaded && loaded < read) {
+            memcpy(a, b, nc * sizeof(float));
+            if(readBvhFrame(r, b))
+                read++, loaded++;
+            else
+                break;
+        }
+        float u = f0 < loaded ? (float) (t - f0) : 0;
+        if(u > 0)
+            frameSlerp(clip, a, b, u, o);
+        else
+            memcpy(o, a, nc * sizeof(float));
+        if(binaryOut)
+            fwrite(o, sizeof(float), nc, out);
+        else
+            writeBvhFrame(out, clip, o);
+    }
+    free(o);
+    free(b);
+    free(a);
+    return read;
+}
+
+// Colunar (Arrow): le todos os frames, para a quantizacao conhecer a
+// faixa de cada coluna antes de gravar
+static int toArrow(BvhReader* r, Clip* clip, FILE* out)
+{
+    int f = 0;
+    TRACE_BEGIN("readFrames");
+    clip->frames = malloc((size_t) clip->numFrames * clip->numChannels * sizeof(float));
+    while(f < clip->numFrames && readBvhFrame(r, clip->frames + (size_t) f * clip->numChannels))
+        f++;
+    clip->numFrames = f;
+    TRACE_END();
+    TRACE_BEGIN("writeArrow");
+    int ok = writeArrow(out, clip, arrowEncoding);
+    TRACE_END();
+    return ok ? f : -1;
+}
+
+// Compactado: a faixa das diferencas e as trilhas constantes dependem
+// de todos os frames
+static int toCompressed(BvhReader* r, Clip* clip, FILE* out)
+{
+    int f = 0;
+    TRACE_BEGIN("readFrames");
+    clip->frames = malloc((size_t) clip->numFrames * clip->numChannels * sizeof(float));
+    while(f < clip->numFrames && readBvhFrame(r, clip->frames + (size_t) f * clip->numChannels))
+        f++;
+    clip->numFrames = f;
+    TRACE_END();
+    TRACE_BEGIN("writeCompressed");
+    int ok = writeCompressed(out, clip);
+    TRACE_END();
+    return ok ? f : -1;
+}
+
+// Camada aditiva: mesmos canais, frame a frame (a camada em loop)
+static int toAdditive(BvhReader* r, Clip* clip, FILE* out)
+{
+    if(!additiveCompatible(&layer, clip)) {
+        fprintf(stderr, "bvhtool: esqueleto diferente do da camada\n");
+        return -1;
+    }
+    float* frame = malloc(clip->numChannels * sizeof(float));
+    int f = 0;
+    writeBvhHeader(out, clip);
+    while(f < clip->numFrames && readBvhFrame(r, frame)) {
+        additiveApply(&layer, f % layer.numFrames, frame, frame);
+        writeBvhFrame(out, clip, frame);
+        f++;
+    }
+    free(frame);
+    return f == clip->numFrames ? f : -1;
+}
+
+static Command commands[] = {
+    { "cache",    toCache,     ".bvhc", "wb" },
+    { "csv",      toCsv,       ".csv",  "w" },
+    { "json",     toJson,      ".json", "w" },
+    { "resample", toResampled, NULL,    "w" },
+    { "arrow",    toArrow,     ".arrow", "wb" },
+    { "compress", toCompressed, ".bvhz", "wb" },
+    { "additive", toAdditive,  "_add.bvh", "w" },
+};
+#define NUM_COMMANDS ((int) (sizeof(commands) / sizeof(commands[0])))
+
+// Converte inputs[i]; chamada pelas threads do pool
+static void convertTask(int i, void* arg)
+{
+    (void) arg;
+    // Registra a thread do pool no trace (a que chamou o pool ja e "main")
+    if(tracing)
+        traceInit(NULL);
+    const char* in = inputs[i];
+    char outName[4096];
+    char suffix[32];
+
+    // Nome de saida: base do arquivo de entrada + sufixo do comando
+    const char* slash = strrchr(in, '/');
+    const char* base = slash ? slash + 1 : in;
+    int baseLen = (int) strlen(base) - 4;
+    if(command->ext)
+        snprintf(suffix, sizeof(suffix), "%s", command->ext);
+    else
+        snprintf(suffix, sizeof(suffix), "_%ghz.bvh%s", targetFps, binaryOut ? "c" : "");
+    if(outDir)
+        snprintf(outName, sizeof(outName), "%s/%.*s%s", outDir, baseLen, base, suffix);
+    else
+        snprintf(outName, sizeof(outName), "%.*s%s", (int) (base - in) + baseLen, in, suffix);
+
+    // Um marcador por arquivo, com o nome do comando
+    TRACE_BEGIN(command->name);
+    BvhReader* r = openBvh(in);
+    if(!r) {
+        atomic_fetch_add(&failures, 1);
+        TRACE_END();
+        return;
+    }
+    Clip* clip = readerClip(r);
+    FILE* out = fopen(outName, binaryOut ? "wb" : command->mode);
+    if(!out) {
+        perror(outName);
+        atomic_fetch_add(&failures, 1);
+    }
+    else {
+        int frames = command->convert(r, clip, out);
+        int ok = frames >= 0 && !ferror(out);
+        if(fclose(out) != 0 || !ok) {
+            perror(outName);
+            atomic_fetch_add(&failures, 1);
+        }
+        else
+            atomic_fetch_add(&framesDone, frames);
+    }
+    closeBvh(r);
+    freeClip(clip);
+    TRACE_END();
+}
+
+static void addInput(const char* path)
+{
+    static int cap = 0;
+    if(numInputs == cap) {
+        cap = cap ? cap*2 : 64;
+        inputs = realloc(inputs, cap * sizeof(char*));
+    }
+    inputs[numInputs] = malloc(strlen(path) + 1);
+    strcpy(inputs[numInputs++], path);
+}
+
+// Acrescenta path, ou os .bvh dentro dele se for um diretorio
+static void addInputs(const char* path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        addInput(path);
+        return;
+    }
+    DIR* d = opendir(path);
+    struct dirent* de;
+    char name[4096];
+    if(!d)
+        return;
+    while((de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if(len < 4 || strcmp(de->d_name + len - 4, ".bvh"))
+            continue;
+        snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+        addInput(name);
+    }
+    closedir(d);
+}
+
+static int cmpString(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Cria dir e os diretorios acima dele que faltarem (como mkdir -p)
+static int makeDirs(const char* dir)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", dir);
+    for(char* p = path + 1; *p; p++)
+        if(*p == '/') {
+            *p = 0;
+            if(mkdir(path, 0755) != 0 && errno != EEXIST)
+                return 0;
+            *p = '/';
+        }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Uso: bvhtool cache|csv|json|resample|arrow|compress|additive [-o dir] [-j threads] [-r fps [-b]]\n"
+                    "               [-e f32|f16|q16] [-l camada.bvh [-m junta] [-w peso]] [-T] entrada...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    int threads = poolDefaultThreads();
+    const char* layerName = NULL;
+    const char* maskJoint = NULL;
+    float layerWeight = 1;
+
+    if(argc < 2)
+        usage();
+    for(int c=0; c<NUM_COMMANDS; c++)
+        if(!strcmp(argv[1], commands[c].name))
+            command = &commands[c];
+    if(!command)
+        usage();
+    for(int i=2; i<argc; i++) {
+        if(!strcmp(argv[i], "-o") && i+1 < argc)
+            outDir = argv[++i];
+        else if(!strcmp(argv[i], "-j") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-r") && i+1 < argc)
+            targetFps = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-e") && i+1 < argc) {
+            const char* e = argv[++i];
+            if(!strcmp(e, "f32")) arrowEncoding = ARROW_F32;
+            else if(!strcmp(e, "f16")) arrowEncoding = ARROW_F16;
+            else if(!strcmp(e, "q16")) arrowEncoding = ARROW_Q16;
+            else usage();
+        }
+        else if(!strcmp(argv[i], "-b"))
+            binaryOut = 1;
+        else if(!strcmp(argv[i], "-T"))
+            tracing = 1;
+        else if(!strcmp(argv[i], "-l") && i+1 < argc)
+            layerName = argv[++i];
+        else if(!strcmp(argv[i], "-m") && i+1 < argc)
+            maskJoint = argv[++i];
+        else if(!strcmp(argv[i], "-w") && i+1 < argc)
+            layerWeight = atof(argv[++i]);
+        else if(argv[i][0] == '-')
+            usage();
+        else
+            addInputs(argv[i]);
+    }
+    if(numInputs == 0 || threads < 1 || targetFps <= 0)
+        usage();
+    if((command->convert == toAdditive) != (layerName != NULL) || (binaryOut && command->convert != toResampled))
+        usage();
+    qsort(inputs, numInputs, sizeof(char*), cmpString);
+
+    Clip* layerClip = NULL;
+    if(layerName) {
+        layerClip = loadBvh(layerName);
+        if(!layerClip || layerClip->numFrames == 0 || !additiveBuild(&layer, layerClip, NULL)) {
+            fprintf(stderr, "bvhtool: erro em %s\n", layerName);
+            return 1;
+        }
+        float* mask = NULL;
+        if(maskJoint) {
+            mask = malloc(layerClip->numNodes * sizeof(float));
+            if(!additiveMask(layerClip, maskJoint, mask)) {
+                fprintf(stderr, "bvhtool: junta %s nao existe em %s\n", maskJoint, layerName);
+                return 1;
+            }
+        }
+        additiveSetWeights(&layer, mask, layerWeight);
+        free(mask);
+    }
+
+    if(outDir && !makeDirs(outDir)) {
+        perror(outDir);
+        return 1;
+    }
+    if(tracing) {
+        char traceName[4096];
+        if(outDir)
+            snprintf(traceName, sizeof(traceName), "%s/%s", outDir, TRACE_FILE);
+        else
+            snprintf(traceName, sizeof(traceName), "%s", TRACE_FILE);
+        traceSetFile(traceName);
+        traceInit("main");
+    }
+
+    double start = timerNow();
+    poolRun(threads, numInputs, convertTask, NULL);
+    double elapsed = timerNow() - start;
+
+    int failed = atomic_load(&failures);
+    fprintf(stderr, "bvhtool %s: %d arquivos, %lld frames, %d com erro, %.0f ms, %d threads\n",
+            command->name, numInputs, (long long) atomic_load(&framesDone), failed, elapsed, threads);
+    for(int i=0; i<numInputs; i++)
+        free(inputs[i]);
+    free(inputs);
+    if(layerClip) {
+        additiveFree(&layer);
+        freeClip(layerClip);
+    }
+    return failed ? 1 : 0;
+}
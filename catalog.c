@@ -0,0 +1,280 @@
+// **********************************************************************
+//	catalog.c
+//  Formato do arquivo: uma linha de cabecalho e uma linha por clip, com
+//  campos separados por tabulacao (o caminho e o primeiro)
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "bvh.h"
+#include "catalog.h"
+#include "pool.h"
+
+#define CATALOG_HEADER "# bvhcatalog 2"
+
+static int cmpEntry(const void* a, const void* b)
+{
+    return strcmp(((const CatalogEntry*) a)->path, ((const CatalogEntry*) b)->path);
+}
+
+// **********************************************************************
+//  Le o catalogo gravado por catalogSave(). Retorna a quantidade de
+//  entradas, ou -1 se o arquivo nao existe ou e de outro formato
+// **********************************************************************
+int catalogLoad(const char* fileName, Catalog* cat)
+{
+    char* line = NULL;
+    size_t cap = 0;
+    int capEntries = 0;
+
+    cat->entries = NULL;
+    cat->numEntries = 0;
+    FILE* fp = fopen(fileName, "r");
+    if(!fp)
+        return -1;
+    if(getline(&line, &cap, fp) < 0 || strncmp(line, CATALOG_HEADER, strlen(CATALOG_HEADER))) {
+        free(line);
+        fclose(fp);
+        return -1;
+    }
+    while(getline(&line, &cap, fp) > 0) {
+        char* tab = strchr(line, '\t');
+        if(!tab)
+            continue;
+        *tab = 0;
+        CatalogEntry e;
+        memset(&e, 0, sizeof(e));
+        int n = sscanf(tab+1, "%lld %lld %d %d %f %f %d %d %llx %d %f %f %f %f %f %f %f %d",
+                       &e.mtime, &e.size, &e.ok, &e.frames, &e.frameTime, &e.duration,
+                       &e.joints, &e.channels, &e.skeletonHash, &e.hasMotion, &e.travel,
+                       &e.bbox[0], &e.bbox[1], &e.bbox[2], &e.bbox[3], &e.bbox[4], &e.bbox[5],
+                       &e.constChannels);
+        if(n != 18)
+            continue;
+        e.path = malloc(strlen(line) + 1);
+        strcpy(e.path, line);
+        if(cat->numEntries == capEntries) {
+            capEntries = capEntries ? capEntries*2 : 256;
+            cat->entries = realloc(cat->entries, capEntries * sizeof(CatalogEntry));
+        }
+        cat->entries[cat->numEntries++] = e;
+    }
+    free(line);
+    fclose(fp);
+    qsort(cat->entries, cat->numEntries, sizeof(CatalogEntry), cmpEntry);
+    return cat->numEntries;
+}
+
+// Grava em um arquivo temporario e renomeia: o catalogo anterior so e
+// substituido se a gravacao terminar
+int catalogSave(const char* fileName, Catalog* cat)
+{
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fileName);
+    FILE* fp = fopen(tmp, "w");
+    if(!fp)
+        return 0;
+    fprintf(fp, "%s\n", CATALOG_HEADER);
+    for(int i=0; i<cat->numEntries; i++) {
+        CatalogEntry* e = &cat->entries[i];
+        fprintf(fp, "%s\t%lld\t%lld\t%d\t%d\t%g\t%g\t%d\t%d\t%016llx\t%d\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%d\n",
+                e->path, e->mtime, e->size, e->ok, e->frames, e->frameTime, e->duration,
+                e->joints, e->channels, e->skeletonHash, e->hasMotion, e->travel,
+                e->bbox[0], e->bbox[1], e->bbox[2], e->bbox[3], e->bbox[4], e->bbox[5],
+                e->constChannels);
+    }
+    int ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    if(ok && rename(tmp, fileName) != 0)
+        ok = 0;
+    if(!ok)
+        remove(tmp);
+    return ok;
+}
+
+void catalogFree(Catalog* cat)
+{
+    for(int i=0; i<cat->numEntries; i++)
+        free(cat->entries[i].path);
+    free(cat->entries);
+    cat->entries = NULL;
+    cat->numEntries = 0;
+}
+
+// **********************************************************************
+//  Preenche os metadados de e->path. A hierarquia e o cabecalho de
+//  MOTION sempre sao lidos; com headersOnly, os frames nao sao lidos
+//  (sem travel, bbox e canais constantes). Os frames sao lidos um a
+//  um, com FK, sem guardar a matriz de frames. Retorna e->ok
+// **********************************************************************
+int catalogIndexFile(CatalogEntry* e, int headersOnly)
+{
+    BvhReader* r = openBvh(e->path);
+    e->ok = r != NULL;
+    e->hasMotion = 0;
+    e->travel = 0;
+    e->constChannels = 0;
+    memset(e->bbox, 0, sizeof(e->bbox));
+    if(!r)
+        return 0;
+    Clip* clip = readerClip(r);
+    e->frames = clip->numFrames;
+    e->frameTime = clip->frameTime;
+    e->duration = clip->numFrames * clip->frameTime;
+    e->skeletonHash = skeletonHash(clip);
+    e->channels = clip->numChannels;
+    e->joints = 0;
+    for(int i=0; i<clip->numNodes; i++)
+        if(clip->nodes[i]->channels > 0)
+            e->joints++;
+
+    if(!headersOnly) {
+        float* frame = malloc(clip->numChannels * sizeof(float));
+        float* world = malloc(clip->numNodes * 16 * sizeof(float));
+        float* chLo = malloc(clip->numChannels * sizeof(float));
+        float* chHi = malloc(clip->numChannels * sizeof(float));
+        float last[3] = { 0, 0, 0 };
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        int f = 0;
+        while(readBvhFrame(r, frame)) {
+            forwardKinematicsSimd(clip, frame, world);
+            for(int i=0; i<clip->numNodes; i++)
+                for(int k=0; k<3; k++) {
+                    float v = world[i*16 + 12 + k];
+                    if(v < lo[k]) lo[k] = v;
+                    if(v > hi[k]) hi[k] = v;
+                }
+            if(f > 0) {
+                float dx = world[12] - last[0], dy = world[13] - last[1], dz = world[14] - last[2];
+                e->travel += sqrtf(dx*dx + dy*dy + dz*dz);
+            }
+            memcpy(last, world + 12, sizeof(last));
+            for(int c=0; c<clip->numChannels; c++) {
+                chLo[c] = f ? fminf(chLo[c], frame[c]) : frame[c];
+                chHi[c] = f ? fmaxf(chHi[c], frame[c]) : frame[c];
+            }
+            f++;
+        }
+        if(f > 0) {
+            memcpy(e->bbox, lo, sizeof(lo));
+            memcpy(e->bbox + 3, hi, sizeof(hi));
+            for(int i=0; i<clip->numNodes; i++) {
+                Node* n = clip->nodes[i];
+                for(int k=0; k<n->channels; k++)
+                    e->constChannels += constantChannel(n->channelType[k], chLo[n->firstChannel + k],
+                                                        chHi[n->firstChannel + k]);
+            }
+        }
+        // Arquivo truncado: vale o que foi lido
+        e->frames = f;
+        e->duration = f * clip->frameTime;
+        e->hasMotion = 1;
+        free(chHi);
+        free(chLo);
+        free(world);
+        free(frame);
+    }
+    closeBvh(r);
+    freeClip(clip);
+    return 1;
+}
+
+// **********************************************************************
+//  Percorre a arvore de diretorios acumulando os arquivos .bvh
+// **********************************************************************
+typedef struct {
+    CatalogEntry* entries;
+    int num;
+    int cap;
+} FileList;
+
+static void scanTree(const char* dir, FileList* list)
+{
+    DIR* d = opendir(dir);
+    struct dirent* de;
+    struct stat st;
+    char path[4096];
+    if(!d)
+        return;
+    while((de = readdir(d))) {
+        if(de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if(stat(path, &st) != 0)
+            continue;
+        if(S_ISDIR(st.st_mode)) {
+            scanTree(path, list);
+            continue;
+        }
+        size_t len = strlen(de->d_name);
+        if(len < 4 || strcmp(de->d_name + len - 4, ".bvh"))
+            continue;
+        if(list->num == list->cap) {
+            list->cap = list->cap ? list->cap*2 : 256;
+            list->entries = realloc(list->entries, list->cap * sizeof(CatalogEntry));
+        }
+        CatalogEntry* e = &list->entries[list->num++];
+        memset(e, 0, sizeof(CatalogEntry));
+        e->path = malloc(strlen(path) + 1);
+        strcpy(e->path, path);
+        e->mtime = (long long) st.st_mtime;
+        e->size = (long long) st.st_size;
+    }
+    closedir(d);
+}
+
+typedef struct {
+    CatalogEntry** todo;
+    int headersOnly;
+} IndexJob;
+
+static void indexTask(int i, void* arg)
+{
+    IndexJob* job = arg;
+    catalogIndexFile(job->todo[i], job->headersOnly);
+}
+
+// **********************************************************************
+//  Atualiza o catalogo com o conteudo atual de dir: arquivos com a
+//  mesma data e tamanho reaproveitam a entrada anterior, os novos e
+//  modificados sao lidos em paralelo e os removidos saem
+//  Retorna a quantidade de arquivos lidos
+// **********************************************************************
+int catalogUpdate(Catalog* cat, const char* dir, int numThreads, int headersOnly)
+{
+    FileList list = { NULL, 0, 0 };
+    scanTree(dir, &list);
+    qsort(list.entries, list.num, sizeof(CatalogEntry), cmpEntry);
+
+    CatalogEntry** todo = malloc((list.num ? list.num : 1) * sizeof(CatalogEntry*));
+    int numTodo = 0;
+    for(int i=0; i<list.num; i++) {
+        CatalogEntry* e = &list.entries[i];
+        CatalogEntry* old = bsearch(e, cat->entries, cat->numEntries, sizeof(CatalogEntry), cmpEntry);
+        if(old && old->mtime == e->mtime && old->size == e->size && (old->hasMotion || headersOnly)) {
+            char* path = e->path;
+            *e = *old;
+            e->path = path;
+        }
+        else
+            todo[numTodo++] = e;
+    }
+
+    IndexJob job = { todo, headersOnly };
+    poolRun(numThreads, numTodo, indexTask, &job);
+    free(todo);
+
+    catalogFree(cat);
+    cat->entries = list.entries;
+    cat->numEntries = list.num;
+    return numTodo;
+}
@@ -0,0 +1,43 @@
+// **********************************************************************
+//	catalog.h
+//  Catalogo de uma biblioteca de clips: metadados de cada arquivo .bvh
+//  de uma arvore de diretorios, gravados em um arquivo texto e
+//  atualizados incrementalmente (so os arquivos modificados sao lidos)
+// **********************************************************************
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+typedef struct {
+    char* path;
+    long long mtime;     // data de modificacao (s)
+    long long size;      // bytes
+    int ok;              // 0 se o arquivo nao pode ser lido
+    int frames;
+    float frameTime;
+    float duration;      // segundos
+    int joints;          // juntas com canais (sem os End Sites)
+    int channels;        // canais por frame
+    unsigned long long skeletonHash;
+    int hasMotion;       // 0 se so os cabecalhos foram lidos
+    float travel;        // distancia percorrida pela raiz
+    float bbox[6];       // min xyz, max xyz de todas as juntas
+    int constChannels;   // canais constantes (retirados por clipPackChannels)
+} CatalogEntry;
+
+typedef struct {
+    CatalogEntry* entries;   // em ordem de caminho
+    int numEntries;
+} Catalog;
+
+// Arquivo padrao do catalogo, dentro do diretorio indexado
+#define CATALOG_FILE "catalog.tsv"
+
+int catalogLoad(const char* fileName, Catalog* cat);
+int catalogSave(const char* fileName, Catalog* cat);
+void catalogFree(Catalog* cat);
+
+int catalogIndexFile(CatalogEntry* e, int headersOnly);
+int catalogUpdate(Catalog* cat, const char* dir, int numThreads, int headersOnly);
+
+#endif
@@ -0,0 +1,257 @@
+// **********************************************************************
+//	clipcache.c
+//  Lista duplamente ligada em ordem de uso (cabeca: mais recente)
+//  A busca e linear: a biblioteca tem poucas dezenas de clips
+//  Pode ser usado de varias threads; a leitura do arquivo e feita
+//  fora da trava
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "clipcache.h"
+#include "clipmap.h"
+#include "perf.h"
+#include "trace.h"
+
+typedef struct CacheEntry CacheEntry;
+
+struct CacheEntry {
+    char* path;
+    unsigned long long hash;   // FNV-1a do conteudo do arquivo
+    Clip* clip;
+    long long bytes;
+    int refs;
+    CacheEntry* prev;
+    CacheEntry* next;
+};
+
+static CacheEntry* head;
+static CacheEntry* tail;
+static CacheStats stats = { 0, 0, 0, 0, CACHE_BUDGET, 0 };
+static int storage = FRAMES_F32;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int isMapped(const char* path)
+{
+    size_t len = strlen(path);
+    return len > 5 && !strcmp(path + len - 5, ".bvhc");
+}
+
+// Hash do conteudo do arquivo (0 se nao puder ser lido). Caches
+// binarios podem ter dezenas de GB: so o tamanho e a data contam
+static unsigned long long hashFile(const char* path)
+{
+    unsigned char buf[65536];
+    unsigned long long h = 14695981039346656037ULL;
+    size_t n;
+    if(isMapped(path)) {
+        struct stat st;
+        if(stat(path, &st) != 0)
+            return 0;
+        long long key[2] = { (long long) st.st_size, (long long) st.st_mtime };
+        const unsigned char* k = (const unsigned char*) key;
+        for(size_t i=0; i<sizeof(key); i++)
+            h = (h ^ k[i]) * 1099511628211ULL;
+        return h;
+    }
+    FILE* fp = fopen(path, "rb");
+    if(!fp)
+        return 0;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        for(size_t i=0; i<n; i++)
+            h = (h ^ buf[i]) * 1099511628211ULL;
+    fclose(fp);
+    return h;
+}
+
+static void listRemove(CacheEntry* e)
+{
+    if(e->prev) e->prev->next = e->next; else head = e->next;
+    if(e->next) e->next->prev = e->prev; else tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void pushFront(CacheEntry* e)
+{
+    e->next = head;
+    e->prev = NULL;
+    if(head) head->prev = e; else tail = e;
+    head = e;
+}
+
+// Tira a entrada do cache; o clip e liberado por quem chamou
+static Clip* removeEntry(CacheEntry* e)
+{
+    Clip* clip = e->clip;
+    listRemove(e);
+    stats.bytes -= e->bytes;
+    stats.clips--;
+    memAdd(MEM_CACHE, -(long long) (sizeof(CacheEntry) + strlen(e->path) + 1));
+    free(e->path);
+    free(e);
+    return clip;
+}
+
+// **********************************************************************
+//  Remove os clips menos usados e sem referencias ate caber no limite
+//  Precisa ser chamada com lock; os clips removidos vao para evicted
+// **********************************************************************
+static int evict(Clip** evicted, int max)
+{
+    int n = 0;
+    CacheEntry* e = tail;
+    while(e && stats.bytes > stats.budget && n < max) {
+        CacheEntry* prev = e->prev;
+        if(e->refs == 0) {
+            evicted[n++] = removeEntry(e);
+            stats.evictions++;
+        }
+        e = prev;
+    }
+    return n;
+}
+
+static void freeEvicted(Clip** evicted, int n)
+{
+    for(int i=0; i<n; i++)
+        freeClip(evicted[i]);
+}
+
+#define MAX_EVICT 64
+
+void cacheSetBudget(long long bytes)
+{
+    Clip* evicted[MAX_EVICT];
+    pthread_mutex_lock(&lock);
+    stats.budget = bytes;
+    int n = evict(evicted, MAX_EVICT);
+    pthread_mutex_unlock(&lock);
+    freeEvicted(evicted, n);
+}
+
+// Formato da matriz de frames (FRAMES_*) dos clips lidos daqui em diante
+void cacheSetStorage(int format)
+{
+    pthread_mutex_lock(&lock);
+    storage = format;
+    pthread_mutex_unlock(&lock);
+}
+
+// **********************************************************************
+//  Devolve o clip do arquivo, lendo-o se nao estiver no cache ou se o
+//  conteudo mudou, sem os canais constantes na matriz de frames
+//  (clipPackChannels) e no formato de cacheSetStorage. Caches binarios
+//  (.bvhc) sao mapeados por janela (clipmap.c), sem ler os frames
+//  O clip fica referenciado ate cacheRelease(). Retorna NULL em caso
+//  de erro
+// **********************************************************************
+Clip* cacheAcquire(const char* path)
+{
+    Clip* evicted[MAX_EVICT];
+    int n = 0;
+    unsigned long long hash = hashFile(path);
+    if(!hash)
+        return NULL;
+
+    pthread_mutex_lock(&lock);
+    for(CacheEntry* e = head; e; e = e->next) {
+        if(strcmp(e->path, path))
+            continue;
+        if(e->hash == hash) {
+            stats.hits++;
+            e->refs++;
+            listRemove(e);
+            pushFront(e);
+            pthread_mutex_unlock(&lock);
+            return e->clip;
+        }
+        // Versao antiga do arquivo: sai assim que nao estiver em uso
+        if(e->refs == 0)
+            evicted[n++] = removeEntry(e);
+        break;
+    }
+    stats.misses++;
+    int format = storage;
+    pthread_mutex_unlock(&lock);
+    freeEvicted(evicted, n);
+
+    TRACE_BEGIN("cacheMiss");
+    Clip* clip;
+    if(isMapped(path))
+        clip = loadClipMapped(path, MAP_WINDOW);
+    else {
+        PERF_BEGIN(STAGE_PARSE);
+        clip = loadBvh(path);
+        PERF_END(STAGE_PARSE);
+    }
+    TRACE_END();
+    if(!clip)
+        return NULL;
+    if(!clip->map) {
+        clipPackChannels(clip);
+        clipSetStorage(clip, format);
+    }
+
+    CacheEntry* e = malloc(sizeof(CacheEntry));
+    e->path = malloc(strlen(path) + 1);
+    strcpy(e->path, path);
+    e->hash = hash;
+    e->clip = clip;
+    e->bytes = clipMemory(clip, NULL);
+    e->refs = 1;
+    memAdd(MEM_CACHE, sizeof(CacheEntry) + strlen(path) + 1);
+
+    pthread_mutex_lock(&lock);
+    pushFront(e);
+    stats.bytes += e->bytes;
+    stats.clips++;
+    n = evict(evicted, MAX_EVICT);
+    pthread_mutex_unlock(&lock);
+    freeEvicted(evicted, n);
+    return clip;
+}
+
+// Solta a referencia; o clip continua no cache enquanto couber
+void cacheRelease(Clip* clip)
+{
+    Clip* evicted[MAX_EVICT];
+    int n = 0;
+    if(!clip)
+        return;
+    pthread_mutex_lock(&lock);
+    for(CacheEntry* e = head; e; e = e->next)
+        if(e->clip == clip) {
+            e->refs--;
+            break;
+        }
+    n = evict(evicted, MAX_EVICT);
+    pthread_mutex_unlock(&lock);
+    freeEvicted(evicted, n);
+}
+
+void cacheGetStats(CacheStats* st)
+{
+    pthread_mutex_lock(&lock);
+    *st = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+// Libera todos os clips sem referencias
+void cacheClear()
+{
+    pthread_mutex_lock(&lock);
+    CacheEntry* e = head;
+    while(e) {
+        CacheEntry* next = e->next;
+        if(e->refs == 0)
+            freeClip(removeEntry(e));
+        e = next;
+    }
+    pthread_mutex_unlock(&lock);
+}
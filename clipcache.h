@@ -0,0 +1,31 @@
+// **********************************************************************
+//	clipcache.h
+//  Cache LRU de clips carregados, por caminho e hash do conteudo, com
+//  limite de memoria. Clips em uso (referenciados) nunca sao removidos
+// **********************************************************************
+
+#ifndef CLIPCACHE_H
+#define CLIPCACHE_H
+
+#include "bvh.h"
+
+// Limite padrao (bytes)
+#define CACHE_BUDGET (256LL << 20)
+
+typedef struct {
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long bytes;     // bytes dos clips guardados
+    long long budget;
+    int clips;
+} CacheStats;
+
+void cacheSetBudget(long long bytes);
+void cacheSetStorage(int storage);
+Clip* cacheAcquire(const char* path);
+void cacheRelease(Clip* clip);
+void cacheGetStats(CacheStats* st);
+void cacheClear();
+
+#endif
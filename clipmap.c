@@ -0,0 +1,198 @@
+// **********************************************************************
+//	clipmap.c
+//  A janela cobre um trecho alinhado a paginas do arquivo. Quando o
+//  frame pedido sai dela, a janela e refeita com o frame perto do seu
+//  inicio (reproducao para frente) ou do fim (para tras), de modo que a
+//  maior parte dela fique na direcao em que os proximos frames vao ser
+//  lidos. A direcao vem dos dois ultimos frames pedidos
+//
+//  A cada MAP_READAHEAD da janela percorrido, o trecho seguinte e pedido
+//  com posix_madvise(WILLNEED); a parte que passa do fim da janela, com
+//  posix_fadvise, para ja estar no page cache quando ela for refeita
+//
+//  O frame e copiado para um vetor do clip: os frames no arquivo nao sao
+//  alinhados a 4 bytes (o cabecalho tem tamanho qualquer), e o ponteiro
+//  devolvido continua valido depois que a janela muda
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "clipmap.h"
+#include "trace.h"
+
+// Fracao da janela pedida adiantada de cada vez
+#define MAP_READAHEAD(m) ((m)->window / 4)
+
+struct ClipMap {
+    int fd;
+    long long fileSize;
+    long long dataOffset;    // inicio dos frames no arquivo
+    int frameBytes;
+    long long window;        // tamanho maximo da janela
+    long long pageSize;
+    unsigned char* base;     // janela mapeada (NULL: nenhuma)
+    long long start, len;    // trecho do arquivo coberto pela janela
+    long long advised;       // ate onde, na direcao corrente, ja foi pedido
+    int last, dir;           // ultimo frame lido e direcao (+1 ou -1)
+    long long remaps;
+    float* frame;            // copia do ultimo frame
+};
+
+// Pede ao sistema o trecho [from, to) do arquivo: a parte dentro da
+// janela pelo mapeamento, o resto pelo descritor
+static void willNeed(ClipMap* m, long long from, long long to)
+{
+    if(from < 0) from = 0;
+    if(to > m->fileSize) to = m->fileSize;
+    if(to <= from)
+        return;
+    long long a = from > m->start ? from : m->start;
+    long long b = to < m->start + m->len ? to : m->start + m->len;
+    if(m->base && b > a) {
+        long long page = (a - m->start) / m->pageSize * m->pageSize;
+        posix_madvise(m->base + page, b - m->start - page, POSIX_MADV_WILLNEED);
+    }
+    if(from < m->start)
+        posix_fadvise(m->fd, from, (to < m->start ? to : m->start) - from, POSIX_FADV_WILLNEED);
+    if(to > m->start + m->len) {
+        long long f = from > m->start + m->len ? from : m->start + m->len;
+        posix_fadvise(m->fd, f, to - f, POSIX_FADV_WILLNEED);
+    }
+}
+
+// Refaz a janela em torno de pos (posicao do frame no arquivo)
+static void remap(ClipMap* m, long long pos)
+{
+    TRACE_BEGIN("mapWindow");
+    if(m->base)
+        munmap(m->base, m->len);
+    // Margem do lado oposto a direcao: ao menos uma pagina, para o
+    // alinhamento de start nao deixar o frame fora da janela
+    long long margin = m->window / 8 > m->pageSize ? m->window / 8 : m->pageSize;
+    long long want = m->dir < 0 ? pos + m->frameBytes - m->window + margin : pos - margin;
+    if(want < 0)
+        want = 0;
+    m->start = want / m->pageSize * m->pageSize;
+    m->len = m->fileSize - m->start < m->window ? m->fileSize - m->start : m->window;
+    void* p = mmap(NULL, m->len, PROT_READ, MAP_SHARED, m->fd, m->start);
+    m->base = p == MAP_FAILED ? NULL : p;
+    m->advised = m->dir < 0 ? pos + m->frameBytes : pos;
+    m->remaps++;
+    TRACE_END();
+}
+
+// **********************************************************************
+//  Abre o cache com uma janela de window bytes (arredondada para cima
+//  ate caber alguns frames). O clip nao tem a matriz de frames: eles
+//  so podem ser lidos por clipFrame, de uma thread por vez
+// **********************************************************************
+Clip* loadClipMapped(const char* fileName, long long window)
+{
+    TRACE_BEGIN("loadClipMapped");
+    FILE* fp = fopen(fileName, "rb");
+    if(!fp) {
+        TRACE_END();
+        return NULL;
+    }
+    Clip* clip = readClipCacheHeader(fp);
+    long long dataOffset = clip ? ftell(fp) : -1;
+    fclose(fp);
+    ClipMap* m = clip ? calloc(1, sizeof(ClipMap)) : NULL;
+    if(m)
+        m->fd = -1;
+    struct stat st;
+    int ok = m && dataOffset >= 0;
+    if(ok) {
+        m->fd = open(fileName, O_RDONLY);
+        m->frameBytes = clip->numChannels * sizeof(float);
+        m->frame = malloc(m->frameBytes + sizeof(float));
+        ok = m->fd >= 0 && m->frame && fstat(m->fd, &st) == 0
+            && st.st_size >= dataOffset + (long long) clip->numFrames * m->frameBytes;
+    }
+    if(!ok) {
+        if(m && m->fd >= 0)
+            close(m->fd);
+        if(m)
+            free(m->frame);
+        free(m);
+        freeClip(clip);
+        fprintf(stderr, "BVH: cache invalido %s\n", fileName);
+        TRACE_END();
+        return NULL;
+    }
+    m->fileSize = st.st_size;
+    m->dataOffset = dataOffset;
+    m->pageSize = sysconf(_SC_PAGESIZE);
+    long long minWindow = 2 * (m->frameBytes + m->pageSize);
+    m->window = (window > minWindow ? window : minWindow) + m->pageSize - 1;
+    m->window = m->window / m->pageSize * m->pageSize;
+    m->dir = 1;
+    m->last = -1;
+    clip->map = m;
+    clipAccount(clip);
+    TRACE_END();
+    return clip;
+}
+
+// Frame do arquivo (numChannels floats), valido ate a proxima chamada
+const float* mapFrame(ClipMap* m, int frame)
+{
+    long long pos = m->dataOffset + (long long) frame * m->frameBytes;
+    int dir = frame > m->last ? 1 : frame < m->last ? -1 : m->dir;
+    if(dir != m->dir) {
+        m->dir = dir;
+        m->advised = dir < 0 ? pos + m->frameBytes : pos;
+    }
+    m->last = frame;
+    if(!m->base || pos < m->start || pos + m->frameBytes > m->start + m->len)
+        remap(m, pos);
+
+    // Leitura adiantada: pede o proximo trecho ao passar da metade do ultimo
+    long long ahead = MAP_READAHEAD(m);
+    if(dir > 0 && pos + m->frameBytes > m->advised - ahead / 2) {
+        long long from = pos > m->advised ? pos : m->advised;
+        willNeed(m, from, from + ahead);
+        m->advised = from + ahead;
+    }
+    else if(dir < 0 && pos < m->advised + ahead / 2) {
+        long long to = pos + m->frameBytes < m->advised ? pos + m->frameBytes : m->advised;
+        willNeed(m, to - ahead, to);
+        m->advised = to - ahead;
+    }
+
+    if(m->base)
+        memcpy(m->frame, m->base + (pos - m->start), m->frameBytes);
+    else if(pread(m->fd, m->frame, m->frameBytes, pos) != m->frameBytes)
+        memset(m->frame, 0, m->frameBytes);    // sem mapeamento: le direto
+    return m->frame;
+}
+
+// Memoria usada no maximo (janela e copia do frame)
+long long mapBytes(const ClipMap* m)
+{
+    return sizeof(ClipMap) + m->window + m->frameBytes;
+}
+
+// Quantas vezes a janela foi refeita
+long long mapRemaps(const ClipMap* m)
+{
+    return m->remaps;
+}
+
+void mapClose(ClipMap* m)
+{
+    if(!m)
+        return;
+    if(m->base)
+        munmap(m->base, m->len);
+    close(m->fd);
+    free(m->frame);
+    free(m);
+}
@@ -0,0 +1,24 @@
+// **********************************************************************
+//	clipmap.h
+//  Clips do cache binario (.bvhc) lidos direto do arquivo por uma janela
+//  mapeada (mmap) que acompanha o frame corrente. So a janela fica na
+//  memoria, entao o tamanho do clip nao e limitado pela RAM. Os trechos
+//  seguintes na direcao da reproducao sao pedidos ao sistema com
+//  antecedencia (madvise/fadvise WILLNEED)
+// **********************************************************************
+
+#ifndef CLIPMAP_H
+#define CLIPMAP_H
+
+#include "bvh.h"
+
+// Bytes mapeados por clip (padrao)
+#define MAP_WINDOW (16LL << 20)
+
+Clip* loadClipMapped(const char* fileName, long long window);
+const float* mapFrame(ClipMap* m, int frame);
+long long mapBytes(const ClipMap* m);
+long long mapRemaps(const ClipMap* m);
+void mapClose(ClipMap* m);
+
+#endif
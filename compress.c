@@ -0,0 +1,313 @@
+// **********************************************************************
+//	compress.c
+//  Quaternio em 32 bits: 2 bits com o indice do maior componente (em
+//  modulo), que nao e gravado (vem de |q| = 1, com o sinal de q trocado
+//  para ele ficar positivo), e 10 bits para cada um dos outros tres, que
+//  ficam em [-1/sqrt(2), 1/sqrt(2)]. O erro maximo por componente e de
+//  7e-4, menos de 0.1 grau
+//
+//  Translacao: a diferenca entre frames seguidos, por eixo, quantizada
+//  em 16 bits entre a menor e a maior diferenca do clip. O erro de
+//  quantizacao volta para o frame seguinte (o codificador mira a posicao
+//  reconstruida), entao nao se acumula ao longo do bloco
+//
+//  Um bloco tem as posicoes absolutas do seu primeiro frame e os
+//  registros de COMPRESS_BLOCK frames (o ultimo bloco e completado com
+//  zeros): o frame f esta no bloco f / COMPRESS_BLOCK, e a translacao e
+//  a soma das diferencas desde o inicio dele
+// **********************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "compress.h"
+#include "mem.h"
+#include "trace.h"
+
+#define QUAT_LEVELS 511      // componentes em -511..511 (zero e exato)
+#define SQRT1_2 0.70710678f
+#define DELTA_MAX 65535
+
+static uint32_t packQuat(const float* q)
+{
+    int big = 0;
+    for(int c=1; c<4; c++)
+        if(fabsf(q[c]) > fabsf(q[big]))
+            big = c;
+    float sign = q[big] < 0 ? -1 : 1;
+    uint32_t code = (uint32_t) big << 30;
+    int shift = 20;
+    for(int c=0; c<4; c++) {
+        if(c == big)
+            continue;
+        long v = lrintf(q[c] * sign * (QUAT_LEVELS / SQRT1_2));
+        if(v < -QUAT_LEVELS) v = -QUAT_LEVELS;
+        if(v > QUAT_LEVELS) v = QUAT_LEVELS;
+        code |= (uint32_t) (v + QUAT_LEVELS) << shift;
+        shift -= 10;
+    }
+    return code;
+}
+
+static void unpackQuat(uint32_t code, float* q)
+{
+    const float scale = SQRT1_2 / QUAT_LEVELS;
+    int big = code >> 30;
+    float a = ((int) ((code >> 20) & 1023) - QUAT_LEVELS) * scale;
+    float b = ((int) ((code >> 10) & 1023) - QUAT_LEVELS) * scale;
+    float c = ((int) (code & 1023) - QUAT_LEVELS) * scale;
+    float w = sqrtf(fmaxf(0, 1 - a*a - b*b - c*c));
+    // Os tres gravados, na ordem, nas posicoes diferentes de big
+    switch(big) {
+    case 0: q[0] = w; q[1] = a; q[2] = b; q[3] = c; break;
+    case 1: q[0] = a; q[1] = w; q[2] = b; q[3] = c; break;
+    case 2: q[0] = a; q[1] = b; q[2] = w; q[3] = c; break;
+    default: q[0] = a; q[1] = b; q[2] = c; q[3] = w; break;
+    }
+}
+
+static int hasPosition(Node* n)
+{
+    for(int c=0; c<n->channels; c++)
+        if(n->channelType[c] <= CH_ZPOS)
+            return 1;
+    return 0;
+}
+
+// Translacao reconstruida do frame i do bloco (base + diferencas)
+static inline float deltaSum(float base, int i, float min, float step, int sum)
+{
+    return base + i * min + step * (float) sum;
+}
+
+// **********************************************************************
+//  Codificacao (precisa de todos os frames do clip)
+// **********************************************************************
+int writeCompressed(FILE* fp, Clip* clip)
+{
+    int n = clip->numNodes, frames = clip->numFrames, bf = COMPRESS_BLOCK;
+    int numRot = 0, numTrans = 0;
+    uint32_t* codes = malloc(((size_t) frames * n + 1) * sizeof(uint32_t));
+    float* pos = malloc(((size_t) frames * n * 3 + 1) * sizeof(float));
+    ZTrack* tracks = calloc(n, sizeof(ZTrack));
+    Pose p;
+    poseInit(&p, n);
+    if(!codes || !pos || !tracks) {
+        free(codes);
+        free(pos);
+        free(tracks);
+        poseFree(&p);
+        return 0;
+    }
+
+    for(int f=0; f<frames; f++) {
+        poseFromFrame(clip, clipFrame(clip, f), &p);
+        for(int j=0; j<n; j++)
+            codes[(size_t) f*n + j] = packQuat(p.rot + j*4);
+        memcpy(pos + (size_t) f*n*3, p.pos, n * 3 * sizeof(float));
+    }
+
+    // Trilhas: constantes ficam no cabecalho, as outras ganham um indice
+    for(int j=0; j<n; j++) {
+        Node* node = clip->nodes[j];
+        ZTrack* t = &tracks[j];
+        const float identity[4] = { 0, 0, 0, 1 };
+        int rotConst = 1, transConst = 1;
+        for(int f=1; f<frames && rotConst; f++)
+            rotConst = codes[(size_t) f*n + j] == codes[j];
+        t->rotConst = frames ? codes[j] : packQuat(identity);
+        t->rotTrack = rotConst ? -1 : numRot++;
+
+        memcpy(t->transConst, frames ? pos + j*3 : node->offset, 3 * sizeof(float));
+        for(int f=1; f<frames && transConst && hasPosition(node); f++)
+            transConst = !memcmp(pos + ((size_t) f*n + j) * 3, pos + j*3, 3 * sizeof(float));
+        t->transTrack = transConst ? -1 : numTrans++;
+        if(transConst)
+            continue;
+        for(int a=0; a<3; a++) {
+            float lo = 0, hi = 0;
+            int first = 1;
+            for(int f=1; f<frames; f++) {
+                if(f % bf == 0)
+                    continue;
+                float d = pos[((size_t) f*n + j) * 3 + a] - pos[((size_t) (f-1)*n + j) * 3 + a];
+                if(first || d < lo) lo = d;
+                if(first || d > hi) hi = d;
+                first = 0;
+            }
+            t->deltaMin[a] = lo;
+            t->deltaStep[a] = (hi - lo) / DELTA_MAX;
+        }
+    }
+
+    int frameBytes = (numRot * 4 + numTrans * 6 + 3) & ~3;
+    int baseBytes = numTrans * 3 * sizeof(float);
+    int blockBytes = baseBytes + bf * frameBytes;
+    int version = COMPRESS_VERSION;
+    fwrite(COMPRESS_MAGIC, 1, 4, fp);
+    fwrite(&version, sizeof(int), 1, fp);
+    fwrite(&bf, sizeof(int), 1, fp);
+    fwrite(&numRot, sizeof(int), 1, fp);
+    fwrite(&numTrans, sizeof(int), 1, fp);
+    writeClipCacheHeader(fp, clip);
+    fwrite(tracks, sizeof(ZTrack), n, fp);
+
+    unsigned char* block = malloc(blockBytes);
+    int* sum = malloc((numTrans * 3 + 1) * sizeof(int));
+    for(int b=0; block && sum && b*bf < frames; b++) {
+        memset(block, 0, blockBytes);
+        memset(sum, 0, numTrans * 3 * sizeof(int));
+        float* base = (float*) block;
+        for(int i=0; i<bf && b*bf + i < frames; i++) {
+            size_t f = (size_t) b*bf + i;
+            unsigned char* rec = block + baseBytes + i * frameBytes;
+            uint32_t* rc = (uint32_t*) rec;
+            uint16_t* dq = (uint16_t*) (rec + numRot * 4);
+            for(int j=0; j<n; j++) {
+                const ZTrack* t = &tracks[j];
+                if(t->rotTrack >= 0)
+                    rc[t->rotTrack] = codes[f*n + j];
+                if(t->transTrack < 0)
+                    continue;
+                int k = t->transTrack * 3;
+                for(int a=0; a<3; a++) {
+                    float target = pos[(f*n + j) * 3 + a];
+                    if(i == 0) {
+                        base[k + a] = target;
+                        continue;
+                    }
+                    // Mira a posicao reconstruida, nao a diferenca original
+                    long q = 0;
+                    if(t->deltaStep[a] > 0)
+                        q = lrintf((target - base[k+a] - i * t->deltaMin[a]) / t->deltaStep[a]) - sum[k+a];
+                    if(q < 0) q = 0;
+                    if(q > DELTA_MAX) q = DELTA_MAX;
+                    dq[k + a] = (uint16_t) q;
+                    sum[k + a] += (int) q;
+                }
+            }
+        }
+        fwrite(block, 1, blockBytes, fp);
+    }
+    int ok = block && sum;
+    free(sum);
+    free(block);
+    free(codes);
+    free(pos);
+    free(tracks);
+    poseFree(&p);
+    return ok && !ferror(fp);
+}
+
+int saveCompressed(Clip* clip, const char* fileName)
+{
+    FILE* fp = fopen(fileName, "wb");
+    if(!fp)
+        return 0;
+    int ok = writeCompressed(fp, clip);
+    ok = fclose(fp) == 0 && ok;
+    if(!ok)
+        remove(fileName);
+    return ok;
+}
+
+// **********************************************************************
+//  Leitura e decodificacao
+// **********************************************************************
+CompressedClip* loadCompressed(const char* fileName)
+{
+    char magic[4];
+    int version;
+
+    TRACE_BEGIN("loadCompressed");
+    FILE* fp = fopen(fileName, "rb");
+    if(!fp) {
+        TRACE_END();
+        return NULL;
+    }
+    CompressedClip* z = calloc(1, sizeof(CompressedClip));
+    int ok = fread(magic, 1, 4, fp) == 4 && !memcmp(magic, COMPRESS_MAGIC, 4)
+        && fread(&version, sizeof(int), 1, fp) == 1 && version == COMPRESS_VERSION
+        && fread(&z->blockFrames, sizeof(int), 1, fp) == 1 && z->blockFrames > 0
+        && fread(&z->numRot, sizeof(int), 1, fp) == 1
+        && fread(&z->numTrans, sizeof(int), 1, fp) == 1
+        && (z->clip = readClipCacheHeader(fp)) != NULL;
+    if(ok) {
+        int n = z->clip->numNodes;
+        z->tracks = malloc(n * sizeof(ZTrack));
+        ok = z->tracks && fread(z->tracks, sizeof(ZTrack), n, fp) == (size_t) n;
+        for(int j=0; ok && j<n; j++)
+            ok = z->tracks[j].rotTrack < z->numRot && z->tracks[j].transTrack < z->numTrans;
+    }
+    if(ok) {
+        z->frameBytes = (z->numRot * 4 + z->numTrans * 6 + 3) & ~3;
+        z->blockBytes = z->numTrans * 3 * sizeof(float) + z->blockFrames * z->frameBytes;
+        z->numBlocks = (z->clip->numFrames + z->blockFrames - 1) / z->blockFrames;
+        size_t bytes = (size_t) z->numBlocks * z->blockBytes;
+        z->data = malloc(bytes + 1);
+        ok = z->data && fread(z->data, 1, bytes, fp) == bytes;
+    }
+    fclose(fp);
+    if(!ok) {
+        fprintf(stderr, "BVH: arquivo compactado invalido %s\n", fileName);
+        freeClip(z->clip);
+        free(z->tracks);
+        free(z->data);
+        free(z);
+        TRACE_END();
+        return NULL;
+    }
+    clipAccount(z->clip);
+    memAdd(MEM_FRAMES, compressedBytes(z));
+    TRACE_END();
+    return z;
+}
+
+// Pose local do frame (p precisa ter numNodes nodos)
+void compressedPose(const CompressedClip* z, int frame, Pose* p)
+{
+    int b = frame / z->blockFrames, i = frame % z->blockFrames;
+    const unsigned char* block = z->data + (size_t) b * z->blockBytes;
+    const float* base = (const float*) block;
+    const unsigned char* recs = block + z->numTrans * 3 * sizeof(float);
+    const uint32_t* rc = (const uint32_t*) (recs + i * z->frameBytes);
+    int deltaOfs = z->numRot * 4;
+
+    for(int j=0; j<z->clip->numNodes; j++) {
+        const ZTrack* t = &z->tracks[j];
+        float* pos = p->pos + j*3;
+        unpackQuat(t->rotTrack >= 0 ? rc[t->rotTrack] : t->rotConst, p->rot + j*4);
+        if(t->transTrack < 0) {
+            memcpy(pos, t->transConst, 3 * sizeof(float));
+            continue;
+        }
+        int k = t->transTrack * 3;
+        int sum[3] = { 0, 0, 0 };
+        for(int r=1; r<=i; r++) {
+            const uint16_t* dq = (const uint16_t*) (recs + r * z->frameBytes + deltaOfs) + k;
+            sum[0] += dq[0];
+            sum[1] += dq[1];
+            sum[2] += dq[2];
+        }
+        for(int a=0; a<3; a++)
+            pos[a] = deltaSum(base[k+a], i, t->deltaMin[a], t->deltaStep[a], sum[a]);
+    }
+}
+
+// Bytes dos blocos e das trilhas
+long long compressedBytes(const CompressedClip* z)
+{
+    return (long long) z->numBlocks * z->blockBytes + z->clip->numNodes * sizeof(ZTrack);
+}
+
+void freeCompressed(CompressedClip* z)
+{
+    if(!z)
+        return;
+    memAdd(MEM_FRAMES, -compressedBytes(z));
+    freeClip(z->clip);
+    free(z->tracks);
+    free(z->data);
+    free(z);
+}
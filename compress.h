@@ -0,0 +1,51 @@
+// **********************************************************************
+//	compress.h
+//  Formato compactado de clips (.bvhz): rotacoes em quaternios
+//  quantizados em 32 bits ("smallest three"), translacoes como
+//  diferencas de frame a frame quantizadas em 16 bits pela faixa de
+//  cada eixo, e trilhas constantes gravadas uma vez so. Os frames ficam
+//  em blocos de tamanho fixo, cada um com a posicao absoluta no seu
+//  inicio: qualquer frame e decodificado sem ler os anteriores
+// **********************************************************************
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "blend.h"
+
+#define COMPRESS_MAGIC "BVHZ"
+#define COMPRESS_VERSION 1
+#define COMPRESS_BLOCK 32    // frames por bloco
+
+// Trilhas de um nodo (4 bytes por campo, gravado como esta no arquivo)
+typedef struct {
+    int rotTrack;        // indice da trilha de rotacao, ou -1 se constante
+    int transTrack;      // indice da trilha de translacao, ou -1
+    uint32_t rotConst;   // rotacao constante (quaternio quantizado)
+    float transConst[3]; // translacao constante (o offset, se nao houver canais)
+    float deltaMin[3];   // diferenca = deltaMin + q * deltaStep
+    float deltaStep[3];
+} ZTrack;
+
+typedef struct {
+    Clip* clip;          // esqueleto, numFrames e frameTime (sem frames)
+    int blockFrames;
+    int numRot, numTrans;
+    int numBlocks;
+    int frameBytes;      // registro de um frame: codigos de rotacao e diferencas
+    int blockBytes;      // posicoes absolutas + blockFrames registros
+    ZTrack* tracks;      // um por nodo
+    unsigned char* data;
+} CompressedClip;
+
+int writeCompressed(FILE* fp, Clip* clip);
+int saveCompressed(Clip* clip, const char* fileName);
+CompressedClip* loadCompressed(const char* fileName);
+void compressedPose(const CompressedClip* z, int frame, Pose* p);
+long long compressedBytes(const CompressedClip* z);
+void freeCompressed(CompressedClip* z);
+
+#endif
@@ -0,0 +1,382 @@
+// **********************************************************************
+//	graph.c
+//  Pose de um frame: posicoes de todas as juntas no referencial da raiz
+//  (relativas a ela e giradas pela direcao do quadril; a raiz guarda a
+//  altura) e suas velocidades, em deslocamento por 1/30 s. A distancia
+//  entre dois frames e a soma dos quadrados das diferencas; o custo de
+//  uma transicao e a raiz da media por junta
+//
+//  A matriz de cada par de clips e calculada em blocos de GRAPH_TILE x
+//  GRAPH_TILE frames (mais uma borda de um frame, para os vizinhos), que
+//  cabem na cache e nao precisam da matriz inteira na memoria. Os pares
+//  de clips sao as tarefas do pool. Um minimo local abaixo do limite
+//  vira transicao nos dois sentidos
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <stdatomic.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "graph.h"
+#include "pool.h"
+#include "timer.h"
+
+#define VEL_WEIGHT (1/30.0f)
+
+typedef struct {
+    int a, b;            // clips, a <= b
+    GraphEdge* edges;    // arestas encontradas, com a origem em src
+    int* src;
+    int numEdges, cap;
+} Pair;
+
+typedef struct {
+    Clip** clips;
+    int numClips;
+    GraphOptions* opt;
+    float** features;    // frames x dims[c] de cada clip
+    int* dims;
+    Pair* pairs;
+    atomic_llong distances;
+} Build;
+
+// **********************************************************************
+//  Poses
+// **********************************************************************
+
+static int featureDims(Clip* clip)
+{
+    return (clip->numNodes * 6 + 3) & ~3;
+}
+
+static void featureTask(int c, void* arg)
+{
+    Build* B = arg;
+    Clip* clip = B->clips[c];
+    int n = clip->numNodes, dims = featureDims(clip);
+    float* world = malloc(n * 16 * sizeof(float));
+    float* prev = malloc(n * 3 * sizeof(float));
+    float* out = calloc((size_t) clip->numFrames * dims, sizeof(float));
+    float scale = clip->frameTime > 0 ? VEL_WEIGHT / clip->frameTime : 3;
+
+    for(int f=0; f<clip->numFrames; f++) {
+        forwardKinematicsSimd(clip, clipFrame(clip, f), world);
+        float dx = world[8], dz = world[10];
+        float len = sqrtf(dx*dx + dz*dz);
+        float fx = len > 1e-6f ? dx / len : 0, fz = len > 1e-6f ? dz / len : 1;
+        float* o = out + (size_t) f * dims;
+        for(int i=0; i<n; i++) {
+            const float* w = world + i*16 + 12;
+            float px = w[0] - world[12], pz = w[2] - world[14];
+            float* p = o + i*3;
+            p[0] = px*fz - pz*fx;
+            p[1] = i > 0 ? w[1] - world[13] : w[1];
+            p[2] = px*fx + pz*fz;
+        }
+        // Velocidades (o primeiro frame repete as do segundo, abaixo)
+        if(f > 0)
+            for(int k=0; k<n*3; k++)
+                o[n*3 + k] = (o[k] - prev[k]) * scale;
+        memcpy(prev, o, n * 3 * sizeof(float));
+    }
+    if(clip->numFrames > 1)
+        memcpy(out + n*3, out + dims + n*3, n * 3 * sizeof(float));
+    B->features[c] = out;
+    B->dims[c] = dims;
+    free(prev);
+    free(world);
+}
+
+// Hash da hierarquia (nomes e pais, sem os offsets, que variam entre
+// as capturas do mesmo ator): clips comparaveis tem o mesmo
+static unsigned long long topologyHash(Clip* clip)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for(int i=0; i<clip->numNodes; i++) {
+        Node* n = clip->nodes[i];
+        int parent = n->parent ? n->parent->index : -1;
+        for(const char* c=n->name; ; c++) {
+            h = (h ^ (unsigned char) *c) * 1099511628211ULL;
+            if(!*c)
+                break;
+        }
+        h = (h ^ (unsigned int) parent) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// **********************************************************************
+//  Distancias
+// **********************************************************************
+
+// Distancias de a ate b[0..3] (vetores de dims floats, multiplo de 4)
+static void distance4(const float* a, const float* const* b, int dims, float* out)
+{
+#ifdef __SSE__
+    __m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    for(int k=0; k<dims; k+=4) {
+        __m128 va = _mm_loadu_ps(a + k);
+        __m128 d0 = _mm_sub_ps(va, _mm_loadu_ps(b[0] + k));
+        __m128 d1 = _mm_sub_ps(va, _mm_loadu_ps(b[1] + k));
+        __m128 d2 = _mm_sub_ps(va, _mm_loadu_ps(b[2] + k));
+        __m128 d3 = _mm_sub_ps(va, _mm_loadu_ps(b[3] + k));
+        s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+        s2 = _mm_add_ps(s2, _mm_mul_ps(d2, d2));
+        s3 = _mm_add_ps(s3, _mm_mul_ps(d3, d3));
+    }
+    // Soma horizontal das quatro de uma vez
+    _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+    _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+#else
+    for(int j=0; j<4; j++) {
+        float sum = 0;
+        for(int k=0; k<dims; k++)
+            sum += (a[k] - b[j][k]) * (a[k] - b[j][k]);
+        out[j] = sum;
+    }
+#endif
+}
+
+// Bloco de linhas [i0-1, i0+GRAPH_TILE] x colunas [j0-1, j0+GRAPH_TILE]
+// (fora dos clips: FLT_MAX). Retorna as distancias calculadas
+static long long computeTile(const float* A, int fa, const float* Bf, int fb, int dims,
+                             int i0, int j0, float* tile)
+{
+    const int W = GRAPH_TILE + 2;
+    int c0 = j0 > 0 ? j0-1 : 0;
+    int c1 = j0 + GRAPH_TILE + 1 < fb ? j0 + GRAPH_TILE + 1 : fb;
+    long long count = 0;
+
+    for(int ti=0; ti<W; ti++) {
+        float* row = tile + ti*W;
+        int i = i0 - 1 + ti;
+        for(int tj=0; tj<W; tj++)
+            row[tj] = FLT_MAX;
+        if(i < 0 || i >= fa)
+            continue;
+        const float* a = A + (size_t) i * dims;
+        int j = c0;
+        for(; j+4<=c1; j+=4) {
+            const float* b[4] = { Bf + (size_t) j * dims, Bf + (size_t) (j+1) * dims,
+                                  Bf + (size_t) (j+2) * dims, Bf + (size_t) (j+3) * dims };
+            distance4(a, b, dims, row + j - (j0-1));
+        }
+        for(; j<c1; j++) {
+            const float* b[4] = { Bf + (size_t) j * dims, Bf + (size_t) j * dims,
+                                  Bf + (size_t) j * dims, Bf + (size_t) j * dims };
+            float d[4];
+            distance4(a, b, dims, d);
+            row[j - (j0-1)] = d[0];
+        }
+        count += c1 - c0;
+    }
+    return count;
+}
+
+static void addEdge(Pair* p, int src, int srcFrame, int dst, int dstFrame, float cost)
+{
+    if(p->numEdges == p->cap) {
+        p->cap = p->cap ? p->cap*2 : 64;
+        p->edges = realloc(p->edges, p->cap * sizeof(GraphEdge));
+        p->src = realloc(p->src, p->cap * sizeof(int));
+    }
+    GraphEdge* e = &p->edges[p->numEdges];
+    p->src[p->numEdges++] = src;
+    e->srcFrame = srcFrame;
+    e->dstFrame = dstFrame;
+    e->dstClip = (unsigned short) dst;
+    float c = cost * 100 + 0.5f;
+    e->cost = c < 65535 ? (unsigned short) c : 65535;
+}
+
+static void pairTask(int index, void* arg)
+{
+    Build* B = arg;
+    Pair* p = &B->pairs[index];
+    const int W = GRAPH_TILE + 2;
+    float tile[(GRAPH_TILE + 2) * (GRAPH_TILE + 2)];
+    Clip* ca = B->clips[p->a];
+    Clip* cb = B->clips[p->b];
+    int fa = ca->numFrames, fb = cb->numFrames, dims = B->dims[p->a];
+    int joints = ca->numNodes;
+    float limit = B->opt->threshold * B->opt->threshold * joints;
+    int self = p->a == p->b;
+    int gap = self ? (int) (B->opt->minGap / (ca->frameTime > 0 ? ca->frameTime : 1/30.0f)) : 0;
+    long long count = 0;
+
+    for(int i0=0; i0<fa; i0+=GRAPH_TILE)
+        for(int j0=0; j0<fb; j0+=GRAPH_TILE) {
+            // Clip com ele mesmo: a matriz e simetrica, so acima da diagonal
+            if(self && j0 + GRAPH_TILE <= i0 + gap)
+                continue;
+            count += computeTile(B->features[p->a], fa, B->features[p->b], fb, dims, i0, j0, tile);
+            for(int ti=1; ti<=GRAPH_TILE; ti++) {
+                int i = i0 + ti - 1;
+                if(i >= fa - 1)
+                    break;
+                for(int tj=1; tj<=GRAPH_TILE; tj++) {
+                    int j = j0 + tj - 1;
+                    if(j >= fb - 1)
+                        break;
+                    if(self && j - i < gap)
+                        continue;
+                    const float* c = tile + ti*W + tj;
+                    float v = *c;
+                    // Minimo local; empates ficam com o primeiro na ordem de varredura
+                    if(v >= limit || v >= c[-W-1] || v >= c[-W] || v >= c[-W+1] || v >= c[-1]
+                       || v > c[1] || v > c[W-1] || v > c[W] || v > c[W+1])
+                        continue;
+                    float cost = sqrtf(v / joints);
+                    addEdge(p, p->a, i, p->b, j, cost);
+                    addEdge(p, p->b, j, p->a, i, cost);
+                }
+            }
+        }
+    atomic_fetch_add(&B->distances, count);
+}
+
+static int cmpEdge(const void* x, const void* y)
+{
+    const GraphEdge* a = x;
+    const GraphEdge* b = y;
+    if(a->srcFrame != b->srcFrame)
+        return a->srcFrame - b->srcFrame;
+    if(a->dstClip != b->dstClip)
+        return a->dstClip - b->dstClip;
+    return a->dstFrame - b->dstFrame;
+}
+
+// **********************************************************************
+//  Monta o grafo dos clips. Compara so clips de mesma hierarquia
+//  stats, se nao for NULL, recebe tempos e tamanhos
+// **********************************************************************
+MotionGraph* graphBuild(Clip** clips, int numClips, GraphOptions* opt, GraphStats* stats)
+{
+    Build B;
+    GraphStats st;
+    memset(&st, 0, sizeof(st));
+    if(numClips > GRAPH_MAX_CLIPS)
+        return NULL;
+    B.clips = clips;
+    B.numClips = numClips;
+    B.opt = opt;
+    B.features = calloc(numClips, sizeof(float*));
+    B.dims = calloc(numClips, sizeof(int));
+    atomic_init(&B.distances, 0);
+
+    double t0 = timerNow();
+    poolRun(opt->numThreads, numClips, featureTask, &B);
+    for(int c=0; c<numClips; c++)
+        st.featureBytes += (long long) clips[c]->numFrames * B.dims[c] * sizeof(float);
+    memAdd(MEM_POSES, st.featureBytes);
+    double t1 = timerNow();
+
+    // Pares de clips de mesmo esqueleto, incluindo cada clip com ele mesmo
+    unsigned long long* hash = malloc(numClips * sizeof(unsigned long long));
+    for(int c=0; c<numClips; c++)
+        hash[c] = topologyHash(clips[c]);
+    int numPairs = 0, capPairs = 0;
+    B.pairs = NULL;
+    for(int a=0; a<numClips; a++)
+        for(int b=a; b<numClips; b++) {
+            if(hash[a] != hash[b] || clips[a]->numFrames < 2 || clips[b]->numFrames < 2)
+                continue;
+            if(numPairs == capPairs) {
+                capPairs = capPairs ? capPairs*2 : 256;
+                B.pairs = realloc(B.pairs, capPairs * sizeof(Pair));
+            }
+            memset(&B.pairs[numPairs], 0, sizeof(Pair));
+            B.pairs[numPairs].a = a;
+            B.pairs[numPairs++].b = b;
+        }
+    free(hash);
+    poolRun(opt->numThreads, numPairs, pairTask, &B);
+    double t2 = timerNow();
+
+    // CSR por clip de origem
+    MotionGraph* g = calloc(1, sizeof(MotionGraph));
+    g->numClips = numClips;
+    g->numFrames = malloc(numClips * sizeof(int));
+    g->first = calloc(numClips + 1, sizeof(int));
+    for(int c=0; c<numClips; c++)
+        g->numFrames[c] = clips[c]->numFrames;
+    for(int p=0; p<numPairs; p++)
+        for(int e=0; e<B.pairs[p].numEdges; e++)
+            g->first[B.pairs[p].src[e] + 1]++;
+    for(int c=0; c<numClips; c++)
+        g->first[c+1] += g->first[c];
+    g->numEdges = g->first[numClips];
+    g->edges = malloc((g->numEdges ? g->numEdges : 1) * sizeof(GraphEdge));
+    int* fill = malloc(numClips * sizeof(int));
+    memcpy(fill, g->first, numClips * sizeof(int));
+    for(int p=0; p<numPairs; p++) {
+        Pair* pr = &B.pairs[p];
+        for(int e=0; e<pr->numEdges; e++)
+            g->edges[fill[pr->src[e]]++] = pr->edges[e];
+        free(pr->edges);
+        free(pr->src);
+    }
+    for(int c=0; c<numClips; c++)
+        qsort(g->edges + g->first[c], g->first[c+1] - g->first[c], sizeof(GraphEdge), cmpEdge);
+    free(fill);
+
+    memAdd(MEM_POSES, -st.featureBytes);
+    for(int c=0; c<numClips; c++)
+        free(B.features[c]);
+    free(B.features);
+    free(B.dims);
+    free(B.pairs);
+
+    st.pairs = numPairs;
+    st.distances = atomic_load(&B.distances);
+    st.graphBytes = (long long) g->numEdges * sizeof(GraphEdge) + (long long) (2*numClips + 1) * sizeof(int);
+    st.featureMs = t1 - t0;
+    st.matrixMs = t2 - t1;
+    if(stats)
+        *stats = st;
+    return g;
+}
+
+void graphFree(MotionGraph* g)
+{
+    if(!g)
+        return;
+    free(g->numFrames);
+    free(g->first);
+    free(g->edges);
+    free(g);
+}
+
+// **********************************************************************
+//  Arquivo: "BVHG", versao, numClips, numEdges; por clip, numFrames e o
+//  caminho (tamanho + bytes); first[numClips+1]; as arestas
+// **********************************************************************
+int graphSave(MotionGraph* g, char** paths, const char* fileName)
+{
+    FILE* fp = fopen(fileName, "wb");
+    if(!fp)
+        return 0;
+    int header[3] = { 1, g->numClips, g->numEdges };
+    fwrite("BVHG", 1, 4, fp);
+    fwrite(header, sizeof(int), 3, fp);
+    for(int c=0; c<g->numClips; c++) {
+        int len = (int) strlen(paths[c]);
+        fwrite(&g->numFrames[c], sizeof(int), 1, fp);
+        fwrite(&len, sizeof(int), 1, fp);
+        fwrite(paths[c], 1, len, fp);
+    }
+    fwrite(g->first, sizeof(int), g->numClips + 1, fp);
+    fwrite(g->edges, sizeof(GraphEdge), g->numEdges, fp);
+    int ok = !ferror(fp);
+    return fclose(fp) == 0 && ok;
+}
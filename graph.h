@@ -0,0 +1,55 @@
+// **********************************************************************
+//	graph.h
+//  Grafo de movimento: transicoes entre frames parecidos de clips do
+//  mesmo esqueleto, encontradas como minimos locais da matriz de
+//  distancias entre poses de cada par de clips
+// **********************************************************************
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "bvh.h"
+
+// Lado dos blocos da matriz de distancias (frames)
+#define GRAPH_TILE 64
+
+// Transicao do frame srcFrame do clip de origem para dstFrame de dstClip
+typedef struct {
+    int srcFrame;
+    int dstFrame;
+    unsigned short dstClip;
+    unsigned short cost;     // distancia (RMS por junta) em centesimos, saturada
+} GraphEdge;
+
+// Arestas agrupadas por clip de origem (CSR): as do clip c estao em
+// edges[first[c] .. first[c+1]), em ordem de srcFrame
+typedef struct {
+    int numClips;
+    int* numFrames;
+    int* first;
+    GraphEdge* edges;
+    int numEdges;
+} MotionGraph;
+
+typedef struct {
+    float threshold;     // distancia maxima (unidades do arquivo)
+    float minGap;        // segundos entre frames do mesmo clip
+    int numThreads;
+} GraphOptions;
+
+typedef struct {
+    long long pairs;         // pares de clips comparados
+    long long distances;     // distancias calculadas (com as bordas dos blocos)
+    long long featureBytes;
+    long long graphBytes;
+    double featureMs;
+    double matrixMs;
+} GraphStats;
+
+#define GRAPH_MAX_CLIPS 65535
+
+MotionGraph* graphBuild(Clip** clips, int numClips, GraphOptions* opt, GraphStats* stats);
+int graphSave(MotionGraph* g, char** paths, const char* fileName);
+void graphFree(MotionGraph* g);
+
+#endif
@@ -0,0 +1,131 @@
+// **********************************************************************
+//	hwcount.c
+//  Um descritor de perf_event_open por contador, medindo so a thread
+//  atual em modo usuario. Contadores que o kernel recusa (containers,
+//  perf_event_paranoid, maquinas virtuais) ficam indisponiveis e sao
+//  lidos como -1; os demais continuam funcionando
+// **********************************************************************
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "hwcount.h"
+
+static const char* names[NUM_HW_COUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+const char* hwName(int counter)
+{
+    return names[counter];
+}
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int fds[NUM_HW_COUNTERS] = { -1, -1, -1, -1, -1 };
+
+static int openCounter(unsigned type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Tempo habilitado/rodando, para corrigir a multiplexacao
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Abre os contadores; retorna quantos estao disponiveis
+int hwOpen()
+{
+    int count = 0;
+    fds[HW_CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[HW_INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[HW_L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                     | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    fds[HW_LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[HW_BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    for(int i=0; i<NUM_HW_COUNTERS; i++)
+        if(fds[i] >= 0)
+            count++;
+    return count;
+}
+
+void hwStart()
+{
+    for(int i=0; i<NUM_HW_COUNTERS; i++)
+        if(fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+void hwStop()
+{
+    for(int i=0; i<NUM_HW_COUNTERS; i++)
+        if(fds[i] >= 0)
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+}
+
+// Le os contadores (escalados se houve multiplexacao); -1 se indisponivel
+int hwRead(long long values[NUM_HW_COUNTERS])
+{
+    int count = 0;
+    for(int i=0; i<NUM_HW_COUNTERS; i++) {
+        unsigned long long v[3];   // valor, tempo habilitado, tempo rodando
+        values[i] = -1;
+        if(fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+            continue;
+        values[i] = v[2] < v[1] ? (long long) ((double) v[0] * v[1] / v[2]) : (long long) v[0];
+        count++;
+    }
+    return count;
+}
+
+void hwClose()
+{
+    for(int i=0; i<NUM_HW_COUNTERS; i++)
+        if(fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+}
+
+#else
+
+int hwOpen()
+{
+    return 0;
+}
+
+void hwStart()
+{
+}
+
+void hwStop()
+{
+}
+
+int hwRead(long long values[NUM_HW_COUNTERS])
+{
+    for(int i=0; i<NUM_HW_COUNTERS; i++)
+        values[i] = -1;
+    return 0;
+}
+
+void hwClose()
+{
+}
+
+#endif
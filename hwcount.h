@@ -0,0 +1,25 @@
+// **********************************************************************
+//	hwcount.h
+//  Contadores de hardware (perf_event_open, so no Linux)
+// **********************************************************************
+
+#ifndef HWCOUNT_H
+#define HWCOUNT_H
+
+enum {
+    HW_CYCLES,
+    HW_INSTRUCTIONS,
+    HW_L1D_MISSES,
+    HW_LLC_MISSES,
+    HW_BRANCH_MISSES,
+    NUM_HW_COUNTERS
+};
+
+int hwOpen();
+void hwStart();
+void hwStop();
+int hwRead(long long values[NUM_HW_COUNTERS]);
+const char* hwName(int counter);
+void hwClose();
+
+#endif
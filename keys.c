@@ -0,0 +1,355 @@
+// **********************************************************************
+//	keys.c
+//  A tolerancia de cada canal de rotacao e a de posicao dividida pelo
+//  alcance da junta (maior distancia, pela hierarquia, ate uma
+//  extremidade abaixo dela): um erro de theta radianos move essa
+//  extremidade no maximo theta x alcance. As tolerancias somadas de
+//  varias juntas podem passar do limite, entao o erro real e medido
+//  por FK e todas sao multiplicadas pela maior escala que o respeita
+//
+//  Cada canal e reduzido de forma gulosa: um segmento cresce enquanto a
+//  reta entre as suas keys passa a menos da tolerancia de todos os
+//  frames intermediarios, ate KEYS_MAX_SPAN frames (o custo e quadratico
+//  no comprimento do segmento). Cubicas de Hermite com a inclinacao em
+//  cada key precisam de menos keys, mas nao de menos bytes: a captura a
+//  30 Hz tem ruido de quase um grau de frame a frame
+//
+//  Uma key custa 6 bytes (frame em 16 bits e valor) e um frame denso 4:
+//  canais com keys em mais de 2/3 dos frames ficam densos
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "keys.h"
+
+#define RAD2DEG 57.29577951308232f
+#define MAX_PASSES 12
+#define REFINE_PASSES 3
+#define KEYS_MAX_SPAN 256
+
+// Alcance de cada nodo: maior comprimento de caminho ate um End Site
+static void nodeReach(Clip* clip, float* reach)
+{
+    // Pos-ordem: filhos antes dos pais
+    for(int j=clip->numNodes-1; j>=0; j--) {
+        Node* n = clip->nodes[j];
+        float r = 0;
+        for(int c=0; c<n->numChildren; c++) {
+            Node* ch = n->children[c];
+            float len = sqrtf(ch->offset[0]*ch->offset[0] + ch->offset[1]*ch->offset[1]
+                              + ch->offset[2]*ch->offset[2]);
+            if(len + reach[ch->index] > r)
+                r = len + reach[ch->index];
+        }
+        reach[j] = r;
+    }
+}
+
+// Keys de um canal (valores com passo stride) dentro de tol; retorna
+// quantas foram gravadas em frames
+static int reduceChannel(const float* v, int stride, int numFrames, float tol, int* frames)
+{
+    int n = 0, start = 0;
+    frames[n++] = 0;
+    while(start < numFrames - 1) {
+        // Maior end tal que a reta start-end aproxima todos os frames entre eles
+        float a = v[(size_t) start * stride];
+        int end = start + 1;
+        while(end + 1 < numFrames && end + 1 - start <= KEYS_MAX_SPAN) {
+            int next = end + 1;
+            float b = v[(size_t) next * stride];
+            float step = (b - a) / (next - start);
+            int ok = 1;
+            for(int f=start+1; f<next && ok; f++)
+                ok = fabsf(a + step * (f - start) - v[(size_t) f * stride]) <= tol;
+            if(!ok)
+                break;
+            end = next;
+        }
+        frames[n++] = end;
+        start = end;
+    }
+    return n;
+}
+
+static void releaseKeys(KeyClip* k)
+{
+    free(k->first);
+    free(k->firstFrame);
+    free(k->keyFrame);
+    free(k->keyValue);
+    memset(k, 0, sizeof(KeyClip));
+}
+
+// Matriz numFrames x numChannels com todos os canais: a do clip ou, se
+// ele for compactado, em 16 bits ou mapeado, uma copia montada por
+// clipFrame (em *copy, a liberar)
+static const float* fullFrames(Clip* clip, float** copy)
+{
+    *copy = NULL;
+    if(!clip->map && !clip->stored)
+        return clip->frames;
+    int nc = clip->numChannels;
+    *copy = malloc((size_t) clip->numFrames * nc * sizeof(float));
+    if(*copy)
+        for(int f=0; f<clip->numFrames; f++)
+            memcpy(*copy + (size_t) f * nc, clipFrame(clip, f), nc * sizeof(float));
+    return *copy;
+}
+
+// Canal cujas keys custam ao menos os seus frames densos
+static int denseChannel(int keys, int frames)
+{
+    return (long long) keys * (sizeof(unsigned short) + sizeof(float))
+        >= (long long) frames * sizeof(float);
+}
+
+// Numero de keys do canal c em scratch (a ultima e o ultimo frame)
+static int channelKeys(const int* scratch, int c, int frames)
+{
+    const int* kf = scratch + (size_t) c * frames;
+    int n = 1;
+    while(kf[n-1] != frames - 1)
+        n++;
+    return n;
+}
+
+// Reduz os frames m com as tolerancias por canal tol; k->first e
+// k->firstFrame ja alocados. Se as keys nao ficarem menores que a
+// matriz original, o clip inteiro fica denso
+static int reduceAll(Clip* clip, const float* m, const float* tol, KeyClip* k, int* scratch)
+{
+    int nc = clip->numChannels, frames = clip->numFrames;
+    long long values = 0, frameKeys = 0;
+    for(int c=0; c<nc; c++) {
+        int n = reduceChannel(m + c, nc, frames, tol[c], scratch + (size_t) c * frames);
+        if(denseChannel(n, frames))
+            values += frames;
+        else {
+            values += n;
+            frameKeys += n;
+        }
+    }
+    free(k->keyFrame);
+    free(k->keyValue);
+    k->keyFrame = NULL;
+    k->dense = 0;
+    k->numKeys = (int) values;
+    k->numFrameKeys = (int) frameKeys;
+    long long raw = (long long) frames * nc * sizeof(float);
+    if(frames > KEYS_MAX_FRAMES || keysBytes(k) >= raw) {
+        k->dense = 1;
+        k->numKeys = frames * nc;
+        k->numFrameKeys = 0;
+        k->keyValue = malloc(raw);
+        if(!k->keyValue)
+            return 0;
+        memcpy(k->keyValue, m, raw);
+        return 1;
+    }
+    k->keyFrame = malloc(frameKeys * sizeof(unsigned short));
+    k->keyValue = malloc(values * sizeof(float));
+    if((!k->keyFrame && frameKeys) || !k->keyValue)
+        return 0;
+    int pos = 0, posFrame = 0;
+    for(int c=0; c<nc; c++) {
+        const int* kf = scratch + (size_t) c * frames;
+        int n = channelKeys(scratch, c, frames);
+        k->first[c] = pos;
+        k->firstFrame[c] = posFrame;
+        if(denseChannel(n, frames)) {
+            for(int f=0; f<frames; f++)
+                k->keyValue[pos++] = m[(size_t) f * nc + c];
+            continue;
+        }
+        for(int i=0; i<n; i++) {
+            k->keyFrame[posFrame++] = (unsigned short) kf[i];
+            k->keyValue[pos++] = m[(size_t) kf[i] * nc + c];
+        }
+    }
+    k->first[nc] = pos;
+    k->firstFrame[nc] = posFrame;
+    return 1;
+}
+
+static int reduceScaled(Clip* clip, const float* m, const float* base, float scale, float* tol,
+                        KeyClip* k, int* scratch)
+{
+    for(int c=0; c<clip->numChannels; c++)
+        tol[c] = base[c] * scale;
+    return reduceAll(clip, m, tol, k, scratch);
+}
+
+// **********************************************************************
+//  Reduz clip com erro maximo tolerance nas extremidades. Retorna 0 se
+//  faltar memoria (ou o clip nao tiver frames)
+// **********************************************************************
+int keysReduce(Clip* clip, float tolerance, KeyClip* k, KeyStats* stats)
+{
+    int nc = clip->numChannels, frames = clip->numFrames;
+    memset(k, 0, sizeof(KeyClip));
+    if(frames == 0)
+        return 0;
+    k->numChannels = nc;
+    k->numFrames = frames;
+    k->first = malloc((nc + 1) * sizeof(int));
+    k->firstFrame = malloc((nc + 1) * sizeof(int));
+    float* reach = malloc(clip->numNodes * sizeof(float));
+    float* base = malloc(nc * sizeof(float));
+    float* tol = malloc(nc * sizeof(float));
+    int* scratch = malloc((size_t) nc * frames * sizeof(int));
+    float* copy;
+    const float* m = fullFrames(clip, &copy);
+    int ok = k->first && k->firstFrame && reach && base && tol && scratch && m;
+
+    if(ok) {
+        nodeReach(clip, reach);
+        for(int j=0; j<clip->numNodes; j++) {
+            Node* n = clip->nodes[j];
+            for(int c=0; c<n->channels; c++)
+                base[n->firstChannel + c] = n->channelType[c] < CH_XROT ? tolerance
+                    : reach[j] > 0 ? tolerance / reach[j] * RAD2DEG : 360;
+        }
+    }
+    // Metade da escala ate o erro ficar no limite; depois, busca binaria
+    // entre a ultima escala que passou e a que falhou
+    float scale = 1, err = 0;
+    int pass = 0;
+    while(ok && pass < MAX_PASSES) {
+        ok = reduceScaled(clip, m, base, scale, tol, k, scratch);
+        pass++;
+        if(ok && (err = keysMaxError(clip, k)) <= tolerance)
+            break;
+        scale *= 0.5f;
+    }
+    if(ok && err <= tolerance && pass > 1) {
+        float lo = scale, hi = scale * 2, loErr = err;
+        for(int r=0; r<REFINE_PASSES && ok; r++) {
+            float mid = (lo + hi) * 0.5f;
+            ok = reduceScaled(clip, m, base, mid, tol, k, scratch);
+            pass++;
+            if(ok && (err = keysMaxError(clip, k)) <= tolerance)
+                lo = mid, loErr = err;
+            else
+                hi = mid;
+        }
+        if(ok && err > tolerance) {
+            ok = reduceScaled(clip, m, base, lo, tol, k, scratch);
+            err = loErr;
+        }
+    }
+    // Sem convergir (tolerancia abaixo da precisao do arquivo): todas as keys
+    if(ok && err > tolerance) {
+        for(int c=0; c<nc; c++)
+            tol[c] = -1;
+        ok = reduceAll(clip, m, tol, k, scratch);
+        err = ok ? keysMaxError(clip, k) : 0;
+    }
+    free(copy);
+    free(scratch);
+    free(tol);
+    free(base);
+    free(reach);
+    if(!ok) {
+        releaseKeys(k);
+        return 0;
+    }
+    if(k->dense) {
+        // Sem indices por canal
+        free(k->first);
+        free(k->firstFrame);
+        k->first = k->firstFrame = NULL;
+    }
+    memAdd(MEM_FRAMES, keysBytes(k));
+    if(stats) {
+        stats->maxError = err;
+        stats->passes = pass;
+    }
+    return 1;
+}
+
+// **********************************************************************
+//  Reconstrucao: para cada canal, busca binaria da ultima key com
+//  frame <= frame e interpolacao linear ate a seguinte. Canais densos
+//  (e o clip denso) sao lidos direto
+// **********************************************************************
+void keysDecode(const KeyClip* k, int frame, float* out)
+{
+    if(k->dense) {
+        memcpy(out, k->keyValue + (size_t) frame * k->numChannels, k->numChannels * sizeof(float));
+        return;
+    }
+    for(int c=0; c<k->numChannels; c++) {
+        const float* v = k->keyValue + k->first[c];
+        const unsigned short* keys = k->keyFrame + k->firstFrame[c];
+        int last = k->firstFrame[c+1] - k->firstFrame[c] - 1;
+        if(last < 0) {
+            out[c] = v[frame];
+            continue;
+        }
+        // Sem desvios: a metade descartada e escolhida por selecao (cmov)
+        const unsigned short* kf = keys;
+        int n = last + 1;
+        while(n > 1) {
+            int half = n >> 1;
+            kf = kf[half] <= frame ? kf + half : kf;
+            n -= half;
+        }
+        int i = (int) (kf - keys);
+        if(i == last || *kf == frame)
+            out[c] = v[i];
+        else {
+            float u = (float) (frame - kf[0]) / (kf[1] - kf[0]);
+            out[c] = v[i] + (v[i+1] - v[i]) * u;
+        }
+    }
+}
+
+// Maior distancia entre as posicoes originais e as reconstruidas das
+// extremidades (End Sites), em todos os frames
+float keysMaxError(Clip* clip, const KeyClip* k)
+{
+    int n = clip->numNodes;
+    float* a = malloc(n * 16 * sizeof(float));
+    float* b = malloc(n * 16 * sizeof(float));
+    float* frame = malloc(clip->numChannels * sizeof(float));
+    float err = 0;
+    for(int f=0; f<clip->numFrames; f++) {
+        keysDecode(k, f, frame);
+        forwardKinematicsSimd(clip, clipFrame(clip, f), a);
+        forwardKinematicsSimd(clip, frame, b);
+        for(int j=0; j<n; j++) {
+            if(clip->nodes[j]->numChildren)
+                continue;
+            float d = 0;
+            for(int x=12; x<15; x++)
+                d += (a[j*16+x] - b[j*16+x]) * (a[j*16+x] - b[j*16+x]);
+            if(d > err * err)
+                err = sqrtf(d);
+        }
+    }
+    free(frame);
+    free(b);
+    free(a);
+    return err;
+}
+
+// Bytes dos valores, dos numeros de frame e dos indices por canal
+long long keysBytes(const KeyClip* k)
+{
+    long long bytes = (long long) k->numKeys * sizeof(float);
+    if(!k->dense)
+        bytes += (long long) k->numFrameKeys * sizeof(unsigned short)
+            + 2 * (k->numChannels + 1) * sizeof(int);
+    return bytes;
+}
+
+void keysFree(KeyClip* k)
+{
+    if(k->keyValue)
+        memAdd(MEM_FRAMES, -keysBytes(k));
+    releaseKeys(k);
+}
@@ -0,0 +1,42 @@
+// **********************************************************************
+//	keys.h
+//  Reducao de keyframes com erro limitado: cada canal vira uma lista de
+//  keys (frame, valor) interpolada linearmente, com o menor numero de
+//  keys tal que as extremidades (End Sites) nao se afastem mais que a
+//  tolerancia das posicoes originais em nenhum frame. Um canal cujas
+//  keys custariam mais que os seus valores fica denso (todos os frames,
+//  sem os numeros de frame), e o clip inteiro fica denso se nem assim
+//  ficar menor: o resultado nunca passa do tamanho original
+// **********************************************************************
+
+#ifndef KEYS_H
+#define KEYS_H
+
+#include "bvh.h"
+
+#define KEYS_MAX_FRAMES 65536   // numeros de frame em 16 bits
+
+typedef struct {
+    int numChannels;
+    int numFrames;
+    int dense;                 // clip inteiro denso: keyValue e a matriz de frames
+    int* first;                // valores do canal c em [first[c], first[c+1])
+    int* firstFrame;           // frames das keys do canal c (canais densos nao tem)
+    unsigned short* keyFrame;  // crescentes dentro de cada canal
+    float* keyValue;
+    int numKeys;               // valores guardados
+    int numFrameKeys;          // numeros de frame guardados
+} KeyClip;
+
+typedef struct {
+    float maxError;      // maior distancia de uma extremidade (unidades do arquivo)
+    int passes;          // reducoes ate atingir a tolerancia
+} KeyStats;
+
+int keysReduce(Clip* clip, float tolerance, KeyClip* k, KeyStats* stats);
+void keysDecode(const KeyClip* k, int frame, float* out);
+float keysMaxError(Clip* clip, const KeyClip* k);
+long long keysBytes(const KeyClip* k);
+void keysFree(KeyClip* k);
+
+#endif
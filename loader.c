@@ -0,0 +1,218 @@
+// **********************************************************************
+//	loader.c
+//  O loader mantem referencias (clipcache.c) ao clip pedido, a seus
+//  vizinhos e ao que esta sendo exibido; as demais sao soltas a cada
+//  novo pedido e o cache decide quando liberar os clips
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "clipcache.h"
+#include "loader.h"
+#include "trace.h"
+
+typedef struct {
+    char* path;
+    LoadState state;
+    Clip* clip;
+} LoadEntry;
+
+// Pedido atual, em ordem de prioridade: o clip, o proximo e o anterior
+#define NUM_WANTED 3
+
+static LoadEntry* entries;
+static int numEntries;
+static int wanted[NUM_WANTED];
+static int shownEntry = -1;
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+static int quit = 0;
+
+// Precisa ser chamada com lock
+static int isWanted(int index)
+{
+    if(index == shownEntry)
+        return 1;
+    for(int w=0; w<NUM_WANTED; w++)
+        if(wanted[w] == index)
+            return 1;
+    return 0;
+}
+
+// Le os clips pedidos, um por vez, na ordem de prioridade
+static void* loaderThread(void* arg)
+{
+    (void) arg;
+    traceInit("loader");
+    pthread_mutex_lock(&lock);
+    while(!quit) {
+        int next = -1;
+        for(int w=0; w<NUM_WANTED && next<0; w++)
+            if(wanted[w] >= 0 && entries[wanted[w]].state == LOAD_NONE)
+                next = wanted[w];
+        if(next < 0) {
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+        LoadEntry* e = &entries[next];
+        e->state = LOAD_BUSY;
+        pthread_mutex_unlock(&lock);
+
+        TRACE_BEGIN("prefetch");
+        Clip* clip = cacheAcquire(e->path);
+        TRACE_END();
+
+        pthread_mutex_lock(&lock);
+        // O pedido pode ter mudado durante a leitura
+        if(clip && !isWanted(next)) {
+            e->state = LOAD_NONE;
+            pthread_mutex_unlock(&lock);
+            cacheRelease(clip);
+            pthread_mutex_lock(&lock);
+            continue;
+        }
+        e->clip = clip;
+        e->state = clip ? LOAD_READY : LOAD_FAILED;
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static int cmpEntry(const void* a, const void* b)
+{
+    return strcmp(((const LoadEntry*) a)->path, ((const LoadEntry*) b)->path);
+}
+
+// **********************************************************************
+//  Lista os arquivos .bvh e .bvhc de dir (em ordem alfabetica) e inicia
+//  a thread de carga. Retorna a quantidade de arquivos (0 se nenhum)
+// **********************************************************************
+int loaderOpen(const char* dir)
+{
+    DIR* d = opendir(dir);
+    if(!d)
+        return 0;
+    int cap = 0;
+    struct dirent* de;
+    while((de = readdir(d))) {
+        size_t len = strlen(de->d_name);
+        if((len < 4 || strcmp(de->d_name + len - 4, ".bvh"))
+           && (len < 5 || strcmp(de->d_name + len - 5, ".bvhc")))
+            continue;
+        if(numEntries == cap) {
+            cap = cap ? cap*2 : 64;
+            entries = realloc(entries, cap * sizeof(LoadEntry));
+        }
+        LoadEntry* e = &entries[numEntries++];
+        e->path = malloc(strlen(dir) + len + 2);
+        sprintf(e->path, "%s/%s", dir, de->d_name);
+        e->state = LOAD_NONE;
+        e->clip = NULL;
+    }
+    closedir(d);
+    if(numEntries == 0)
+        return 0;
+    qsort(entries, numEntries, sizeof(LoadEntry), cmpEntry);
+
+    for(int w=0; w<NUM_WANTED; w++)
+        wanted[w] = -1;
+    quit = 0;
+    running = pthread_create(&worker, NULL, loaderThread, NULL) == 0;
+    if(!running)
+        fprintf(stderr, "loader: nao foi possivel criar a thread\n");
+    return running ? numEntries : 0;
+}
+
+// Termina a thread (esperando a leitura em andamento) e libera os clips
+void loaderClose()
+{
+    if(running) {
+        pthread_mutex_lock(&lock);
+        quit = 1;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(worker, NULL);
+        running = 0;
+    }
+    for(int i=0; i<numEntries; i++) {
+        cacheRelease(entries[i].clip);
+        free(entries[i].path);
+    }
+    cacheClear();
+    free(entries);
+    entries = NULL;
+    numEntries = 0;
+    shownEntry = -1;
+}
+
+int loaderNumFiles()
+{
+    return numEntries;
+}
+
+const char* loaderPath(int index)
+{
+    return entries[index].path;
+}
+
+// Indice do arquivo com o nome name (sem o diretorio), ou -1
+int loaderFind(const char* name)
+{
+    for(int i=0; i<numEntries; i++) {
+        const char* base = strrchr(entries[i].path, '/') + 1;
+        if(!strcmp(base, name))
+            return i;
+    }
+    return -1;
+}
+
+// **********************************************************************
+//  Pede o clip index e antecipa seus vizinhos (a lista e circular)
+//  shown: clip em exibicao, que nao pode ser liberado (-1 se nenhum)
+//  Clips prontos fora do pedido voltam para o cache
+// **********************************************************************
+void loaderRequest(int index, int shown)
+{
+    Clip* released[NUM_WANTED+1];
+    int numReleased = 0;
+
+    pthread_mutex_lock(&lock);
+    wanted[0] = index;
+    wanted[1] = (index + 1) % numEntries;
+    wanted[2] = (index + numEntries - 1) % numEntries;
+    shownEntry = shown;
+    for(int i=0; i<numEntries; i++)
+        if(entries[i].state == LOAD_READY && !isWanted(i)) {
+            // No maximo os do pedido anterior
+            if(numReleased < NUM_WANTED+1)
+                released[numReleased++] = entries[i].clip;
+            else
+                cacheRelease(entries[i].clip);
+            entries[i].clip = NULL;
+            entries[i].state = LOAD_NONE;
+        }
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+
+    for(int i=0; i<numReleased; i++)
+        cacheRelease(released[i]);
+}
+
+// Estado do clip index; quando LOAD_READY, *clip recebe o clip
+int loaderPoll(int index, Clip** clip)
+{
+    pthread_mutex_lock(&lock);
+    int state = entries[index].state;
+    *clip = entries[index].clip;
+    pthread_mutex_unlock(&lock);
+    return state;
+}
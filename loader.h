@@ -0,0 +1,30 @@
+// **********************************************************************
+//	loader.h
+//  Carga de clips em segundo plano: uma thread le os arquivos de um
+//  diretorio sob demanda e antecipa os vizinhos (proximo e anterior)
+//  do clip pedido, para a troca de clip nao travar a janela
+// **********************************************************************
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "bvh.h"
+
+typedef enum {
+    LOAD_NONE,         // nao carregado
+    LOAD_BUSY,         // sendo lido pela thread
+    LOAD_READY,        // pronto (loaderClip)
+    LOAD_FAILED        // erro de leitura
+} LoadState;
+
+int loaderOpen(const char* dir);
+void loaderClose();
+
+int loaderNumFiles();
+const char* loaderPath(int index);
+int loaderFind(const char* name);
+
+void loaderRequest(int index, int shown);
+int loaderPoll(int index, Clip** clip);
+
+#endif
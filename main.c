@@ -20,17 +20,13 @@
 #include <GL/glut.h>
 #endif
 
-typedef struct Node Node;
-
-struct Node {
-    char name[20];       // nome
-    float offset[3];     // offset (deslocamento)
-    int channels;        // qtd de canais (3 ou 6)
-    float* channelData;  // vetor com os dados dos canais
-    int numChildren;     // qtd de filhos
-    Node** children;     // vetor de ponteiros para os filhos
-    Node* parent;        // ponteiro para o pai
-};
+#include "bvh.h"
+#include "perf.h"
+#include "trace.h"
+#include "alloc.h"
+#include "clipcache.h"
+#include "loader.h"
+#include "blend.h"
 
 // Raiz da hierarquia
 Node* root;
@@ -43,7 +39,6 @@ int curFrame = 0;
 
 // Funcoes para liberacao de memoria da hierarquia
 void freeTree();
-void freeNode(Node* node);
 
 // Variaveis globais para manipulacao da visualizacao 3D
 int width,height;
@@ -57,42 +52,35 @@ float Obs[3] = {0,0,-80};
 float Alvo[3];
 float ObsIni[3];
 
-// **********************************************************************
-//  Cria um nodo novo para a hierarquia, fazendo também a ligacao com
-//  o seu pai (se houver)
-//  Parametros:
-//  - name: string com o nome do nodo
-//  - parent: ponteiro para o nodo pai (NULL se for a raiz)
-//  - numChannels: quantidade de canais de transformacao (3 ou 6)
-//  - ofx, ofy, ofz: offset (deslocamento) lido do arquivo
-//  - numChildren: quantidade de filhos que serao inseridos posteriormente
-// **********************************************************************
-Node* createNode(char name[20], Node* parent, int numChannels, float ofx, float ofy, float ofz, int numChildren)
-{
-    Node* aux = malloc(sizeof(Node));
-    aux->channels = numChannels;
-    aux->channelData = calloc(sizeof(float), numChannels);
-    strcpy(aux->name, name);
-    aux->offset[0] = ofx;
-    aux->offset[1] = ofy;
-    aux->offset[2] = ofz;
-    aux->numChildren = numChildren;
-    if(numChildren > 0)
-        aux->children = calloc(sizeof(Node*), numChildren);
-    else
-        aux->children = NULL;
-    aux->parent = parent;
-    if(parent)
-        for(int i=0; i<parent->numChildren; i++)
-            if(!parent->children[i]) {
-//                printf("Insert at parent: %d\n", i);
-                parent->children[i] = aux;
-                break;
-            }
-    printf("Created %s\n", name);
-    return aux;
-}
-
+// Exibe o HUD de desempenho (tecla 'h')
+int showHud = 0;
+
+// Clip em exibicao (NULL: esqueleto de exemplo) e seu indice no loader
+Clip* clip = NULL;
+int clipIndex = -1;
+// Clip pedido ao loader, ainda sendo carregado (-1: nenhum)
+int pendingClip = -1;
+
+// Matrizes globais (FK) e vertices dos ossos do frame atual
+// (contabilizados em MEM_GPU para drawNodes nodos)
+float* world = NULL;
+float* verts = NULL;
+int numVerts = 0;
+int drawNodes = 0;
+
+// Transicao (tecla 'b'): o proximo clip entra misturado ao atual por
+// blendTime segundos, com a raiz alinhada ao ponto em que o atual estava
+float blendTime = 0.5f;
+int blendNext = 0;
+int fading = 0;
+Crossfade fade;
+// Alinhamento da raiz do clip exibido (herdado da ultima transicao)
+RootAlign viewAlign = { 0, { 0, 0, 0 } };
+
+// Reproducao continua (barra de espaco)
+int playing = 0;
+void play(int value);
+
 //
 // DADOS DE EXEMPLO DO PRIMEIRO FRAME
 //
@@ -124,8 +112,28 @@ void applyData(float data[], Node* n)
 
 void apply()
 {
-    dataPos = 0;
-    applyData(data, root);
+    TRACE_BEGIN("apply");
+    if(clip) {
+        PERF_BEGIN(STAGE_FK);
+        TRACE_BEGIN("forwardKinematics");
+        if(fading)
+            crossfadeEval(&fade, world);
+        else {
+            forwardKinematicsSimd(clip, clipFrame(clip, curFrame), world);
+            alignWorld(&viewAlign, clip->numNodes, world);
+        }
+        TRACE_END();
+        PERF_END(STAGE_FK);
+    }
+    PERF_BEGIN(STAGE_APPLY);
+    if(clip)
+        numVerts = buildBoneVertices(clip, world, verts);
+    else {
+        dataPos = 0;
+        applyData(data, root);
+    }
+    PERF_END(STAGE_APPLY);
+    TRACE_END();
 }
 
 void initMaleSkel()
@@ -181,6 +189,7 @@ void vsum (float a[3], float b[3], float c[3])
 void drawLine (float col[3], float aaa[3], float bbb[3])
 {
     glColor3fv(col);
+    PERF_DRAWCALL();
     glBegin(GL_LINES);
        glVertex3fv(aaa);
        glVertex3fv(bbb);
@@ -223,31 +232,99 @@ void drawNode(float pox, float poy, float poz, Node* node)
 
 void drawSkeleton()
 {
-    drawNode(0, 0, 0, root);
+    PERF_BEGIN(STAGE_DRAWNODE);
+    TRACE_BEGIN("drawNode");
+    if(clip) {
+        PERF_DRAWCALL();
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, verts);
+        glDrawArrays(GL_LINES, 0, numVerts);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    else
+        drawNode(0, 0, 0, root);
+    TRACE_END();
+    PERF_END(STAGE_DRAWNODE);
 }
 
 void freeTree()
 {
+    memAdd(MEM_SKELETON, -nodeMemory(root));
+    memAdd(MEM_FRAMES, -(long long) sizeof(data));
     freeNode(root);
 }
 
-void freeNode(Node* node)
+// **********************************************************************
+//  Troca o clip exibido por um ja carregado (pertence ao loader)
+// **********************************************************************
+void showClip(Clip* c, int index)
+{
+    Clip* prev = clip;
+    int prevIndex = clipIndex;
+    int length = (int) (blendTime / c->frameTime + 0.5f);
+    fading = blendNext && prev && length > 0 &&
+             crossfadeStart(&fade, prev, curFrame, &viewAlign, c, 0, length);
+    if(!fading)
+        rootAlignIdentity(&viewAlign);
+    blendNext = 0;
+    clip = c;
+    clipIndex = index;
+    totalFrames = c->numFrames;
+    curFrame = 0;
+    world = realloc(world, c->numNodes * 16 * sizeof(float));
+    verts = realloc(verts, c->numNodes * 6 * sizeof(float));
+    memAdd(MEM_GPU, (long long) (c->numNodes - drawNodes) * (16 + 6) * sizeof(float));
+    drawNodes = c->numNodes;
+
+    apply();
+    glutSetWindowTitle(loaderPath(index));
+    // Agora o clip anterior pode ser liberado (na transicao, so no fim dela)
+    loaderRequest(index, fading ? prevIndex : index);
+    glutPostRedisplay();
+}
+
+// Fim da transicao: o clip novo segue sozinho, alinhado
+void endFade()
 {
-    //printf("Freeing %s %p\n", node->name,node->children);
-    if(node == NULL) return;
-    //printf("Freeing children...\n");
-    for(int i=0; i<node->numChildren; i++) {
-        //printf(">>> child %d\n", i);
-        freeNode(node->children[i]);
+    if(!fading)
+        return;
+    fading = 0;
+    viewAlign = fade.toAlign;
+    curFrame = fade.toFrame;
+    loaderRequest(clipIndex, clipIndex);
+}
+
+// Aguarda o clip pedido sem bloquear a janela
+void pollLoader(int value)
+{
+    Clip* c;
+    if(pendingClip < 0)
+        return;
+    int state = loaderPoll(pendingClip, &c);
+    if(state == LOAD_READY) {
+        int index = pendingClip;
+        pendingClip = -1;
+        showClip(c, index);
     }
-    //printf("Freeing channel data...\n");
-    free(node->channelData);
-    if(node->numChildren>0) {
-        //printf("Freeing children array...\n");
-        free(node->children);
+    else if(state == LOAD_FAILED) {
+        printf("Erro ao carregar %s\n", loaderPath(pendingClip));
+        pendingClip = -1;
     }
-}
-
+    else
+        glutTimerFunc(20, pollLoader, 0);
+}
+
+// Pede um clip ao loader; o atual continua na tela ate o novo chegar
+void requestClip(int index)
+{
+    int wasPending = pendingClip >= 0;
+    endFade();
+    pendingClip = index;
+    loaderRequest(index, clipIndex);
+    if(!wasPending)
+        pollLoader(0);
+}
+
 // **********************************************************************
 //  Desenha um quadriculado para representar um piso
 // **********************************************************************
@@ -258,9 +335,13 @@ void drawFloor()
     float delta = (2*LARG)/(qtd-1);
     float z = -LARG;
 
+    PERF_BEGIN(STAGE_DRAWFLOOR);
+    TRACE_BEGIN("drawFloor");
     int i;
     for (i=0; i<qtd; i++)
     {
+        PERF_DRAWCALL();
+        PERF_DRAWCALL();
         glBegin(GL_LINES);
         glVertex3f(-LARG,0,z);
         glVertex3f(LARG,0,z);
@@ -272,13 +353,15 @@ void drawFloor()
 
         z += delta;
     }
-
+    TRACE_END();
+    PERF_END(STAGE_DRAWFLOOR);
 }
 // **********************************************************************
 //  Desenha os eixos coordenados
 // **********************************************************************
 void drawAxes()
 {
+    PERF_DRAWCALL();
     glBegin(GL_LINES);
     glColor3f(1,0,0); // vermelho
 
@@ -371,6 +454,8 @@ void reshape( int w, int h )
     if(h == 0)
         h = 1;
 
+    width = w;
+    height = h;
     ratio = 1.0f * w / h;
     // Reset the coordinate system before modifying
     glMatrixMode(GL_PROJECTION);
@@ -381,11 +466,106 @@ void reshape( int w, int h )
     posUser();
 }
 
+#ifndef BVH_NO_PROFILE
+// Escreve uma string na posicao (x,y) da tela
+void drawText(float x, float y, const char* str)
+{
+    glRasterPos2f(x, y);
+    while(*str)
+        glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *str++);
+}
+
+// **********************************************************************
+//  Desenha o HUD de desempenho: FPS, draw calls e, para cada etapa,
+//  media, p50 e p99 da janela, com um histograma dos tempos ao lado
+// **********************************************************************
+#define HUD_BINS 24
+void drawHud()
+{
+    char str[128];
+    int bins[HUD_BINS];
+    PerfStats st;
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, width, 0, height);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+
+    float y = height - 16;
+    glColor3f(1,1,1);
+    sprintf(str, "%.1f fps   %d draw calls", perfFps(), perfDrawCalls());
+    drawText(8, y, str);
+    y -= 18;
+    drawText(8, y, "stage        avg     p50     p99  (ms)");
+
+    for(int s=0; s<NUM_STAGES; s++) {
+        y -= 16;
+        perfGetStats(s, &st);
+        sprintf(str, "%-10s %6.3f  %6.3f  %6.3f", perfStageName(s), st.avg, st.p50, st.p99);
+        glColor3f(1,1,1);
+        drawText(8, y, str);
+
+        // Histograma de 0 ao maximo da janela
+        int highest = perfHistogram(s, bins, HUD_BINS, st.max);
+        glColor3f(0,1,0);
+        glBegin(GL_QUADS);
+        for(int b=0; b<HUD_BINS && highest>0; b++) {
+            float x0 = 300 + b*5;
+            float h = 12.0f * bins[b] / highest;
+            glVertex2f(x0, y-2);
+            glVertex2f(x0+4, y-2);
+            glVertex2f(x0+4, y-2+h);
+            glVertex2f(x0, y-2+h);
+        }
+        glEnd();
+    }
+
+    // Alocacoes no heap feitas por etapa no ultimo frame (deve ser zero)
+    if(allocAvailable()) {
+        y -= 18;
+        int n = sprintf(str, "alloc/frame:");
+        for(int s=0; s<=ALLOC_OUTSIDE; s++)
+            if(s != STAGE_FRAME && s != STAGE_PARSE)
+                n += sprintf(str+n, " %s %d", s == ALLOC_OUTSIDE ? "outros" : perfStageName(s),
+                             allocLastFrame(s));
+        glColor3f(1,1,0);
+        drawText(8, y, str);
+    }
+
+    // Cache de clips
+    CacheStats cs;
+    cacheGetStats(&cs);
+    y -= 18;
+    sprintf(str, "cache: %d clips %.1f/%.0f MB  hits %lld  misses %lld  evictions %lld",
+            cs.clips, cs.bytes / 1048576.0, cs.budget / 1048576.0, cs.hits, cs.misses, cs.evictions);
+    glColor3f(0,1,1);
+    drawText(8, y, str);
+
+    glEnable(GL_DEPTH_TEST);
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// Mantem a tela sendo redesenhada enquanto o HUD estiver visivel
+void idle()
+{
+    glutPostRedisplay();
+}
+#endif
+
 // **********************************************************************
 //  Callback para desenho da tela
 // **********************************************************************
 void display()
 {
+    TRACE_BEGIN("display");
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
     posUser();
@@ -404,7 +584,18 @@ void display()
     drawSkeleton();
     glPopMatrix();
 
+#ifndef BVH_NO_PROFILE
+    if(showHud)
+        drawHud();
+#endif
+
+    PERF_BEGIN(STAGE_SWAP);
+    TRACE_BEGIN("swap");
     glutSwapBuffers();
+    TRACE_END();
+    PERF_END(STAGE_SWAP);
+    PERF_FRAME_END();
+    TRACE_END();
 }
 
 // **********************************************************************
@@ -415,15 +606,78 @@ void keyboard ( unsigned char key, int x, int y )
     switch ( key )
     {
     case 27:        // Termina o programa qdo
+        loaderClose();
+        crossfadeFree(&fade);
+        free(world);
+        free(verts);
         freeTree();
         exit ( 0 );   // a tecla ESC for pressionada
         break;
 
+#ifndef BVH_NO_PROFILE
+    case 'h':       // Liga/desliga o HUD de desempenho
+        showHud = !showHud;
+        glutIdleFunc(showHud ? idle : NULL);
+        glutPostRedisplay();
+        break;
+#endif
+
+#ifndef BVH_NO_TRACE
+    case 't':       // Grava o trace ate o momento
+        printf("Trace: %d eventos em %s\n", traceDump(TRACE_FILE), TRACE_FILE);
+        break;
+#endif
+
+    case 'm':       // Mostra o uso de memoria por subsistema
+        memReport(stdout);
+        break;
+
+    case 'b':       // Proximo clip com transicao suave
+    case 'n':       // Proximo clip do diretorio
+    case 'p':       // Clip anterior
+        if(loaderNumFiles() > 0) {
+            int n = loaderNumFiles();
+            int from = pendingClip >= 0 ? pendingClip : clipIndex;
+            blendNext = key == 'b';
+            requestClip((from + (key == 'p' ? n-1 : 1)) % n);
+        }
+        break;
+
+    case ' ':       // Inicia/para a reproducao
+        playing = !playing;
+        if(playing)
+            play(0);
+        break;
+
     default:
         break;
     }
 }
 
+// **********************************************************************
+//  Avanca um frame (durante a transicao, nos dois clips)
+// **********************************************************************
+void nextFrame()
+{
+    if(fading) {
+        if(!crossfadeStep(&fade))
+            endFade();
+    }
+    else if(++curFrame >= totalFrames)
+        curFrame = 0;
+    apply();
+    glutPostRedisplay();
+}
+
+// Timer da reproducao continua, no ritmo do clip
+void play(int value)
+{
+    if(!playing)
+        return;
+    nextFrame();
+    glutTimerFunc(clip ? (unsigned) (clip->frameTime * 1000) : 33, play, 0);
+}
+
 // **********************************************************************
 //  Callback para eventos de teclas especiais
 // **********************************************************************
@@ -433,12 +687,10 @@ void arrow_keys ( int a_keys, int x, int y )
     switch ( a_keys )
     {
     case GLUT_KEY_RIGHT:
-        if(++curFrame >= totalFrames)
-            curFrame = 0;
-        apply();
-        glutPostRedisplay();
+        nextFrame();
         break;
     case GLUT_KEY_LEFT:
+        endFade();
         if(--curFrame < 0)
             curFrame = totalFrames-1;
         apply();
@@ -473,6 +725,7 @@ void init()
 // **********************************************************************
 int main (int argc, char** argv)
 {
+    traceInit("main");
     glutInit            ( &argc, argv );
     glutInitDisplayMode (GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGB );
     glutInitWindowPosition (0,0);
@@ -490,6 +743,51 @@ int main (int argc, char** argv)
     // Exemplo: monta manualmente um esqueleto
     // (no trabalho, deve-se ler do arquivo)
     initMaleSkel();
+    memAdd(MEM_SKELETON, nodeMemory(root));
+    memAdd(MEM_FRAMES, sizeof(data));
+
+    // Clips do diretorio (bvh/ ou o informado), carregados em segundo
+    // plano; o esqueleto de exemplo fica na tela ate o primeiro chegar
+    // Uso: bvhviewer [-c MB] [-b seg] [-s f32|f16|q16] [diretorio | arquivo.bvh | arquivo.bvhc]
+    // Caches binarios (.bvhc) nao sao lidos inteiros: os frames vem de
+    // uma janela mapeada do arquivo que acompanha a reproducao
+    // -c: limite de memoria do cache de clips
+    // -b: duracao da transicao entre clips (tecla 'b')
+    // -s: formato dos frames na memoria (float, float16 ou 16 bits
+    //     quantizados pela faixa de cada canal)
+    char dir[512] = "bvh";
+    const char* start = NULL;
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-c") && i+1 < argc) {
+            cacheSetBudget(atoll(argv[++i]) << 20);
+            continue;
+        }
+        if(!strcmp(argv[i], "-b") && i+1 < argc) {
+            blendTime = atof(argv[++i]);
+            continue;
+        }
+        if(!strcmp(argv[i], "-s") && i+1 < argc) {
+            const char* s = argv[++i];
+            cacheSetStorage(!strcmp(s, "f16") ? FRAMES_F16 : !strcmp(s, "q16") ? FRAMES_Q16 : FRAMES_F32);
+            continue;
+        }
+        snprintf(dir, sizeof(dir), "%s", argv[i]);
+        size_t len = strlen(dir);
+        if((len > 4 && !strcmp(dir + len - 4, ".bvh")) || (len > 5 && !strcmp(dir + len - 5, ".bvhc"))) {
+            char* slash = strrchr(dir, '/');
+            start = argv[i] + (slash ? slash - dir + 1 : 0);
+            if(slash)
+                *slash = 0;
+            else
+                strcpy(dir, ".");
+        }
+    }
+    if(loaderOpen(dir) > 0) {
+        int first = start ? loaderFind(start) : 0;
+        requestClip(first >= 0 ? first : 0);
+    }
+    else
+        printf("Nenhum arquivo .bvh em %s\n", dir);
 
     // Define que o tratador de evento para
     // o redesenho da tela. A funcao "display"
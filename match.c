@@ -0,0 +1,424 @@
+// **********************************************************************
+//	match.c
+//  Caracteristicas (no referencial da raiz: x para a direita, z para a
+//  frente do quadril, y para cima):
+//   0..11   posicoes de LeftFoot, RightFoot, LeftHand e RightHand
+//   12..17  velocidades dos pes
+//   18..20  velocidade da raiz
+//   21..26  posicao (xz) da raiz daqui a 1/3, 2/3 e 1 s
+//   27..32  direcao (xz) do quadril nesses instantes
+//  Cada dimensao e normalizada pela media e desvio padrao da biblioteca
+//
+//  A kd-tree divide pela mediana do eixo de maior amplitude ate folhas
+//  de MATCH_LEAF frames; as linhas ficam na ordem das folhas, contiguas,
+//  e cada nodo guarda a caixa justa das suas linhas. A busca e exata:
+//  visita primeiro o filho de caixa mais proxima e descarta os nodos
+//  cuja caixa esta mais longe que o melhor frame ja encontrado
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "match.h"
+
+static const char* jointNames[4] = { "LeftFoot", "RightFoot", "LeftHand", "RightHand" };
+static const float futureTimes[3] = { 1/3.0f, 2/3.0f, 1.0f };
+
+// **********************************************************************
+//  Caracteristicas
+// **********************************************************************
+
+// Vetor d (xz ou xyz) no referencial de direcao fwd (xz, unitaria)
+static void toLocal(const float* fwd, const float* d, float* out)
+{
+    out[0] = d[0]*fwd[1] - d[2]*fwd[0];
+    out[1] = d[1];
+    out[2] = d[0]*fwd[0] + d[2]*fwd[1];
+}
+
+// Preenche out (numFrames x MATCH_DIMS) com as caracteristicas brutas
+// de cada frame. Retorna 0 se o esqueleto nao tem as juntas usadas
+int matchClipFeatures(Clip* clip, float* out)
+{
+    int joint[4];
+    int n = clip->numFrames;
+    for(int j=0; j<4; j++) {
+        joint[j] = -1;
+        for(int i=0; i<clip->numNodes; i++)
+            if(!strcmp(clip->nodes[i]->name, jointNames[j]))
+                joint[j] = i;
+        if(joint[j] < 0)
+            return 0;
+    }
+    float inv = clip->frameTime > 0 ? 1 / clip->frameTime : 30;
+    int ahead[3];
+    for(int k=0; k<3; k++)
+        ahead[k] = (int) (futureTimes[k] * inv + 0.5f);
+
+    // Raiz e juntas (5 x xyz) e direcao do quadril (xz) em cada frame
+    float* world = malloc(clip->numNodes * 16 * sizeof(float));
+    float* pos = malloc((size_t) n * 15 * sizeof(float));
+    float* dir = malloc((size_t) n * 2 * sizeof(float));
+    for(int f=0; f<n; f++) {
+        forwardKinematicsSimd(clip, clipFrame(clip, f), world);
+        float* p = pos + (size_t) f * 15;
+        memcpy(p, world + 12, 3 * sizeof(float));
+        for(int j=0; j<4; j++)
+            memcpy(p + 3 + j*3, world + joint[j]*16 + 12, 3 * sizeof(float));
+        // Eixo z local da raiz, projetado no chao
+        float dx = world[8], dz = world[10];
+        float len = sqrtf(dx*dx + dz*dz);
+        dir[f*2] = len > 1e-6f ? dx / len : 0;
+        dir[f*2+1] = len > 1e-6f ? dz / len : 1;
+    }
+
+    for(int f=0; f<n; f++) {
+        float* o = out + (size_t) f * MATCH_DIMS;
+        const float* p = pos + (size_t) f * 15;
+        const float* fwd = dir + f*2;
+        float d[3];
+        // Velocidades: diferenca para o frame anterior (no primeiro, o seguinte)
+        int a = f > 0 ? f-1 : f;
+        int b = f > 0 ? f : (n > 1 ? 1 : 0);
+        const float* pa = pos + (size_t) a * 15;
+        const float* pb = pos + (size_t) b * 15;
+
+        for(int j=0; j<4; j++) {
+            for(int c=0; c<3; c++)
+                d[c] = p[3 + j*3 + c] - p[c];
+            toLocal(fwd, d, o + j*3);
+        }
+        for(int j=0; j<2; j++) {
+            for(int c=0; c<3; c++)
+                d[c] = (pb[3 + j*3 + c] - pa[3 + j*3 + c]) * inv;
+            toLocal(fwd, d, o + 12 + j*3);
+        }
+        for(int c=0; c<3; c++)
+            d[c] = (pb[c] - pa[c]) * inv;
+        toLocal(fwd, d, o + 18);
+
+        // Trajetoria futura (o fim do clip se repete)
+        for(int k=0; k<3; k++) {
+            int g = f + ahead[k] < n ? f + ahead[k] : n-1;
+            float l[3];
+            const float* pg = pos + (size_t) g * 15;
+            d[0] = pg[0] - p[0];
+            d[1] = 0;
+            d[2] = pg[2] - p[2];
+            toLocal(fwd, d, l);
+            o[21 + k*2] = l[0];
+            o[21 + k*2 + 1] = l[2];
+            d[0] = dir[g*2];
+            d[2] = dir[g*2+1];
+            toLocal(fwd, d, l);
+            o[27 + k*2] = l[0];
+            o[27 + k*2 + 1] = l[2];
+        }
+        for(int i=MATCH_USED; i<MATCH_DIMS; i++)
+            o[i] = 0;
+    }
+    free(dir);
+    free(pos);
+    free(world);
+    return 1;
+}
+
+// **********************************************************************
+//  Construcao da kd-tree
+// **********************************************************************
+
+typedef struct {
+    MatchDb* db;
+    const float* raw;    // linhas normalizadas, na ordem original
+    int* order;          // linha original de cada posicao
+    int capNodes;
+} Builder;
+
+static float key(Builder* b, int pos, int dim)
+{
+    return b->raw[(size_t) b->order[pos] * MATCH_DIMS + dim];
+}
+
+// Reordena order[lo, hi) para que a posicao nth tenha a mediana do eixo
+// dim: as anteriores ficam <= e as seguintes >=
+static void selectNth(Builder* b, int lo, int hi, int nth, int dim)
+{
+    hi--;
+    while(lo < hi) {
+        float pivot = key(b, (lo + hi) / 2, dim);
+        int i = lo, j = hi;
+        while(i <= j) {
+            while(key(b, i, dim) < pivot) i++;
+            while(key(b, j, dim) > pivot) j--;
+            if(i <= j) {
+                int t = b->order[i];
+                b->order[i++] = b->order[j];
+                b->order[j--] = t;
+            }
+        }
+        if(nth <= j)
+            hi = j;
+        else if(nth >= i)
+            lo = i;
+        else
+            break;
+    }
+}
+
+static int buildNode(Builder* b, int lo, int hi)
+{
+    MatchDb* db = b->db;
+    if(db->numNodes == b->capNodes) {
+        b->capNodes = b->capNodes ? b->capNodes*2 : 256;
+        db->nodes = realloc(db->nodes, b->capNodes * sizeof(MatchNode));
+    }
+    int id = db->numNodes++;
+    MatchNode* n = &db->nodes[id];
+    n->leaf = 1;
+    n->left = lo;
+    n->right = hi;
+
+    // Caixa das linhas e eixo de maior amplitude
+    float spread = 0;
+    int dim = -1;
+    for(int d=0; d<MATCH_DIMS; d++) {
+        float mn = FLT_MAX, mx = -FLT_MAX;
+        for(int i=lo; i<hi; i++) {
+            float v = key(b, i, d);
+            if(v < mn) mn = v;
+            if(v > mx) mx = v;
+        }
+        n->lo[d] = mn;
+        n->hi[d] = mx;
+        if(mx - mn > spread) {
+            spread = mx - mn;
+            dim = d;
+        }
+    }
+    // Se todas as linhas forem iguais, fica uma folha
+    if(hi - lo <= MATCH_LEAF || dim < 0)
+        return id;
+
+    int mid = (lo + hi) / 2;
+    selectNth(b, lo, hi, mid, dim);
+    int left = buildNode(b, lo, mid);
+    int right = buildNode(b, mid, hi);
+    // nodes pode ter sido realocado
+    n = &db->nodes[id];
+    n->leaf = 0;
+    n->left = left;
+    n->right = right;
+    return id;
+}
+
+// **********************************************************************
+//  Extrai, normaliza e indexa todos os frames dos clips. Clips sem as
+//  juntas usadas ficam de fora
+// **********************************************************************
+MatchDb* matchBuild(Clip** clips, int numClips)
+{
+    MatchDb* db = calloc(1, sizeof(MatchDb));
+    size_t total = 0;
+    for(int c=0; c<numClips; c++)
+        total += clips[c]->numFrames;
+
+    float* raw = malloc(total * MATCH_DIMS * sizeof(float));
+    int* clipOf = malloc(total * sizeof(int));
+    int* frameOf = malloc(total * sizeof(int));
+    int rows = 0;
+    for(int c=0; c<numClips; c++) {
+        if(!matchClipFeatures(clips[c], raw + (size_t) rows * MATCH_DIMS))
+            continue;
+        for(int f=0; f<clips[c]->numFrames; f++) {
+            clipOf[rows] = c;
+            frameOf[rows++] = f;
+        }
+    }
+    db->numRows = rows;
+
+    // Media e desvio padrao de cada dimensao (constantes ficam zeradas)
+    for(int d=0; d<MATCH_USED; d++) {
+        double sum = 0, sq = 0;
+        for(int r=0; r<rows; r++) {
+            double v = raw[(size_t) r * MATCH_DIMS + d];
+            sum += v;
+            sq += v*v;
+        }
+        double mean = rows ? sum / rows : 0;
+        double var = rows ? sq / rows - mean*mean : 0;
+        db->mean[d] = (float) mean;
+        db->scale[d] = var > 1e-12 ? (float) (1 / sqrt(var)) : 0;
+    }
+    for(int r=0; r<rows; r++)
+        matchNormalize(db, raw + (size_t) r * MATCH_DIMS, raw + (size_t) r * MATCH_DIMS);
+
+    Builder b = { db, raw, malloc((rows ? rows : 1) * sizeof(int)), 0 };
+    for(int r=0; r<rows; r++)
+        b.order[r] = r;
+    if(rows > 0)
+        buildNode(&b, 0, rows);
+
+    // Linhas na ordem das folhas
+    db->features = malloc((size_t) (rows ? rows : 1) * MATCH_DIMS * sizeof(float));
+    db->clip = malloc((rows ? rows : 1) * sizeof(int));
+    db->frame = malloc((rows ? rows : 1) * sizeof(int));
+    for(int i=0; i<rows; i++) {
+        int r = b.order[i];
+        memcpy(db->features + (size_t) i * MATCH_DIMS, raw + (size_t) r * MATCH_DIMS, MATCH_DIMS * sizeof(float));
+        db->clip[i] = clipOf[r];
+        db->frame[i] = frameOf[r];
+    }
+    free(b.order);
+    free(frameOf);
+    free(clipOf);
+    free(raw);
+    memAdd(MEM_POSES, (long long) rows * (MATCH_DIMS * sizeof(float) + 2 * sizeof(int))
+                      + (long long) db->numNodes * sizeof(MatchNode));
+    return db;
+}
+
+void matchFree(MatchDb* db)
+{
+    if(!db)
+        return;
+    memAdd(MEM_POSES, -((long long) db->numRows * (MATCH_DIMS * sizeof(float) + 2 * sizeof(int))
+                        + (long long) db->numNodes * sizeof(MatchNode)));
+    free(db->features);
+    free(db->clip);
+    free(db->frame);
+    free(db->nodes);
+    free(db);
+}
+
+// Caracteristicas brutas -> consulta (raw e query podem coincidir)
+void matchNormalize(MatchDb* db, const float* raw, float* query)
+{
+    for(int d=0; d<MATCH_DIMS; d++)
+        query[d] = (raw[d] - db->mean[d]) * db->scale[d];
+}
+
+// **********************************************************************
+//  Busca
+// **********************************************************************
+
+// Distancia ao quadrado entre dois vetores de MATCH_DIMS floats
+static float distance(const float* a, const float* b)
+{
+#ifdef __SSE__
+    __m128 acc = _mm_setzero_ps();
+    for(int i=0; i<MATCH_DIMS; i+=4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i));
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float sum = 0;
+    for(int i=0; i<MATCH_DIMS; i++)
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    return sum;
+#endif
+}
+
+// Distancia ao quadrado de q a caixa [lo, hi] (0 se estiver dentro)
+static float boxDistance(const float* q, const float* lo, const float* hi)
+{
+#ifdef __SSE__
+    __m128 acc = _mm_setzero_ps();
+    __m128 zero = _mm_setzero_ps();
+    for(int i=0; i<MATCH_DIMS; i+=4) {
+        __m128 v = _mm_loadu_ps(q+i);
+        __m128 d = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(lo+i), v), zero),
+                              _mm_max_ps(_mm_sub_ps(v, _mm_loadu_ps(hi+i)), zero));
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float sum = 0;
+    for(int i=0; i<MATCH_DIMS; i++) {
+        float d = q[i] < lo[i] ? lo[i] - q[i] : q[i] > hi[i] ? q[i] - hi[i] : 0;
+        sum += d*d;
+    }
+    return sum;
+#endif
+}
+
+typedef struct {
+    MatchDb* db;
+    const float* q;
+    float best;
+    int row;
+} Search;
+
+static void searchNode(Search* s, int id)
+{
+    MatchNode* n = &s->db->nodes[id];
+    if(n->leaf) {
+        const float* row = s->db->features + (size_t) n->left * MATCH_DIMS;
+        for(int r=n->left; r<n->right; r++, row += MATCH_DIMS) {
+            float d = distance(s->q, row);
+            if(d < s->best) {
+                s->best = d;
+                s->row = r;
+            }
+        }
+        return;
+    }
+    // Primeiro o filho mais proximo; o outro so se ainda puder ganhar
+    MatchNode* nodes = s->db->nodes;
+    int a = n->left, b = n->right;
+    float da = boxDistance(s->q, nodes[a].lo, nodes[a].hi);
+    float db = boxDistance(s->q, nodes[b].lo, nodes[b].hi);
+    if(db < da) {
+        int t = a; a = b; b = t;
+        float u = da; da = db; db = u;
+    }
+    if(da < s->best)
+        searchNode(s, a);
+    if(db < s->best)
+        searchNode(s, b);
+}
+
+// Linha mais proxima da consulta (normalizada), ou -1 se o indice esta
+// vazio; dist recebe a distancia ao quadrado
+int matchNearest(MatchDb* db, const float* query, float* dist)
+{
+    Search s;
+    s.db = db;
+    s.q = query;
+    s.best = FLT_MAX;
+    s.row = -1;
+    if(db->numRows > 0)
+        searchNode(&s, 0);
+    if(dist)
+        *dist = s.best;
+    return s.row;
+}
+
+// O mesmo, percorrendo todas as linhas (referencia para a kd-tree)
+int matchNearestBrute(MatchDb* db, const float* query, float* dist)
+{
+    float best = FLT_MAX;
+    int row = -1;
+    const float* f = db->features;
+    for(int r=0; r<db->numRows; r++, f += MATCH_DIMS) {
+        float d = distance(query, f);
+        if(d < best) {
+            best = d;
+            row = r;
+        }
+    }
+    if(dist)
+        *dist = best;
+    return row;
+}
@@ -0,0 +1,46 @@
+// **********************************************************************
+//	match.h
+//  Motion matching: um vetor de caracteristicas por frame (pes e maos
+//  em relacao a raiz, velocidades e trajetoria futura da raiz) e busca
+//  do frame mais proximo em toda a biblioteca por uma kd-tree
+// **********************************************************************
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include "bvh.h"
+
+// Caracteristicas por frame (33 usadas; o resto e zero, para o SSE)
+#define MATCH_USED 33
+#define MATCH_DIMS 36
+
+// Frames por folha da kd-tree (percorridos por forca bruta)
+#define MATCH_LEAF 16
+
+typedef struct {
+    float lo[MATCH_DIMS];    // caixa que contem as linhas do nodo
+    float hi[MATCH_DIMS];
+    int leaf;
+    int left, right;     // filhos; nas folhas, linhas [left, right)
+} MatchNode;
+
+typedef struct {
+    int numRows;         // frames indexados
+    float* features;     // numRows x MATCH_DIMS, normalizados, na ordem das folhas
+    int* clip;           // clip e frame de origem de cada linha
+    int* frame;
+    float mean[MATCH_DIMS];
+    float scale[MATCH_DIMS]; // 1 / desvio padrao
+    MatchNode* nodes;    // nodes[0] e a raiz
+    int numNodes;
+} MatchDb;
+
+int matchClipFeatures(Clip* clip, float* out);
+MatchDb* matchBuild(Clip** clips, int numClips);
+void matchFree(MatchDb* db);
+
+void matchNormalize(MatchDb* db, const float* raw, float* query);
+int matchNearest(MatchDb* db, const float* query, float* dist);
+int matchNearestBrute(MatchDb* db, const float* query, float* dist);
+
+#endif
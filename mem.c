@@ -0,0 +1,57 @@
+// **********************************************************************
+//	mem.c
+//  Contadores atomicos: clips podem ser carregados em outras threads
+// **********************************************************************
+
+#include <stdatomic.h>
+
+#include "mem.h"
+
+static const char* categoryNames[NUM_MEM] = {
+    "skeleton", "frames", "poses", "cache", "gpu"
+};
+
+static atomic_llong usage[NUM_MEM];
+static atomic_llong peak[NUM_MEM];
+
+// Soma (ou subtrai, se negativo) bytes a categoria
+void memAdd(int category, long long bytes)
+{
+    long long now = atomic_fetch_add(&usage[category], bytes) + bytes;
+    long long old = atomic_load(&peak[category]);
+    while(now > old && !atomic_compare_exchange_weak(&peak[category], &old, now))
+        ;
+}
+
+long long memUsage(int category)
+{
+    return atomic_load(&usage[category]);
+}
+
+long long memPeak(int category)
+{
+    return atomic_load(&peak[category]);
+}
+
+long long memTotal()
+{
+    long long total = 0;
+    for(int c=0; c<NUM_MEM; c++)
+        total += memUsage(c);
+    return total;
+}
+
+const char* memCategoryName(int category)
+{
+    return categoryNames[category];
+}
+
+// Tabela com uso atual e pico de cada categoria, em KB
+void memReport(FILE* fp)
+{
+    fprintf(fp, "%-10s %12s %12s\n", "memoria", "atual (KB)", "pico (KB)");
+    for(int c=0; c<NUM_MEM; c++)
+        fprintf(fp, "%-10s %12.1f %12.1f\n", categoryNames[c],
+                memUsage(c) / 1024.0, memPeak(c) / 1024.0);
+    fprintf(fp, "%-10s %12.1f\n", "total", memTotal() / 1024.0);
+}
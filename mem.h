@@ -0,0 +1,28 @@
+// **********************************************************************
+//	mem.h
+//  Contabilidade do uso de memoria por subsistema
+//  Cada subsistema informa o que aloca e libera com memAdd()
+// **********************************************************************
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdio.h>
+
+typedef enum {
+    MEM_SKELETON,      // nodos, canais e vetores da hierarquia
+    MEM_FRAMES,        // matrizes de frames (canais brutos)
+    MEM_POSES,         // trilhas de pose pre-calculadas
+    MEM_CACHE,         // caches de clips
+    MEM_GPU,           // vertices enviados ao OpenGL e matrizes de onde saem
+    NUM_MEM
+} MemCategory;
+
+void memAdd(int category, long long bytes);
+long long memUsage(int category);
+long long memPeak(int category);
+long long memTotal();
+const char* memCategoryName(int category);
+void memReport(FILE* fp);
+
+#endif
@@ -0,0 +1,142 @@
+// **********************************************************************
+//	perf.c
+//  Temporizadores monotonicos e janelas de amostras por etapa
+// **********************************************************************
+
+#ifndef BVH_NO_PROFILE
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "perf.h"
+#include "alloc.h"
+#include "timer.h"
+
+static const char* stageNames[NUM_STAGES] = {
+    "parse", "fk", "apply", "drawNode", "drawFloor", "swap", "frame"
+};
+
+// Inicio da medicao atual (por thread: a leitura dos clips roda no
+// loader) e tempo acumulado no frame corrente, em ns
+static _Thread_local double stageStart[NUM_STAGES];
+static atomic_llong stageAccum[NUM_STAGES];
+
+// Janela circular com os ultimos PERF_WINDOW frames
+static float samples[NUM_STAGES][PERF_WINDOW];
+static int numSamples = 0;
+static int nextSample = 0;
+
+static double lastFrame = 0;
+static int drawCalls = 0;
+static int lastDrawCalls = 0;
+
+double perfNow()
+{
+    return timerNow();
+}
+
+void perfBegin(int stage)
+{
+    stageStart[stage] = perfNow();
+    ALLOC_ENTER(stage);
+}
+
+void perfEnd(int stage)
+{
+    ALLOC_LEAVE();
+    atomic_fetch_add(&stageAccum[stage], (long long) ((perfNow() - stageStart[stage]) * 1e6));
+}
+
+void perfDrawCall()
+{
+    drawCalls++;
+}
+
+// **********************************************************************
+//  Fecha o frame atual: guarda os tempos acumulados na janela e zera
+//  os acumuladores. Deve ser chamada uma vez por display()
+// **********************************************************************
+void perfFrameEnd()
+{
+    double now = perfNow();
+    atomic_store(&stageAccum[STAGE_FRAME], lastFrame > 0 ? (long long) ((now - lastFrame) * 1e6) : 0);
+    lastFrame = now;
+
+    for(int s=0; s<NUM_STAGES; s++)
+        samples[s][nextSample] = (float) (atomic_exchange(&stageAccum[s], 0) * 1e-6);
+    nextSample = (nextSample + 1) % PERF_WINDOW;
+    if(numSamples < PERF_WINDOW)
+        numSamples++;
+
+    lastDrawCalls = drawCalls;
+    drawCalls = 0;
+    ALLOC_FRAME_END();
+}
+
+const char* perfStageName(int stage)
+{
+    return stageNames[stage];
+}
+
+static int cmpFloat(const void* a, const void* b)
+{
+    float fa = *(const float*) a;
+    float fb = *(const float*) b;
+    return (fa > fb) - (fa < fb);
+}
+
+// Media, mediana, p99 e maximo da etapa sobre a janela
+void perfGetStats(int stage, PerfStats* st)
+{
+    float sorted[PERF_WINDOW];
+    float sum = 0;
+
+    memset(st, 0, sizeof(PerfStats));
+    if(numSamples == 0)
+        return;
+    memcpy(sorted, samples[stage], numSamples * sizeof(float));
+    qsort(sorted, numSamples, sizeof(float), cmpFloat);
+    for(int i=0; i<numSamples; i++)
+        sum += sorted[i];
+    st->avg = sum / numSamples;
+    st->p50 = sorted[numSamples / 2];
+    st->p99 = sorted[(numSamples * 99) / 100];
+    st->max = sorted[numSamples - 1];
+}
+
+// **********************************************************************
+//  Distribui as amostras da etapa em numBins intervalos de [0, maxMs]
+//  (amostras acima de maxMs caem no ultimo). Retorna o maior bin
+// **********************************************************************
+int perfHistogram(int stage, int bins[], int numBins, float maxMs)
+{
+    int highest = 0;
+    memset(bins, 0, numBins * sizeof(int));
+    if(maxMs <= 0)
+        maxMs = 1;
+    for(int i=0; i<numSamples; i++) {
+        int b = (int) (samples[stage][i] / maxMs * numBins);
+        if(b >= numBins)
+            b = numBins - 1;
+        if(++bins[b] > highest)
+            highest = bins[b];
+    }
+    return highest;
+}
+
+float perfFps()
+{
+    PerfStats st;
+    perfGetStats(STAGE_FRAME, &st);
+    return st.avg > 0 ? 1000.0f / st.avg : 0;
+}
+
+int perfDrawCalls()
+{
+    return lastDrawCalls;
+}
+
+#endif
@@ -0,0 +1,61 @@
+// **********************************************************************
+//	perf.h
+//  Instrumentacao de desempenho por etapa do frame (HUD)
+//  Compilar com -DBVH_NO_PROFILE remove toda a instrumentacao
+// **********************************************************************
+
+#ifndef PERF_H
+#define PERF_H
+
+// Etapas medidas a cada frame
+typedef enum {
+    STAGE_PARSE,       // loadBvh(): leitura dos arquivos texto (thread do loader)
+    STAGE_FK,          // forwardKinematics*/crossfadeEval(): matrizes globais
+    STAGE_APPLY,       // apply(): vertices dos ossos (fora a FK)
+    STAGE_DRAWNODE,    // drawNode(): percurso da hierarquia (FK no OpenGL)
+    STAGE_DRAWFLOOR,   // drawFloor(): piso
+    STAGE_SWAP,        // glutSwapBuffers()
+    STAGE_FRAME,       // intervalo total entre dois frames
+    NUM_STAGES
+} PerfStage;
+
+// Tamanho da janela de amostras (frames) usada nas estatisticas
+#define PERF_WINDOW 128
+
+// Estatisticas de uma etapa sobre a janela atual (em ms)
+typedef struct {
+    float avg;
+    float p50;
+    float p99;
+    float max;
+} PerfStats;
+
+#ifndef BVH_NO_PROFILE
+
+double perfNow();
+void perfBegin(int stage);
+void perfEnd(int stage);
+void perfDrawCall();
+void perfFrameEnd();
+
+const char* perfStageName(int stage);
+void perfGetStats(int stage, PerfStats* st);
+int perfHistogram(int stage, int bins[], int numBins, float maxMs);
+float perfFps();
+int perfDrawCalls();
+
+#define PERF_BEGIN(s)     perfBegin(s)
+#define PERF_END(s)       perfEnd(s)
+#define PERF_DRAWCALL()   perfDrawCall()
+#define PERF_FRAME_END()  perfFrameEnd()
+
+#else
+
+#define PERF_BEGIN(s)
+#define PERF_END(s)
+#define PERF_DRAWCALL()
+#define PERF_FRAME_END()
+
+#endif
+
+#endif
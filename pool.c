@@ -0,0 +1,124 @@
+// **********************************************************************
+//	pool.c
+//  Cada thread recebe uma faixa contigua das tarefas (uma fila dupla),
+//  que consome pela frente. Quando a sua acaba, rouba pelo fundo da
+//  fila de outra thread: tarefas longas e curtas se equilibram sem um
+//  ponto unico de disputa, e tarefas vizinhas tendem a ficar na mesma
+//  thread
+// **********************************************************************
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    int lo;              // proxima tarefa do dono
+    int hi;              // fim da faixa (exclusivo), onde se rouba
+} PoolQueue;
+
+typedef struct {
+    PoolQueue* queues;
+    int numThreads;
+    PoolTask task;
+    void* arg;
+} PoolJob;
+
+typedef struct {
+    PoolJob* job;
+    int id;
+} PoolWorker;
+
+// Proxima tarefa da propria fila, ou -1
+static int popFront(PoolQueue* q)
+{
+    int i = -1;
+    pthread_mutex_lock(&q->lock);
+    if(q->lo < q->hi)
+        i = q->lo++;
+    pthread_mutex_unlock(&q->lock);
+    return i;
+}
+
+// Ultima tarefa da fila de outra thread, ou -1
+static int stealBack(PoolQueue* q)
+{
+    int i = -1;
+    pthread_mutex_lock(&q->lock);
+    if(q->lo < q->hi)
+        i = --q->hi;
+    pthread_mutex_unlock(&q->lock);
+    return i;
+}
+
+static void* poolThread(void* p)
+{
+    PoolWorker* w = p;
+    PoolJob* job = w->job;
+    int n = job->numThreads;
+    for(;;) {
+        int i = popFront(&job->queues[w->id]);
+        // Vitimas em ordem a partir da thread seguinte
+        for(int v=1; i<0 && v<n; v++)
+            i = stealBack(&job->queues[(w->id + v) % n]);
+        if(i < 0)
+            break;
+        job->task(i, job->arg);
+    }
+    return NULL;
+}
+
+// Quantidade de processadores disponiveis
+int poolDefaultThreads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+// **********************************************************************
+//  Executa task(i, arg) para i em [0, numTasks) com numThreads threads
+//  (a thread que chama e a de numero 0) e retorna quando todas
+//  terminarem. As tarefas nao podem criar outras
+// **********************************************************************
+void poolRun(int numThreads, int numTasks, PoolTask task, void* arg)
+{
+    if(numTasks <= 0)
+        return;
+    if(numThreads > numTasks)
+        numThreads = numTasks;
+    if(numThreads < 1)
+        numThreads = 1;
+
+    PoolJob job = { NULL, numThreads, task, arg };
+    job.queues = malloc(numThreads * sizeof(PoolQueue));
+    PoolWorker* workers = malloc(numThreads * sizeof(PoolWorker));
+    pthread_t* threads = malloc(numThreads * sizeof(pthread_t));
+    for(int t=0; t<numThreads; t++) {
+        pthread_mutex_init(&job.queues[t].lock, NULL);
+        job.queues[t].lo = (int) ((long long) numTasks * t / numThreads);
+        job.queues[t].hi = (int) ((long long) numTasks * (t+1) / numThreads);
+        workers[t].job = &job;
+        workers[t].id = t;
+    }
+
+    // Se uma thread nao puder ser criada, sua fila e roubada pelas outras
+    int* started = calloc(numThreads, sizeof(int));
+    for(int t=1; t<numThreads; t++)
+        started[t] = pthread_create(&threads[t], NULL, poolThread, &workers[t]) == 0;
+    poolThread(&workers[0]);
+    for(int t=1; t<numThreads; t++)
+        if(started[t])
+            pthread_join(threads[t], NULL);
+
+    for(int t=0; t<numThreads; t++)
+        pthread_mutex_destroy(&job.queues[t].lock);
+    free(started);
+    free(threads);
+    free(workers);
+    free(job.queues);
+}
@@ -0,0 +1,15 @@
+// **********************************************************************
+//	pool.h
+//  Pool de threads para lacos paralelos sobre as tarefas 0..numTasks-1,
+//  com roubo de tarefas entre as threads
+// **********************************************************************
+
+#ifndef POOL_H
+#define POOL_H
+
+typedef void (*PoolTask)(int index, void* arg);
+
+int poolDefaultThreads();
+void poolRun(int numThreads, int numTasks, PoolTask task, void* arg);
+
+#endif
@@ -0,0 +1,571 @@
+// **********************************************************************
+//	query.c
+//  A expressao e compilada (descida recursiva) direto para uma lista de
+//  operacoes sobre registradores de QUERY_BLOCK floats: cada operacao
+//  e um laco simples sobre o bloco, que o compilador vetoriza. Valores
+//  logicos sao 0 ou 1; o resultado fica no registrador 0
+//
+//  Gramatica:
+//   expr  := and ('||' and)*            (ou 'or')
+//   and   := not ('&&' not)*            (ou 'and')
+//   not   := '!' not | cmp              (ou 'not')
+//   cmp   := soma [('<'|'<='|'>'|'>='|'=='|'!=') soma]
+//   soma  := prod (('+'|'-') prod)*
+//   prod  := unario (('*'|'/') unario)*
+//   unario:= '-' unario | atomo
+//   atomo := numero | '(' expr ')' | junta '.' campo
+//          | dist '(' junta ',' junta ')' | abs '(' expr ')'
+//   campo := x | y | z | vx | vy | vz | speed | hspeed
+//  "root" e a raiz do clip. Velocidades em unidades do arquivo por
+//  segundo (diferenca para o frame anterior); hspeed ignora o eixo y
+// **********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+
+#include "query.h"
+
+enum {
+    OP_CONST, OP_POS, OP_VEL, OP_SPEED, OP_HSPEED, OP_DIST,
+    OP_NEG, OP_ABS, OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_AND, OP_OR, OP_NOT
+};
+
+typedef struct {
+    unsigned char code;
+    unsigned char dst, a, b;     // registradores
+    unsigned char joint, joint2; // indices em Query.joints
+    unsigned char axis;
+    float k;
+} QueryOp;
+
+struct Query {
+    QueryOp ops[QUERY_MAX_OPS];
+    int numOps;
+    char joints[QUERY_MAX_JOINTS][20];
+    int numJoints;
+};
+
+// **********************************************************************
+//  Trilhas: FK de todos os frames, transpostas para colunas
+// **********************************************************************
+
+static long long tracksBytes(Tracks* t)
+{
+    return (long long) t->numNodes * 3 * t->numFrames * sizeof(float)
+         + (long long) t->numNodes * sizeof(t->names[0]);
+}
+
+// Preenche t a partir de clip (t->path fica a cargo de quem chama)
+// Retorna 0 se faltar memoria
+int bakeTracks(Clip* clip, Tracks* t)
+{
+    int n = clip->numNodes, frames = clip->numFrames;
+    float* world = malloc(n * 16 * sizeof(float));
+
+    t->numNodes = n;
+    t->numFrames = frames;
+    t->frameTime = clip->frameTime;
+    t->names = malloc(n * sizeof(t->names[0]));
+    t->pos = malloc((size_t) n * 3 * frames * sizeof(float));
+    if(!world || !t->names || !t->pos) {
+        free(world);
+        free(t->names);
+        free(t->pos);
+        t->names = NULL;
+        t->pos = NULL;
+        return 0;
+    }
+    for(int i=0; i<n; i++)
+        memcpy(t->names[i], clip->nodes[i]->name, sizeof(t->names[0]));
+    for(int f=0; f<frames; f++) {
+        forwardKinematicsSimd(clip, clipFrame(clip, f), world);
+        for(int i=0; i<n; i++)
+            for(int a=0; a<3; a++)
+                t->pos[((size_t) i*3 + a) * frames + f] = world[i*16 + 12 + a];
+    }
+    free(world);
+    memAdd(MEM_POSES, tracksBytes(t));
+    return 1;
+}
+
+void freeTracks(Tracks* t)
+{
+    if(t->pos)
+        memAdd(MEM_POSES, -tracksBytes(t));
+    free(t->path);
+    free(t->names);
+    free(t->pos);
+    memset(t, 0, sizeof(Tracks));
+}
+
+// **********************************************************************
+//  Compilacao
+// **********************************************************************
+
+enum { T_END, T_NUM, T_IDENT, T_OP };
+
+typedef struct {
+    const char* start;
+    const char* s;       // proximo caractere
+    const char* tokPos;  // inicio do token atual
+    int tok;
+    char text[64];
+    float num;
+    Query* q;
+    char* err;
+    int errSize;
+    int failed;
+} Parser;
+
+static void fail(Parser* p, const char* fmt, ...)
+{
+    if(p->failed)
+        return;
+    p->failed = 1;
+    char msg[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    if(p->err)
+        snprintf(p->err, p->errSize, "%s (coluna %d)", msg, (int) (p->tokPos - p->start) + 1);
+}
+
+static int isIdent(int c)
+{
+    return isalnum(c) || c == '_' || c == ':';
+}
+
+static void next(Parser* p)
+{
+    static const char* ops2[] = { "<=", ">=", "==", "!=", "&&", "||" };
+    while(isspace((unsigned char) *p->s))
+        p->s++;
+    const char* s = p->s;
+    p->tokPos = s;
+    if(!*s) {
+        p->tok = T_END;
+        strcpy(p->text, "fim");
+        return;
+    }
+    if(isdigit((unsigned char) *s) || (*s == '.' && isdigit((unsigned char) s[1]))) {
+        char* end;
+        p->num = strtof(s, &end);
+        p->tok = T_NUM;
+        snprintf(p->text, sizeof(p->text), "%.*s", (int) (end - s), s);
+        p->s = end;
+        return;
+    }
+    if(isIdent((unsigned char) *s)) {
+        int len = 0;
+        while(isIdent((unsigned char) s[len]))
+            len++;
+        snprintf(p->text, sizeof(p->text), "%.*s", len, s);
+        p->s = s + len;
+        p->tok = T_IDENT;
+        // Operadores por extenso
+        if(!strcmp(p->text, "and")) strcpy(p->text, "&&");
+        else if(!strcmp(p->text, "or")) strcpy(p->text, "||");
+        else if(!strcmp(p->text, "not")) strcpy(p->text, "!");
+        else return;
+        p->tok = T_OP;
+        return;
+    }
+    p->tok = T_OP;
+    for(int i=0; i<6; i++)
+        if(!strncmp(s, ops2[i], 2)) {
+            strcpy(p->text, ops2[i]);
+            p->s = s + 2;
+            return;
+        }
+    if(!strchr("<>+-*/(),.!", *s)) {
+        fail(p, "caractere inesperado '%c'", *s);
+        p->tok = T_END;
+        return;
+    }
+    p->text[0] = *s;
+    p->text[1] = 0;
+    p->s = s + 1;
+}
+
+// Consome o operador op, se for o token atual
+static int accept(Parser* p, const char* op)
+{
+    if(p->tok != T_OP || strcmp(p->text, op))
+        return 0;
+    next(p);
+    return 1;
+}
+
+static void expect(Parser* p, const char* op)
+{
+    if(!accept(p, op))
+        fail(p, "esperado '%s' e nao '%s'", op, p->text);
+}
+
+static void emit(Parser* p, int code, int dst, int a, int b)
+{
+    if(p->q->numOps == QUERY_MAX_OPS || dst >= QUERY_REGS) {
+        fail(p, "expressao muito grande");
+        return;
+    }
+    QueryOp* op = &p->q->ops[p->q->numOps++];
+    memset(op, 0, sizeof(QueryOp));
+    op->code = code;
+    op->dst = dst;
+    op->a = a;
+    op->b = b;
+}
+
+// Nome de junta -> indice em Query.joints
+static int parseJoint(Parser* p)
+{
+    Query* q = p->q;
+    if(p->tok != T_IDENT) {
+        fail(p, "esperado nome de junta e nao '%s'", p->text);
+        return 0;
+    }
+    int j;
+    for(j=0; j<q->numJoints; j++)
+        if(!strcmp(q->joints[j], p->text))
+            break;
+    if(j == q->numJoints) {
+        if(j == QUERY_MAX_JOINTS || strlen(p->text) >= sizeof(q->joints[0])) {
+            fail(p, j == QUERY_MAX_JOINTS ? "juntas demais" : "nome de junta longo");
+            return 0;
+        }
+        strcpy(q->joints[q->numJoints++], p->text);
+    }
+    next(p);
+    return j;
+}
+
+static void parseOr(Parser* p, int r);
+
+static void parseAtom(Parser* p, int r)
+{
+    static const struct { const char* name; int code, axis; } fields[] = {
+        { "x", OP_POS, 0 }, { "y", OP_POS, 1 }, { "z", OP_POS, 2 },
+        { "vx", OP_VEL, 0 }, { "vy", OP_VEL, 1 }, { "vz", OP_VEL, 2 },
+        { "speed", OP_SPEED, 0 }, { "hspeed", OP_HSPEED, 0 },
+    };
+    if(p->failed)
+        return;
+    if(p->tok == T_NUM) {
+        emit(p, OP_CONST, r, 0, 0);
+        if(!p->failed)
+            p->q->ops[p->q->numOps-1].k = p->num;
+        next(p);
+        return;
+    }
+    if(accept(p, "(")) {
+        parseOr(p, r);
+        expect(p, ")");
+        return;
+    }
+    if(p->tok != T_IDENT) {
+        fail(p, "inesperado '%s'", p->text);
+        return;
+    }
+
+    // Funcoes
+    if(p->s[strspn(p->s, " \t")] == '(') {
+        if(!strcmp(p->text, "abs")) {
+            next(p);
+            expect(p, "(");
+            parseOr(p, r);
+            expect(p, ")");
+            emit(p, OP_ABS, r, r, 0);
+        }
+        else if(!strcmp(p->text, "dist")) {
+            next(p);
+            expect(p, "(");
+            int a = parseJoint(p);
+            expect(p, ",");
+            int b = parseJoint(p);
+            expect(p, ")");
+            emit(p, OP_DIST, r, 0, 0);
+            if(!p->failed) {
+                p->q->ops[p->q->numOps-1].joint = a;
+                p->q->ops[p->q->numOps-1].joint2 = b;
+            }
+        }
+        else
+            fail(p, "funcao desconhecida '%s'", p->text);
+        return;
+    }
+
+    // junta.campo
+    int j = parseJoint(p);
+    expect(p, ".");
+    if(p->failed)
+        return;
+    for(int i=0; i<(int) (sizeof(fields)/sizeof(fields[0])); i++)
+        if(p->tok == T_IDENT && !strcmp(p->text, fields[i].name)) {
+            emit(p, fields[i].code, r, 0, 0);
+            if(!p->failed) {
+                p->q->ops[p->q->numOps-1].joint = j;
+                p->q->ops[p->q->numOps-1].axis = fields[i].axis;
+            }
+            next(p);
+            return;
+        }
+    fail(p, "campo desconhecido '%s' (x, y, z, vx, vy, vz, speed, hspeed)", p->text);
+}
+
+static void parseUnary(Parser* p, int r)
+{
+    if(accept(p, "-")) {
+        parseUnary(p, r);
+        emit(p, OP_NEG, r, r, 0);
+    }
+    else
+        parseAtom(p, r);
+}
+
+static void parseProd(Parser* p, int r)
+{
+    parseUnary(p, r);
+    while(!p->failed) {
+        int code;
+        if(accept(p, "*")) code = OP_MUL;
+        else if(accept(p, "/")) code = OP_DIV;
+        else break;
+        parseUnary(p, r+1);
+        emit(p, code, r, r, r+1);
+    }
+}
+
+static void parseSum(Parser* p, int r)
+{
+    parseProd(p, r);
+    while(!p->failed) {
+        int code;
+        if(accept(p, "+")) code = OP_ADD;
+        else if(accept(p, "-")) code = OP_SUB;
+        else break;
+        parseProd(p, r+1);
+        emit(p, code, r, r, r+1);
+    }
+}
+
+static void parseCmp(Parser* p, int r)
+{
+    static const struct { const char* op; int code; } cmps[] = {
+        { "<=", OP_LE }, { ">=", OP_GE }, { "<", OP_LT }, { ">", OP_GT },
+        { "==", OP_EQ }, { "!=", OP_NE },
+    };
+    parseSum(p, r);
+    for(int i=0; i<6 && !p->failed; i++)
+        if(accept(p, cmps[i].op)) {
+            parseSum(p, r+1);
+            emit(p, cmps[i].code, r, r, r+1);
+            return;
+        }
+}
+
+static void parseNot(Parser* p, int r)
+{
+    if(accept(p, "!")) {
+        parseNot(p, r);
+        emit(p, OP_NOT, r, r, 0);
+    }
+    else
+        parseCmp(p, r);
+}
+
+static void parseAnd(Parser* p, int r)
+{
+    parseNot(p, r);
+    while(!p->failed && accept(p, "&&")) {
+        parseNot(p, r+1);
+        emit(p, OP_AND, r, r, r+1);
+    }
+}
+
+static void parseOr(Parser* p, int r)
+{
+    parseAnd(p, r);
+    while(!p->failed && accept(p, "||")) {
+        parseAnd(p, r+1);
+        emit(p, OP_OR, r, r, r+1);
+    }
+}
+
+// **********************************************************************
+//  Compila expr. Em erro retorna NULL e descreve o erro em err
+// **********************************************************************
+Query* queryCompile(const char* expr, char* err, int errSize)
+{
+    Parser p;
+    memset(&p, 0, sizeof(p));
+    p.start = p.s = expr;
+    p.err = err;
+    p.errSize = errSize;
+    p.q = calloc(1, sizeof(Query));
+    next(&p);
+    parseOr(&p, 0);
+    if(!p.failed && p.tok != T_END)
+        fail(&p, "inesperado '%s'", p.text);
+    if(p.failed) {
+        free(p.q);
+        return NULL;
+    }
+    return p.q;
+}
+
+void queryFree(Query* q)
+{
+    free(q);
+}
+
+// **********************************************************************
+//  Execucao
+// **********************************************************************
+
+static const float* column(Tracks* t, int node, int axis)
+{
+    return t->pos + ((size_t) node*3 + axis) * t->numFrames;
+}
+
+// Velocidade de uma coordenada nos frames f0..f0+n-1; o frame 0 repete
+// a do frame 1
+static void velocity(const float* restrict c, int f0, int n, float inv, float* restrict r)
+{
+    int s = f0 == 0;
+    for(int i=s; i<n; i++)
+        r[i] = (c[f0+i] - c[f0+i-1]) * inv;
+    if(s)
+        r[0] = n > 1 ? r[1] : 0;
+}
+
+static void runOp(QueryOp* op, Tracks* t, const int* node, int f0, int n, float inv,
+                  float (*regs)[QUERY_BLOCK])
+{
+    // Sem restrict: dst e a sao o mesmo registrador nas operacoes
+    // aritmeticas (cada laco le a[i] antes de gravar r[i])
+    float* r = regs[op->dst];
+    const float* a = regs[op->a];
+    const float* b = regs[op->b];
+    float vx[QUERY_BLOCK], vy[QUERY_BLOCK], vz[QUERY_BLOCK];
+    int j = node[op->joint];
+
+    switch(op->code) {
+    case OP_CONST:
+        for(int i=0; i<n; i++) r[i] = op->k;
+        break;
+    case OP_POS:
+        memcpy(r, column(t, j, op->axis) + f0, n * sizeof(float));
+        break;
+    case OP_VEL:
+        velocity(column(t, j, op->axis), f0, n, inv, r);
+        break;
+    case OP_SPEED:
+    case OP_HSPEED:
+        velocity(column(t, j, 0), f0, n, inv, vx);
+        velocity(column(t, j, 2), f0, n, inv, vz);
+        if(op->code == OP_SPEED) {
+            velocity(column(t, j, 1), f0, n, inv, vy);
+            for(int i=0; i<n; i++) r[i] = sqrtf(vx[i]*vx[i] + vy[i]*vy[i] + vz[i]*vz[i]);
+        }
+        else
+            for(int i=0; i<n; i++) r[i] = sqrtf(vx[i]*vx[i] + vz[i]*vz[i]);
+        break;
+    case OP_DIST: {
+        int k = node[op->joint2];
+        const float* restrict ax = column(t, j, 0) + f0;
+        const float* restrict ay = column(t, j, 1) + f0;
+        const float* restrict az = column(t, j, 2) + f0;
+        const float* restrict bx = column(t, k, 0) + f0;
+        const float* restrict by = column(t, k, 1) + f0;
+        const float* restrict bz = column(t, k, 2) + f0;
+        for(int i=0; i<n; i++) {
+            float dx = ax[i] - bx[i], dy = ay[i] - by[i], dz = az[i] - bz[i];
+            r[i] = sqrtf(dx*dx + dy*dy + dz*dz);
+        }
+        break;
+    }
+    case OP_NEG: for(int i=0; i<n; i++) r[i] = -a[i]; break;
+    case OP_ABS: for(int i=0; i<n; i++) r[i] = fabsf(a[i]); break;
+    case OP_ADD: for(int i=0; i<n; i++) r[i] = a[i] + b[i]; break;
+    case OP_SUB: for(int i=0; i<n; i++) r[i] = a[i] - b[i]; break;
+    case OP_MUL: for(int i=0; i<n; i++) r[i] = a[i] * b[i]; break;
+    case OP_DIV: for(int i=0; i<n; i++) r[i] = a[i] / b[i]; break;
+    case OP_LT:  for(int i=0; i<n; i++) r[i] = a[i] < b[i]; break;
+    case OP_LE:  for(int i=0; i<n; i++) r[i] = a[i] <= b[i]; break;
+    case OP_GT:  for(int i=0; i<n; i++) r[i] = a[i] > b[i]; break;
+    case OP_GE:  for(int i=0; i<n; i++) r[i] = a[i] >= b[i]; break;
+    case OP_EQ:  for(int i=0; i<n; i++) r[i] = a[i] == b[i]; break;
+    case OP_NE:  for(int i=0; i<n; i++) r[i] = a[i] != b[i]; break;
+    case OP_AND: for(int i=0; i<n; i++) r[i] = (a[i] != 0) & (b[i] != 0); break;
+    case OP_OR:  for(int i=0; i<n; i++) r[i] = (a[i] != 0) | (b[i] != 0); break;
+    case OP_NOT: for(int i=0; i<n; i++) r[i] = a[i] == 0; break;
+    }
+}
+
+static int findNode(Tracks* t, const char* name)
+{
+    if(!strcmp(name, "root"))
+        return t->numNodes > 0 ? 0 : -1;
+    for(int i=0; i<t->numNodes; i++)
+        if(!strcmp(t->names[i], name))
+            return i;
+    return -1;
+}
+
+// **********************************************************************
+//  Avalia q sobre todos os frames de t. ranges recebe as faixas em que
+//  a expressao e verdadeira (liberar com free). Retorna a quantidade de
+//  faixas, ou -1 se o clip nao tem alguma das juntas citadas
+//  Pode ser chamada por varias threads com a mesma Query
+// **********************************************************************
+int queryRun(Query* q, Tracks* t, FrameRange** ranges)
+{
+    int node[QUERY_MAX_JOINTS] = { 0 };
+    float regs[QUERY_REGS][QUERY_BLOCK];
+    float inv = t->frameTime > 0 ? 1 / t->frameTime : 0;
+    FrameRange* out = NULL;
+    int num = 0, cap = 0, open = -1;
+
+    *ranges = NULL;
+    for(int j=0; j<q->numJoints; j++)
+        if((node[j] = findNode(t, q->joints[j])) < 0)
+            return -1;
+
+    for(int f0=0; f0<t->numFrames; f0+=QUERY_BLOCK) {
+        int n = t->numFrames - f0 < QUERY_BLOCK ? t->numFrames - f0 : QUERY_BLOCK;
+        for(int i=0; i<q->numOps; i++)
+            runOp(&q->ops[i], t, node, f0, n, inv, regs);
+        // Bordas das faixas
+        const float* m = regs[0];
+        for(int i=0; i<n; i++) {
+            if((m[i] != 0) == (open >= 0))
+                continue;
+            if(open < 0) {
+                open = f0 + i;
+                continue;
+            }
+            if(num == cap) {
+                cap = cap ? cap*2 : 16;
+                out = realloc(out, cap * sizeof(FrameRange));
+            }
+            out[num].first = open;
+            out[num++].last = f0 + i - 1;
+            open = -1;
+        }
+    }
+    if(open >= 0) {
+        if(num == cap)
+            out = realloc(out, (cap + 1) * sizeof(FrameRange));
+        out[num].first = open;
+        out[num++].last = t->numFrames - 1;
+    }
+    *ranges = out;
+    return num;
+}
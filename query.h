@@ -0,0 +1,46 @@
+// **********************************************************************
+//	query.h
+//  Consultas sobre as posicoes globais das juntas, pre-calculadas (FK)
+//  em colunas: predicados como "LeftHand.y > Head.y" ou
+//  "root.hspeed > 300" sao compilados em um programa de operacoes
+//  sobre blocos de frames e devolvem as faixas de frames que os
+//  satisfazem
+// **********************************************************************
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "bvh.h"
+
+#define QUERY_BLOCK 512      // frames avaliados por vez
+#define QUERY_REGS 16        // registradores (profundidade da expressao)
+#define QUERY_MAX_OPS 128
+#define QUERY_MAX_JOINTS 32  // juntas distintas citadas na expressao
+
+// Posicoes globais de um clip, por colunas: a coordenada eixo (0..2)
+// da junta i esta em pos + (i*3 + eixo) * numFrames
+typedef struct {
+    char* path;
+    int numNodes;
+    int numFrames;
+    float frameTime;
+    char (*names)[20];
+    float* pos;
+} Tracks;
+
+// Faixa de frames, inclusiva
+typedef struct {
+    int first;
+    int last;
+} FrameRange;
+
+typedef struct Query Query;
+
+int bakeTracks(Clip* clip, Tracks* t);
+void freeTracks(Tracks* t);
+
+Query* queryCompile(const char* expr, char* err, int errSize);
+int queryRun(Query* q, Tracks* t, FrameRange** ranges);
+void queryFree(Query* q);
+
+#endif
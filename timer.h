@@ -0,0 +1,32 @@
+// **********************************************************************
+//	timer.h
+//  Relogio monotonico de alta resolucao
+// **********************************************************************
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Tempo monotonico em milissegundos
+static inline double timerNow()
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if(!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double) t.QuadPart * 1000.0 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+#endif
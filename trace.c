@@ -0,0 +1,149 @@
+// **********************************************************************
+//	trace.c
+//  Cada thread grava seus eventos em um buffer circular proprio, sem
+//  travas: so a thread dona escreve, e o indice de escrita e publicado
+//  com uma operacao atomica. Os buffers ficam numa lista ligada global
+//  inserida por CAS, percorrida por traceDump()
+// **********************************************************************
+
+#ifndef BVH_NO_TRACE
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "timer.h"
+
+// Eventos guardados por thread (os mais antigos sao sobrescritos)
+#define TRACE_CAPACITY (1 << 15)
+// Profundidade maxima de escopos aninhados
+#define TRACE_DEPTH 64
+
+typedef struct {
+    const char* name;
+    double ts;           // inicio (us)
+    double dur;          // duracao (us)
+} TraceEvent;
+
+typedef struct TraceBuffer TraceBuffer;
+
+struct TraceBuffer {
+    TraceEvent events[TRACE_CAPACITY];
+    atomic_ullong head;          // total de eventos ja escritos
+    int tid;
+    char threadName[32];
+    double stack[TRACE_DEPTH];   // inicio dos escopos abertos
+    const char* names[TRACE_DEPTH];
+    int depth;
+    TraceBuffer* next;
+};
+
+static _Atomic(TraceBuffer*) buffers = NULL;
+static atomic_int nextTid = 1;
+static _Thread_local TraceBuffer* local = NULL;
+static atomic_int exitHandler = 0;
+static char exitFile[4096] = TRACE_FILE;
+
+// Tempo em microssegundos, como pede o formato
+static double traceNow()
+{
+    return timerNow() * 1000.0;
+}
+
+static void traceAtExit()
+{
+    traceDump(exitFile);
+}
+
+// Arquivo gravado na saida do processo (TRACE_FILE se nao for chamada)
+void traceSetFile(const char* fileName)
+{
+    snprintf(exitFile, sizeof(exitFile), "%s", fileName);
+}
+
+// **********************************************************************
+//  Cria o buffer da thread atual e o insere na lista global
+//  Na primeira chamada do processo, agenda o traceDump() na saida
+// **********************************************************************
+void traceInit(const char* threadName)
+{
+    if(!local) {
+        TraceBuffer* buf = calloc(1, sizeof(TraceBuffer));
+        if(!buf)
+            return;
+        buf->tid = atomic_fetch_add(&nextTid, 1);
+        TraceBuffer* first = atomic_load(&buffers);
+        do {
+            buf->next = first;
+        } while(!atomic_compare_exchange_weak(&buffers, &first, buf));
+        local = buf;
+    }
+    if(threadName)
+        snprintf(local->threadName, sizeof(local->threadName), "%s", threadName);
+    else if(!local->threadName[0])
+        snprintf(local->threadName, sizeof(local->threadName), "thread %d", local->tid);
+
+    if(!atomic_exchange(&exitHandler, 1))
+        atexit(traceAtExit);
+}
+
+// Threads que nao chamaram traceInit() nao sao registradas
+void traceBegin(const char* name)
+{
+    if(!local || local->depth >= TRACE_DEPTH)
+        return;
+    local->names[local->depth] = name;
+    local->stack[local->depth++] = traceNow();
+}
+
+void traceEnd()
+{
+    if(!local || local->depth == 0)
+        return;
+    local->depth--;
+    unsigned long long h = atomic_load_explicit(&local->head, memory_order_relaxed);
+    TraceEvent* ev = &local->events[h % TRACE_CAPACITY];
+    ev->name = local->names[local->depth];
+    ev->ts = local->stack[local->depth];
+    ev->dur = traceNow() - ev->ts;
+    atomic_store_explicit(&local->head, h + 1, memory_order_release);
+}
+
+// **********************************************************************
+//  Grava todos os buffers em fileName no formato JSON de eventos
+//  Pode ser chamada a qualquer momento, de qualquer thread; eventos
+//  sobrescritos durante a copia podem sair inconsistentes
+//  Retorna o total de eventos gravados, ou -1 em caso de erro
+// **********************************************************************
+int traceDump(const char* fileName)
+{
+    FILE* fp = fopen(fileName ? fileName : TRACE_FILE, "w");
+    if(!fp)
+        return -1;
+
+    int total = 0;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for(TraceBuffer* buf = atomic_load(&buffers); buf; buf = buf->next) {
+        unsigned long long head = atomic_load_explicit(&buf->head, memory_order_acquire);
+        unsigned long long first = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                total ? ",\n" : "", buf->tid, buf->threadName);
+        total++;
+        for(unsigned long long i=first; i<head; i++) {
+            TraceEvent* ev = &buf->events[i % TRACE_CAPACITY];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    ev->name, buf->tid, ev->ts, ev->dur);
+            total++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return total;
+}
+
+#endif
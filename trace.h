@@ -0,0 +1,36 @@
+// **********************************************************************
+//	trace.h
+//  Marcadores de trace por escopo, exportados no formato JSON de
+//  eventos do Chrome (chrome://tracing, ui.perfetto.dev)
+//  Compilar com -DBVH_NO_TRACE remove toda a instrumentacao
+// **********************************************************************
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Arquivo gerado por traceDump() quando nenhum outro e informado
+#define TRACE_FILE "trace.json"
+
+#ifndef BVH_NO_TRACE
+
+void traceInit(const char* threadName);
+void traceSetFile(const char* fileName);
+void traceBegin(const char* name);
+void traceEnd();
+int traceDump(const char* fileName);
+
+// 'name' deve ser uma string constante (so o ponteiro e guardado)
+#define TRACE_BEGIN(name)   traceBegin(name)
+#define TRACE_END()         traceEnd()
+
+#else
+
+#define traceInit(threadName)
+#define traceSetFile(fileName)
+#define traceDump(fileName) 0
+#define TRACE_BEGIN(name)
+#define TRACE_END()
+
+#endif
+
+#endif